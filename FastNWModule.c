@@ -24,13 +24,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
-#include <float.h>
-
-__inline int mymax(int a, int b) {
-  return a > b ? a : b;
-}
-
-typedef enum {false, true} bool;
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "fastnw_internal.h"
 
 typedef struct {
 	char *shorter;
@@ -39,1055 +37,1572 @@ typedef struct {
 	int mismatch;
 	int gap;
 	int gap_extend;
+	Engine engine;
 	bool switched;
+	bool profile;
+	size_t max_memory;
+	int min_score;
 } Arguments;
 
 const Arguments FAILED = {
-	NULL, NULL, 0, 0, 0, 0, false
+	NULL, NULL, 0, 0, 0, 0, FASTNW_DYNAMIC, false, false, 0, INT_MIN
 };
 
-typedef struct {
-	int score;
-	char *align1;
-	char *align2;
-} Alignment;
+/*********************** Module state ***********************
+* Everything a module object owns lives here rather than in globals,
+* so Python 3 can load the module in several interpreters and run it
+* without the GIL. Python 2 modules have no state of their own, so
+* the one module there uses a static instance.
+*/
 
-typedef struct {
+//a call of one of the *_async methods
+typedef struct Job {
+	Method method;
+	Arguments arguments;
+	PyObject *args; //owns the strings in arguments
+	PyObject *kwds;
+	PyObject *future; //cleared once the result is in
+	PyObject *capsule; //the job as a python object, referenced while queued
+	volatile int cancel; //set when the future is cancelled
+
+	//results
+	Profile profile;
 	int score;
-	size_t index;
-} HirschReturn;
+	Alignment alignment;
 
-const HirschReturn NEED_MEM = {
-	0, -1
-};
+	struct Job *next;
+} Job;
 
 typedef struct {
-	int *cur;
-	int *cur_right;
-	int *cur_down;
-} ScoreReturn;
-
-const ScoreReturn NO_MEM = {
-	0, NULL, NULL
-};
-
-typedef enum {NONE, DOWN, RIGHT, ANY} Direction;
+	struct ModuleState *state;
+	pthread_t id;
+	Job *job; //running, if any
+} Worker;
 
+//native threads running the *_async methods, started by the first one
 typedef struct {
-	int index;
-	Direction left;
-	Direction right;
-} PartitionReturn;
-
-//for quickly counting a Needleman Wunsch _score_
-//returns a ScoreReturn object that must be freed after use
-//returning entire bottom row allows use in Partition
-ScoreReturn Score(const char *horizontal, size_t hl, size_t hr,
-	const char *vertical, size_t vl, size_t vr,
-	int match, int mismatch, int gap, int gap_extend,
-	Direction start_direction) {
-
-	//dimensions of matrix
-	size_t width = hr-hl+1;
-	size_t height = vr-vl+1;
-
-	//loop variables
-	size_t i;
-	size_t j;
-
-	//return value
-	ScoreReturn ret;
-
-	//current and previous row given not in a gap, in a down gap, and in a right gap
-	int *cur = malloc(width*sizeof(int));
-	int *prev = malloc(width*sizeof(int));
-	int *cur_right = malloc(width*sizeof(int));
-	int *prev_right = malloc(width*sizeof(int));
-	int *cur_down = malloc(width*sizeof(int));
-	int *prev_down = malloc(width*sizeof(int));
-	int *temp; //for switching cur and prev
-
-
-	/******************** Check Memory ***********************/
-	if (cur==NULL || prev==NULL || cur_right==NULL
-		|| prev_right==NULL || cur_down==NULL || prev_down==NULL) {
-
-		free(cur);
-		free(prev);
-		free(cur_right);
-		free(prev_right);
-		free(cur_down);
-		free(prev_down);
-		return NO_MEM;
-	}
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	Job *first; //queued
+	Job *last;
+	Worker *workers;
+	int worker_count;
+	bool stopping;
+	PyInterpreterState *interpreter;
+} Pool;
+
+typedef struct ModuleState {
+	Cache cache; //results of earlier calls, off until set_cache gives it a budget
+	Pool pool;
+} ModuleState;
+
+#if PY_MAJOR_VERSION >= 3
+static ModuleState *GetState(PyObject *module) {
+	return (ModuleState *)PyModule_GetState(module);
+}
+#else
+static ModuleState python2_state;
+
+static ModuleState *GetState(PyObject *module) {
+	return &python2_state;
+}
+#endif
+
+//a str (or bytes) argument as characters, NULL with a python error if
+//it is neither. The characters belong to the object
+const char *StringData(PyObject *object, Py_ssize_t *length) {
+	char *ret;
+
+#if PY_MAJOR_VERSION >= 3
+	if (PyUnicode_Check(object))
+		return PyUnicode_AsUTF8AndSize(object, length);
+#endif
+	if (PyBytes_AsStringAndSize(object, &ret, length) < 0)
+		return NULL;
+	return ret;
+}
 
-	/*************** Initial assignment of cur ***************/
-	cur[0] = 0;
-	cur_right[0] = INT_MIN/4;
-	cur_down[0] = INT_MIN/4;
-	for (i=1; i<width; i++) {
-		cur[i] = INT_MIN/4;
-		cur_right[i] = mymax(cur[i-1] + gap, cur_right[i-1] + gap_extend);
-		cur_down[i] = INT_MIN/4;
+//interprets the engine keyword, setting a python error if unknown
+bool GetEngine(const char *name, Engine *engine) {
+	if (strcmp(name, "dp") == 0) {
+		*engine = FASTNW_DYNAMIC;
+	} else if (strcmp(name, "wfa") == 0) {
+		*engine = FASTNW_WAVEFRONT;
+	} else if (strcmp(name, "band") == 0) {
+		*engine = FASTNW_BANDED;
+	} else if (strcmp(name, "russians") == 0) {
+		*engine = FASTNW_FOUR_RUSSIANS;
+	} else {
+		PyErr_SetString(PyExc_ValueError, "engine must be 'dp', 'wfa', 'band' or 'russians'");
+		return false;
 	}
+	return true;
+}
 
-	/******** Second row depends on start_direction **********/
-	if (height > 1) {
-		temp = prev;
-		prev = cur;
-		cur = temp;
-
-		temp = prev_down;
-		prev_down = cur_down;
-		cur_down = temp;
-
-		temp = prev_right;
-		prev_right = cur_right;
-		cur_right = temp;
-
-		cur[0] = INT_MIN/4;
-		cur_right[0] = INT_MIN/4;
-		switch (start_direction) {
-			case NONE : //cant use prev_right or cur_down
-				cur_down[0] = INT_MIN/4;
-				for (i=1; i<width; i++) {
-					if (horizontal[hl+i-1] == vertical[vl])
-						cur[i] = prev[i-1]+match;
-					else
-						cur[i] = prev[i-1]+mismatch;
-					cur_right[i] = mymax(cur[i-1] + gap, cur_right[i-1] + gap_extend);
-					cur_down[i] = INT_MIN/4;
-				}
-				break;
-			case DOWN : //can only use cur_down
-				cur_down[0] = gap;
-				for (i=1; i<width; i++) {
-					cur[i] = INT_MIN/4;
-					cur_right[i] = INT_MIN/4;
-					cur_down[i] = INT_MIN/4;
-				}
-				break;
-			case RIGHT : //cant use prev or cur_down
-				cur_down[0] = INT_MIN/4;
-				for (i=1; i<width; i++) {
-					if (horizontal[hl+i-1] == vertical[vl])
-						cur[i] = prev_right[i-1]+match;
-					else
-						cur[i] = prev_right[i-1]+mismatch;
-					cur_right[i] = mymax(cur[i-1] + gap, cur_right[i-1] + gap_extend);
-					cur_down[i] = INT_MIN/4;
-				}
-				break;
-			case ANY : //can use arrays as normal
-				cur_down[0] = gap;
-				for (i=1; i<width; i++) {
-					if (horizontal[hl+i-1] == vertical[vl])
-						cur[i] = mymax(prev[i-1], prev_right[i-1])+match;
-					else
-						cur[i] = mymax(prev[i-1], prev_right[i-1])+mismatch;
-					cur_right[i] = mymax(cur[i-1] + gap, cur_right[i-1] + gap_extend);
-					cur_down[i] = INT_MIN/4;
-				}
-				break;
-			default :
-				printf("ERROR: Initial direction error\n");
-				break;
-		}
+//interprets python arguments
+Arguments GetArguments(PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"string1", "string2", "match", "mismatch",
+		"gap", "gap_extend", "engine", "profile", "max_memory", "min_score", NULL};
+	char *temp; //for switching longer and shorter
+	char *engine = "dp";
+	int profile = 0;
+	Py_ssize_t max_memory = 0;
+	Arguments arguments; //return value
+	arguments.gap_extend = INT_MIN;
+	arguments.min_score = INT_MIN;
+	
+	//parse python args
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "ssiii|isini", kwlist,
+		&arguments.shorter, &arguments.longer, &arguments.match,
+		&arguments.mismatch, &arguments.gap, &arguments.gap_extend, &engine,
+		&profile, &max_memory, &arguments.min_score))
+		return FAILED;
+	arguments.profile = (profile != 0);
+	if (max_memory < 0) {
+		PyErr_SetString(PyExc_ValueError, "max_memory must not be negative");
+		return FAILED;
 	}
+	arguments.max_memory = max_memory;
 
-	/***************** Assign rest of matrix *****************/
-	for (j=2; j<height; j++) {
-		//current becomes previous
-		temp = prev;
-		prev = cur;
-		cur = temp;
-
-		temp = prev_down;
-		prev_down = cur_down;
-		cur_down = temp;
-
-		temp = prev_right;
-		prev_right = cur_right;
-		cur_right = temp;
-
-		cur[0] = INT_MIN/4;
-		cur_right[0] = INT_MIN/4;
-		cur_down[0] = mymax(prev[0]+gap, prev_down[0]+gap_extend);
-
-		//calculate current row
-		for (i=1; i<width; i++) {
-			
-			//calculate score after diagonal path
-			if (horizontal[hl+i-1] == vertical[vl+j-1]) {
-				cur[i] = mymax(prev[i-1], mymax(prev_right[i-1], prev_down[i-1])) + match;
-			} else {
-				cur[i] = mymax(prev[i-1], mymax(prev_right[i-1], prev_down[i-1])) + mismatch;
-			}
+	if (!GetEngine(engine, &arguments.engine))
+		return FAILED;
 
-			//calculate score after downward path
-			cur_down[i] = mymax(prev[i] + gap, prev_down[i] + gap_extend);
+	//find shorter and longer inputs
+	if (arguments.switched = (strlen(arguments.shorter) > strlen(arguments.longer))) {
+		temp = arguments.shorter;
+		arguments.shorter = arguments.longer;
+		arguments.longer = temp;
+	}
 
-			//calculate score after rightward path
-			cur_right[i] = mymax(cur[i-1] + gap, cur_right[i-1] + gap_extend);
-		}
+	//if gap_extend isn't specified, must be equal to gap
+	if (arguments.gap_extend == INT_MIN) {
+		arguments.gap_extend = arguments.gap;
 	}
 
-	free(prev);
-	free(prev_right);
-	free(prev_down);
+	return arguments;
+}
 
-	ret.cur = cur;
-	ret.cur_right = cur_right;
-	ret.cur_down = cur_down;
+//pairs a result with its profile as a dict when one was asked for.
+//steals the reference to result
+PyObject *Profiled(PyObject *result, const Profile *profile, bool wanted) {
+	PyObject *ret;
+
+	if (!wanted || result == NULL)
+		return result;
+
+	ret = Py_BuildValue("(N,{s:L,s:L,s:l,s:l,s:i,s:n,s:n,"
+		"s:d,s:d,s:d,s:d,s:d,s:d,s:s})", result,
+		"score_cells", profile->score_cells,
+		"leaf_cells", profile->leaf_cells,
+		"nodes", profile->nodes,
+		"leaves", profile->leaves,
+		"depth", profile->depth,
+		"allocated", (Py_ssize_t)profile->allocated,
+		"peak", (Py_ssize_t)profile->peak,
+		"forward", profile->forward,
+		"reverse", profile->reverse,
+		"partition", profile->partition,
+		"fill", profile->fill,
+		"traceback", profile->traceback,
+		"total", profile->total,
+		"kernel", profile->kernel);
 
 	return ret;
 }
 
-//Full Needleman Wunsch algorithm, with added capability
-//for starting and ending requirements (allowing it to be used with Hirsch)
-HirschReturn NeedlemanWunsch(char *Z, char *W, size_t Z_spot,
-	const char *horizontal, size_t hl, size_t hr,
-	const char *vertical, size_t vl, size_t vr,
-	int match, int mismatch, int gap, int gap_extend,
-	Direction start_direction, Direction end_direction) {
+//whether a call goes through the cache. Profiled calls always do the
+//work, so there is something to profile
+bool Cacheable(Cache *cache, Arguments arguments) {
+	return !arguments.profile && CacheEnabled(cache);
+}
 
-	//for indexing
-	size_t i;
-	size_t j;
-
-	//matrix dimensions
-	size_t width = hr-hl+1;
-	size_t height = vr-vl+1;
-
-	//temporary calculations
-	int from;
-	int from_right;
-	int from_down;
-
-	//score matrix
-	int *mat = malloc(width*height*sizeof(int));
-	int *mat_right = malloc(width*height*sizeof(int));
-	int *mat_down = malloc(width*height*sizeof(int));
-
-	//0=none, 1=right, 2=down
-	int trace;
-	int *mat_dir = malloc(width*height*sizeof(int));
-	int *mat_right_dir = malloc(width*height*sizeof(int));
-	int *mat_down_dir = malloc(width*height*sizeof(int));
-
-	//backwards alignments
-	size_t rev_spot;
-	char *rev_Z = malloc((width+height)*sizeof(char));
-	char *rev_W = malloc((width+height)*sizeof(char));
-
-	HirschReturn ret;
-
-	if (mat==NULL || mat_right==NULL || mat_down==NULL
-		|| mat_dir==NULL || mat_right_dir==NULL || mat_down_dir==NULL
-		|| rev_Z==NULL || rev_W==NULL) {
-
-		free(mat);
-		free(mat_right);
-		free(mat_down);
-		free(mat_dir);
-		free(mat_right_dir);
-		free(mat_down_dir);
-		free(rev_Z);
-		free(rev_W);
-		return NEED_MEM;
+CacheKey ArgumentsKey(Arguments arguments, Method method) {
+	return MakeCacheKey(arguments.shorter, strlen(arguments.shorter),
+		arguments.longer, strlen(arguments.longer), method, arguments.engine,
+		arguments.match, arguments.mismatch, arguments.gap, arguments.gap_extend);
+}
+
+//score of shorter against longer, from the cache if it has it and
+//cached if it did not. Touches no python objects, so it can run
+//without the GIL
+int RunScore(Cache *cache, Arguments arguments, Profile *profile,
+	const volatile int *cancel) {
+
+	CacheKey key;
+	bool cacheable = Cacheable(cache, arguments);
+	int ret;
+
+	if (cacheable) {
+		key = ArgumentsKey(arguments, FASTNW_SCORE);
+		if (CacheGet(cache, key, &ret, NULL))
+			return ret < arguments.min_score ? BELOW_MIN_SCORE : ret;
 	}
 
-/*
-	printf(horizontal);
-	printf("\n");
-	printf(vertical);
-	printf("\n");
+	ret = FastNWScore(arguments.shorter, strlen(arguments.shorter),
+		arguments.longer, strlen(arguments.longer),
+		arguments.match, arguments.mismatch, arguments.gap, arguments.gap_extend,
+		arguments.engine, arguments.max_memory, arguments.min_score,
+		arguments.profile ? profile : NULL, cancel);
+	//scores cut short by min_score are not the real score
+	if (cacheable && ret != INT_MIN && ret != BELOW_MIN_SCORE && ret != CANCELLED)
+		CachePut(cache, key, ret, NULL);
 
-	printf("width = %d\n", width);
-	printf("height = %d\n", height);
-*/
+	return ret;
+}
 
-	/********************** First row ************************/
-	mat[0] = 0;
-	mat_dir[0] = -1;
+//python value of a score, None if it was below min_score
+PyObject *ScoreResult(int score, Arguments arguments, Profile *profile) {
+	if (score == INT_MIN)
+		return PyErr_NoMemory();
+	if (score == BELOW_MIN_SCORE) {
+		Py_INCREF(Py_None);
+		return Profiled(Py_None, profile, arguments.profile);
+	}
 
-	mat_right[0] = INT_MIN/4;
-	mat_right_dir[0] = -1;
-	
-	mat_down[0] = INT_MIN/4;
-	mat_down_dir[0] = -1;
-	
-	for (i=1; i<width; i++) {
-		mat[i] = INT_MIN/4;
-		mat_dir[i] = -1;
-
-		from = mat[i-1] + gap;
-		from_right = mat_right[i-1] + gap_extend;
-		if (from > from_right) {
-			mat_right[i] = from;
-			mat_right_dir[i] = 0;
-		} else {
-			mat_right[i] = from_right;
-			mat_right_dir[i] = 1;
-		}
+	return Profiled(Py_BuildValue("i", score), profile, arguments.profile);
+}
 
-		mat_down[i] = INT_MIN/4;
-		mat_down_dir[i] = -1; //added down
+//handler for score method from python
+static PyObject * NWScore(PyObject *self, PyObject *args, PyObject *kwds) {
+	int ret;
+	Profile profile;
+	ModuleState *state = GetState(self);
+
+	Arguments arguments = GetArguments(args, kwds);
+	if (!arguments.shorter)
+		return NULL;
+
+	//the strings belong to args, which outlives the call
+	Py_BEGIN_ALLOW_THREADS
+	ret = RunScore(&state->cache, arguments, &profile, NULL);
+	Py_END_ALLOW_THREADS
+	return ScoreResult(ret, arguments, &profile);
+}
+
+//python value of an alignment: [aligned string1, aligned string2, score],
+//None if it scored below min_score
+PyObject *AlignmentResult(Alignment res, Arguments arguments, Profile *profile) {
+	PyObject *ret;
+
+	if (res.align1 == NULL && res.score == BELOW_MIN_SCORE) {
+		Py_INCREF(Py_None);
+		return Profiled(Py_None, profile, arguments.profile);
+	}
+	if (res.align1 == NULL && res.score == ENGINE_ERROR) {
+		PyErr_SetString(PyExc_RuntimeError, "alignment traceback failed");
+		return NULL;
 	}
+	if (res.align1 == NULL)
+		return PyErr_NoMemory();
 
-	/******** Second row depends on start_direction **********/
-	if (height > 1) {
-		j = width;
-
-		mat[j] = INT_MIN/4;
-		mat_dir[j] = -1;
-
-		mat_right[j] = INT_MIN/4;
-		mat_right_dir[j] = -1;
-
-		switch (start_direction) {
-			case NONE : //cant use prev_right or cur_down
-				mat_down[j] = INT_MIN/4;
-				mat_down_dir[j] = -1;
-
-				for (i=1; i<width; i++) {
-					if (horizontal[hl+i-1] == vertical[vl])
-						mat[j+i] = mat[i-1]+match;
-					else
-						mat[j+i] = mat[i-1]+mismatch;
-					mat_dir[j+i] = 0;
-
-					from = mat[j+i-1] + gap;
-					from_right = mat_right[j+i-1] + gap_extend;
-					if (from > from_right) {
-						mat_right[j+i] = from;
-						mat_right_dir[j+i] = 0;
-					} else {
-						mat_right[j+i] = from_right;
-						mat_right_dir[j+i] = 1;
-					}
-					
-					mat_down[j+i] = INT_MIN/4;
-					mat_down_dir[j+i] = -1;
-				}
-				break;
-			case DOWN : //can only use cur_down
-				//printf("Starting down\n");
-				mat_down[j] = gap;
-				mat_down_dir[j] = 0;
-
-				for (i=1; i<width; i++) {
-					mat[j+i] = INT_MIN/4;
-					mat_dir[j+i] = -1;
-
-					mat_right[j+i] = INT_MIN/4;
-					mat_right_dir[j+i] = -1;
-
-					mat_down[j+i] = INT_MIN/4;
-					mat_down_dir[j+i] = -1;
-				}
-				break;
-			case RIGHT : //cant use prev or cur_down
-				mat_down[j] = INT_MIN/4;
-				mat_down_dir[j] = -1;
-
-				for (i=1; i<width; i++) {
-					if (horizontal[hl+i-1] == vertical[vl])
-						mat[j+i] = mat_right[i-1]+match;
-					else
-						mat[j+i] = mat_right[i-1]+mismatch;
-					mat_dir[j+i] = 0;
-
-					from = mat[j+i-1] + gap;
-					from_right = mat_right[j+i-1] + gap_extend;
-					if (from > from_right) {
-						mat_right[j+i] = from;
-						mat_right_dir[j+i] = 0;
-					} else {
-						mat_right[j+i] = from_right;
-						mat_right_dir[j+i] = 1;
-					}
-					
-					mat_down[j+i] = INT_MIN/4;
-					mat_down_dir[j+i] = -1;
-				}
-				break;
-			case ANY : //can use arrays as normal
-				mat_down[j] = gap;
-				mat_down_dir[j] = 0;
-
-				for (i=1; i<width; i++) {
-					from = mat[i-1];
-					from_right = mat_right[i-1];
-					if (from > from_right) {
-						mat[j+i] = from;
-						mat_dir[j+i] = 0;
-					} else {
-						mat[j+i] = from_right;
-						mat_dir[j+i] = 1;
-					}
-					if (horizontal[hl+i-1] == vertical[vl])
-						mat[j+i] += match;
-					else
-						mat[j+i] += mismatch;
-
-					from = mat[j+i-1] + gap; //added j
-					from_right = mat_right[j+i-1] + gap_extend; //added j
-					if (from > from_right) {
-						mat_right[j+i] = from;
-						mat_right_dir[j+i] = 0;
-					} else {
-						mat_right[j+i] = from_right;
-						mat_right_dir[j+i] = 1;
-					}
-
-					mat_down[j+i] = INT_MIN/4;
-					mat_down_dir[j+i] = -1;
-				}
-				break;
-			default :
-				printf("ERROR: Initial direction error\n");
-				break;
+	if (arguments.switched)
+		ret = Py_BuildValue("[s,s,i]", res.align2, res.align1, res.score);
+	else
+		ret = Py_BuildValue("[s,s,i]", res.align1, res.align2, res.score);
+
+	FreeAlignment(res);
+
+	return Profiled(ret, profile, arguments.profile);
+}
+
+//alignment of shorter against longer by align or qalign, rebuilt from
+//its CIGAR when the cache has it and cached when it did not. Like
+//RunScore, it can run without the GIL
+Alignment RunAlignment(Cache *cache, Arguments arguments, Method method,
+	Profile *profile, const volatile int *cancel) {
+
+	Alignment res;
+	CacheKey key;
+	bool cacheable = Cacheable(cache, arguments);
+	char *cigar;
+	int score;
+
+	if (cacheable) {
+		key = ArgumentsKey(arguments, method);
+		if (CacheGet(cache, key, &score, &cigar)) {
+			if (score < arguments.min_score) {
+				res.align1 = NULL;
+				res.align2 = NULL;
+				res.score = BELOW_MIN_SCORE;
+			} else {
+				res = CigarAlignment(arguments.shorter, arguments.longer, cigar, score);
+			}
+			free(cigar);
+			return res;
 		}
 	}
 
-	/***************** Assign rest of matrix *****************/
-	for (j=2*width; j<width*height; j+=width) {
+	if (method == FASTNW_QALIGN)
+		res = FastNWQAlign(arguments.shorter, strlen(arguments.shorter),
+			arguments.longer, strlen(arguments.longer),
+			arguments.match, arguments.mismatch, arguments.gap, arguments.gap_extend,
+			arguments.max_memory, arguments.min_score,
+			arguments.profile ? profile : NULL, cancel);
+	else
+		res = FastNWAlign(arguments.shorter, strlen(arguments.shorter),
+			arguments.longer, strlen(arguments.longer),
+			arguments.match, arguments.mismatch, arguments.gap, arguments.gap_extend,
+			arguments.engine, arguments.max_memory, arguments.min_score,
+			arguments.profile ? profile : NULL, cancel);
+
+	if (cacheable && res.align1 != NULL) {
+		cigar = FastNWCigar(res);
+		if (cigar != NULL)
+			CachePut(cache, key, res.score, cigar);
+		free(cigar);
+	}
 
-		mat[j] = INT_MIN/4;
-		mat_dir[j] = -1;
+	return res;
+}
 
-		mat_right[j] = INT_MIN/4;
-		mat_right_dir[j] = -1;
+//handler for align method from python
+static PyObject * Align(PyObject *self, PyObject *args, PyObject *kwds) {
+	Alignment res; //alignment of shorter against longer
+	Profile profile;
+	ModuleState *state = GetState(self);
 
-		from = mat[j-width]+gap;
-		from_down = mat_down[j-width]+gap_extend;
-		if (from > from_down) {
-			mat_down[j] = from;
-			mat_down_dir[j] = 0;
-		} else {
-			mat_down[j] = from_down;
-			mat_down_dir[j] = 2;
-		}
+	Arguments arguments = GetArguments(args, kwds);
+	if (!arguments.shorter)
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	res = RunAlignment(&state->cache, arguments, FASTNW_ALIGN, &profile, NULL);
+	Py_END_ALLOW_THREADS
+	return AlignmentResult(res, arguments, &profile);
+}
 
-		//calculate current row
-		for (i=1; i<width; i++) {
-			
-			//calculate score after diagonal path
-			from = mat[j-width+i-1];
-			from_right = mat_right[j-width+i-1];
-			from_down = mat_down[j-width+i-1];
-			if (from > from_right && from > from_down) {
-				mat[j+i] = from;
-				mat_dir[j+i] = 0;
-			} else if (from_right > from_down) {
-				mat[j+i] = from_right;
-				mat_dir[j+i] = 1;
+//handler for qalign method from python
+static PyObject * QAlign(PyObject *self, PyObject *args, PyObject *kwds) {
+	Alignment res; //alignment of shorter against longer
+	Profile profile;
+	ModuleState *state = GetState(self);
+
+	Arguments arguments = GetArguments(args, kwds);
+	if (!arguments.shorter)
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	res = RunAlignment(&state->cache, arguments, FASTNW_QALIGN, &profile, NULL);
+	Py_END_ALLOW_THREADS
+	return AlignmentResult(res, arguments, &profile);
+}
+
+//handler for search method from python
+static PyObject * NWSearch(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"query", "database", "k", "match", "mismatch",
+		"gap", "gap_extend", "threads", "engine", NULL};
+	Search search;
+	FastaReader reader;
+	PyObject *database;
+	PyObject *path = NULL; //database file name as bytes, if it is a file
+	PyObject *ret = NULL;
+	PyObject *item;
+	Py_buffer view;
+	bool have_view = false;
+	char *engine = "dp";
+	int k;
+	int threads = 1;
+	int fd = -1;
+	struct stat info;
+	void *mapped = NULL;
+	size_t i;
+	bool ok;
+
+	search.gap_extend = INT_MIN;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "sOiiii|iis", kwlist,
+		&search.query, &database, &k, &search.match, &search.mismatch,
+		&search.gap, &search.gap_extend, &threads, &engine))
+		return NULL;
+	if (!GetEngine(engine, &search.engine))
+		return NULL;
+	if (k < 1 || threads < 1) {
+		PyErr_SetString(PyExc_ValueError, "k and threads must be positive");
+		return NULL;
+	}
+	if (search.gap_extend == INT_MIN)
+		search.gap_extend = search.gap;
+	search.query_length = strlen(search.query);
+
+	memset(&reader, 0, sizeof(FastaReader));
+	reader.line_start = true;
+
+	//a str or path-like object names a file, anything else (bytes too
+	//on Python 3) must be a buffer of FASTA text
+#if PY_MAJOR_VERSION >= 3
+	if (PyUnicode_Check(database) || PyObject_HasAttrString(database, "__fspath__")) {
+		if (!PyUnicode_FSConverter(database, &path))
+			return NULL;
+	}
+#else
+	if (PyUnicode_Check(database)) {
+		path = PyUnicode_AsUTF8String(database);
+		if (path == NULL)
+			return NULL;
+	} else if (PyBytes_Check(database)) {
+		path = database;
+		Py_INCREF(path);
+	}
+#endif
+
+	if (path != NULL) {
+		fd = open(PyBytes_AsString(path), O_RDONLY);
+		if (fd < 0) {
+			PyErr_SetFromErrnoWithFilename(PyExc_OSError, PyBytes_AsString(path));
+			Py_DECREF(path);
+			return NULL;
+		}
+		//map regular files, read anything else through a buffer
+		if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+			mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapped == MAP_FAILED) {
+				mapped = NULL;
 			} else {
-				mat[j+i] = from_down;
-				mat_dir[j+i] = 2;
+				madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+				reader.data = mapped;
+				reader.length = info.st_size;
 			}
-			if (horizontal[hl+i-1] == vertical[vl+j/width-1]) {
-				mat[j+i] += match;
-			} else {
-				mat[j+i] += mismatch;
+		}
+		if (mapped == NULL) {
+			reader.file = fdopen(fd, "r");
+			if (reader.file == NULL) {
+				PyErr_SetFromErrnoWithFilename(PyExc_OSError, PyBytes_AsString(path));
+				close(fd);
+				Py_DECREF(path);
+				return NULL;
 			}
-
-			//calculate score after rightward path
-			from = mat[j+i-1] + gap; //removed -width
-			from_right = mat_right[j+i-1] + gap_extend; //removed -width
-			if (from > from_right) {
-				mat_right[j+i] = from;
-				mat_right_dir[j+i] = 0;
-			} else {
-				mat_right[j+i] = from_right;
-				mat_right_dir[j+i] = 1;
+			reader.buffer = malloc(FASTA_BUFFER*sizeof(char));
+			if (reader.buffer == NULL) {
+				fclose(reader.file);
+				Py_DECREF(path);
+				return PyErr_NoMemory();
 			}
+		}
+	} else {
+		if (PyObject_GetBuffer(database, &view, PyBUF_SIMPLE) < 0)
+			return NULL;
+		have_view = true;
+		reader.data = view.buf;
+		reader.length = view.len;
+	}
 
-			//calculate score after downward path
-			from = mat[j-width+i] + gap;
-			from_down = mat_down[j-width+i] + gap_extend;
-			if (from > from_down) {
-				mat_down[j+i] = from;
-				mat_down_dir[j+i] = 0;
+	search.heap = malloc(k*sizeof(Hit));
+	search.size = 0;
+	search.k = k;
+	search.failed = (search.heap == NULL);
+	pthread_mutex_init(&search.lock, NULL);
+
+	Py_BEGIN_ALLOW_THREADS
+	ok = !search.failed && RunSearch(&search, &reader, threads);
+	Py_END_ALLOW_THREADS
+
+	//build [id, aligned query, aligned record, score] for each hit
+	if (ok) {
+		ret = PyList_New(search.size);
+		for (i=0; ret!=NULL && i<search.size; i++) {
+			item = Py_BuildValue("[s,s,s,i]", search.heap[i].id,
+				search.heap[i].Z, search.heap[i].W, search.heap[i].score);
+			if (item == NULL) {
+				Py_DECREF(ret);
+				ret = NULL;
 			} else {
-				mat_down[j+i] = from_down;
-				mat_down_dir[j+i] = 2;
+				PyList_SET_ITEM(ret, i, item);
 			}
 		}
+	} else if (reader.error != 0) {
+		errno = reader.error;
+		PyErr_SetFromErrnoWithFilename(PyExc_OSError, PyBytes_AsString(path));
+	} else {
+		PyErr_NoMemory();
 	}
 
-	/*
-	for (j=0; j<width*height; j+=width) {
-		for (i=0; i<width; i++) {
-			printf("%d, ", mat[j+i]);
-		}
-		printf("\n");
+	for (i=0; search.heap!=NULL && i<search.size; i++) {
+		free(search.heap[i].id);
+		free(search.heap[i].seq);
+		free(search.heap[i].Z);
+		free(search.heap[i].W);
 	}
-	for (j=0; j<width*height; j+=width) {
-		for (i=0; i<width; i++) {
-			printf("%d, ", mat_dir[j+i]);
-		}
-		printf("\n");
+	free(search.heap);
+	pthread_mutex_destroy(&search.lock);
+
+	if (mapped != NULL) {
+		munmap(mapped, reader.length);
+		close(fd);
 	}
-	for (j=0; j<width*height; j+=width) {
-		for (i=0; i<width; i++) {
-			printf("%d, ", mat_right[j+i]);
-		}
-		printf("\n");
+	if (reader.file != NULL)
+		fclose(reader.file);
+	free(reader.buffer);
+	Py_XDECREF(path);
+	if (have_view)
+		PyBuffer_Release(&view);
+
+	return ret;
+}
+
+//handler for pairwise_scores method from python
+static PyObject * PairwiseScores(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"seqs", "match", "mismatch", "gap", "gap_extend",
+		"threads", "out", "engine", NULL};
+	Pairwise pairwise;
+	PyObject *seqs;
+	PyObject *fast;
+	PyObject **items = NULL; //held while the GIL is released
+	PyObject *out = Py_None;
+	Py_buffer view;
+	char *engine = "dp";
+	int threads = 1;
+	size_t i;
+	Py_ssize_t length;
+	bool created = false; //out is a new bytearray
+	bool ok;
+
+	pairwise.gap_extend = INT_MIN;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oiii|iiOs", kwlist,
+		&seqs, &pairwise.match, &pairwise.mismatch, &pairwise.gap,
+		&pairwise.gap_extend, &threads, &out, &engine))
+		return NULL;
+	if (!GetEngine(engine, &pairwise.engine))
+		return NULL;
+	if (threads < 1) {
+		PyErr_SetString(PyExc_ValueError, "threads must be positive");
+		return NULL;
 	}
-	for (j=0; j<width*height; j+=width) {
-		for (i=0; i<width; i++) {
-			printf("%d, ", mat_right_dir[j+i]);
-		}
-		printf("\n");
+	if (pairwise.gap_extend == INT_MIN)
+		pairwise.gap_extend = pairwise.gap;
+
+	fast = PySequence_Fast(seqs, "seqs must be a sequence of strings");
+	if (fast == NULL)
+		return NULL;
+	pairwise.count = PySequence_Fast_GET_SIZE(fast);
+	pairwise.seqs = malloc((pairwise.count+1)*sizeof(char *));
+	pairwise.lengths = malloc((pairwise.count+1)*sizeof(size_t));
+	items = malloc((pairwise.count+1)*sizeof(PyObject *));
+	if (pairwise.seqs==NULL || pairwise.lengths==NULL || items==NULL) {
+		Py_DECREF(fast);
+		free(pairwise.seqs);
+		free(pairwise.lengths);
+		free(items);
+		return PyErr_NoMemory();
+	}
+	for (i=0; i<pairwise.count; i++) {
+		items[i] = PySequence_Fast_GET_ITEM(fast, i);
+		Py_INCREF(items[i]);
 	}
-	for (j=0; j<width*height; j+=width) {
-		for (i=0; i<width; i++) {
-			printf("%d, ", mat_down[j+i]);
+	Py_DECREF(fast);
+
+	//write into the caller's buffer, which must be of C ints, or a new one
+	if (out == Py_None) {
+		out = PyByteArray_FromStringAndSize(NULL, pairwise.count*pairwise.count*sizeof(int));
+		created = true;
+	} else {
+		Py_INCREF(out);
+	}
+	if (out == NULL || PyObject_GetBuffer(out, &view,
+		PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0) {
+		Py_XDECREF(out);
+		out = NULL;
+	} else if (!created && (view.format == NULL || strcmp(view.format, "i") != 0
+		|| view.itemsize != sizeof(int))) {
+		PyErr_SetString(PyExc_TypeError, "out must be a buffer of int32 values (format 'i')");
+		PyBuffer_Release(&view);
+		Py_DECREF(out);
+		out = NULL;
+	} else if ((size_t)view.len != pairwise.count*pairwise.count*sizeof(int)) {
+		PyErr_SetString(PyExc_ValueError, "out must hold len(seqs)**2 int32 values");
+		PyBuffer_Release(&view);
+		Py_DECREF(out);
+		out = NULL;
+	}
+
+	for (i=0; out!=NULL && i<pairwise.count; i++) {
+		pairwise.seqs[i] = StringData(items[i], &length);
+		if (pairwise.seqs[i] == NULL) {
+			PyBuffer_Release(&view);
+			Py_DECREF(out);
+			out = NULL;
+		} else {
+			pairwise.lengths[i] = length;
 		}
-		printf("\n");
 	}
-	for (j=0; j<width*height; j+=width) {
-		for (i=0; i<width; i++) {
-			printf("%d, ", mat_down_dir[j+i]);
+
+	if (out != NULL) {
+		pairwise.out = view.buf;
+		Py_BEGIN_ALLOW_THREADS
+		ok = RunPairwise(&pairwise, threads);
+		Py_END_ALLOW_THREADS
+		PyBuffer_Release(&view);
+		if (!ok) {
+			Py_DECREF(out);
+			out = PyErr_NoMemory();
 		}
-		printf("\n");
 	}
-	*/
-	
 
-	/*********** Matrix completed, begin backtrace **************/
+	for (i=0; i<pairwise.count; i++)
+		Py_DECREF(items[i]);
+	free(items);
+	free(pairwise.seqs);
+	free(pairwise.lengths);
 
-	//calculate backtrace starting position
-	i = width*height-1;
-	switch (end_direction) {
-		case NONE :
-			ret.score = mat[i];
-			trace = 0;
-			//rev_Z[0] = horizontal[hr-1];
-			//rev_W[0] = vertical[vr-1];
-			break;
-		case RIGHT :
-			ret.score = mat_right[i];
-			trace = 1;
-			//rev_Z[0] = horizontal[hr-1];
-			//rev_W[0] = '-';
-			break;
-		case DOWN :
-			//printf("start trace down\n");
-			ret.score = mat_down[i];
-			trace = 2;
-			//rev_Z[0] = '-';
-			//rev_W[0] = vertical[vr-1];
-			break;
-		case ANY :
-			if (mat[i] > mat_right[i] && mat[i] > mat_down[i]) {
-				ret.score = mat[i];
-				trace = 0;
-				//rev_Z[0] = horizontal[hr-1];
-				//rev_W[0] = vertical[vr-1];
-			} else if (mat_right[i] > mat_down[i]) {
-				ret.score = mat_right[i];
-				trace = 1;
-				//rev_Z[0] = horizontal[hr-1];
-				//rev_W[0] = '-';
-			} else {
-				//printf("hi\n");
-				ret.score = mat_down[i];
-				trace = 2;
-				//rev_Z[0] = '-';
-				//rev_W[0] = vertical[vr-1];
-				//printf("Trace = %d\n", trace);
-			}
-			break;
-		default :
-			printf("ERROR: end direction error\n");
-			break;
+	return out;
+}
+
+//the strings of a python sequence, held until ReleaseStrings so their
+//characters can be used without the GIL
+typedef struct {
+	PyObject **items;
+	const char **seqs;
+	size_t *lengths;
+	size_t count;
+} Strings;
+
+void ReleaseStrings(Strings *strings) {
+	size_t i;
+
+	for (i=0; strings->items!=NULL && i<strings->count; i++)
+		Py_DECREF(strings->items[i]);
+	free(strings->items);
+	free(strings->seqs);
+	free(strings->lengths);
+}
+
+//false with a python error if seqs is not a sequence of strings
+bool GetStrings(PyObject *seqs, const char *name, Strings *strings) {
+	PyObject *fast;
+	Py_ssize_t length;
+	size_t i;
+
+	strings->items = NULL;
+	strings->seqs = NULL;
+	strings->lengths = NULL;
+	strings->count = 0;
+
+	fast = PySequence_Fast(seqs, name);
+	if (fast == NULL)
+		return false;
+	strings->count = PySequence_Fast_GET_SIZE(fast);
+	strings->items = malloc((strings->count+1)*sizeof(PyObject *));
+	strings->seqs = malloc((strings->count+1)*sizeof(char *));
+	strings->lengths = malloc((strings->count+1)*sizeof(size_t));
+	if (strings->items==NULL || strings->seqs==NULL || strings->lengths==NULL) {
+		Py_DECREF(fast);
+		free(strings->items);
+		strings->items = NULL;
+		ReleaseStrings(strings);
+		PyErr_NoMemory();
+		return false;
 	}
+	for (i=0; i<strings->count; i++) {
+		strings->items[i] = PySequence_Fast_GET_ITEM(fast, i);
+		Py_INCREF(strings->items[i]);
+	}
+	Py_DECREF(fast);
 
-	//printf("Populating\n");
-
-	//populate rev alignments
-	j = height-1;
-	i = width-1;
-	rev_spot = 0;
-	while (j > 0 || i > 0) {
-		//printf("i=%d, j=%d, t=%d\n", i, j, trace);
-		switch (trace) {
-			case 0 :
-				trace = mat_dir[j*width+i];
-				i--;
-				j--;
-				rev_Z[rev_spot] = horizontal[hl+i];
-				rev_W[rev_spot] = vertical[vl+j];
-				break;
-			case 1 :
-				trace = mat_right_dir[j*width+i];
-				i--;
-				rev_Z[rev_spot] = horizontal[hl+i];
-				rev_W[rev_spot] = '-';
-				break;
-			case 2 :
-				trace = mat_down_dir[j*width+i];
-				j--;
-				rev_Z[rev_spot] = '-';
-				rev_W[rev_spot] = vertical[vl+j];
-				break;
-			default :
-				printf("ERROR: traceback error\n");
-				exit(0);
-				break;
+	for (i=0; i<strings->count; i++) {
+		strings->seqs[i] = StringData(strings->items[i], &length);
+		if (strings->seqs[i] == NULL) {
+			ReleaseStrings(strings);
+			return false;
 		}
-		
-		rev_spot++;
+		strings->lengths[i] = length;
 	}
 
-	ret.index = Z_spot + rev_spot;
+	return true;
+}
 
-	/************ Put rev alignments into Z and W ************/
+//fills the strings of pairs from two python sequences of the same
+//length, held in strings1 and strings2 until ReleaseStrings. false with
+//a python error otherwise
+bool GetPairs(PyObject *seqs1, PyObject *seqs2,
+	Strings *strings1, Strings *strings2, Pairs *pairs) {
+
+	if (!GetStrings(seqs1, "strings1 must be a sequence of strings", strings1))
+		return false;
+	if (!GetStrings(seqs2, "strings2 must be a sequence of strings", strings2)) {
+		ReleaseStrings(strings1);
+		return false;
+	}
+	if (strings1->count != strings2->count) {
+		PyErr_SetString(PyExc_ValueError, "strings1 and strings2 must be the same length");
+		ReleaseStrings(strings1);
+		ReleaseStrings(strings2);
+		return false;
+	}
+	pairs->seqs1 = strings1->seqs;
+	pairs->lengths1 = strings1->lengths;
+	pairs->seqs2 = strings2->seqs;
+	pairs->lengths2 = strings2->lengths;
+	pairs->count = strings1->count;
 
-	rev_Z[rev_spot] = '\0';
-	rev_W[rev_spot] = '\0';
+	return true;
+}
 
-/*
-	printf("Aligning ");
-	printf(rev_Z);
-	printf(" and ");
-	printf(rev_W);
-	printf("\n");
-*/
+//handler for align_batch method from python. Returns flat buffers
+//rather than a list per pair: int32 scores, the CIGAR operation of
+//every column of every alignment as bytes, and int64 offsets, pair i
+//being ops[offsets[i]:offsets[i+1]]
+static PyObject * AlignBatch(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"strings1", "strings2", "match", "mismatch", "gap",
+		"gap_extend", "threads", "engine", NULL};
+	Pairs pairs;
+	Strings strings1;
+	Strings strings2;
+	PyObject *seqs1;
+	PyObject *seqs2;
+	PyObject *scores = NULL;
+	PyObject *ops = NULL;
+	PyObject *offsets = NULL;
+	PyObject *ret = NULL;
+	char *engine = "dp";
+	int threads = 1;
+	int *score_data;
+	char *op_data;
+	long long *offset_data;
+	long long total = 0;
+	size_t i;
+	bool ok;
 
-	for (rev_spot; rev_spot > 0; rev_spot--, Z_spot++) {
-		//printf("%d, %d\n", rev_spot, Z_spot);
-		Z[Z_spot] = rev_Z[rev_spot-1];
-		W[Z_spot] = rev_W[rev_spot-1];
+	pairs.gap_extend = INT_MIN;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOiii|iis", kwlist,
+		&seqs1, &seqs2, &pairs.match, &pairs.mismatch, &pairs.gap,
+		&pairs.gap_extend, &threads, &engine))
+		return NULL;
+	if (!GetEngine(engine, &pairs.engine))
+		return NULL;
+	if (threads < 1) {
+		PyErr_SetString(PyExc_ValueError, "threads must be positive");
+		return NULL;
 	}
-	if (Z_spot != ret.index) {
-		printf("ERROR: indexing problem\n");
+	if (pairs.gap_extend == INT_MIN)
+		pairs.gap_extend = pairs.gap;
+	pairs.align = true;
+	pairs.min_score = INT_MIN;
+
+	if (!GetPairs(seqs1, seqs2, &strings1, &strings2, &pairs))
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	ok = RunPairs(&pairs, threads);
+	Py_END_ALLOW_THREADS
+	if (!ok) {
+		ReleaseStrings(&strings1);
+		ReleaseStrings(&strings2);
+		return PyErr_NoMemory();
 	}
 
-	free(mat);
-	free(mat_right);
-	free(mat_down);
-	free(mat_dir);
-	free(mat_right_dir);
-	free(mat_down_dir);
-	free(rev_Z);
-	free(rev_W);
+	for (i=0; i<pairs.count; i++)
+		total += strlen(pairs.ops[i]);
+	scores = PyByteArray_FromStringAndSize(NULL, pairs.count*sizeof(int));
+	ops = PyByteArray_FromStringAndSize(NULL, total);
+	offsets = PyByteArray_FromStringAndSize(NULL, (pairs.count+1)*sizeof(long long));
+
+	if (scores!=NULL && ops!=NULL && offsets!=NULL) {
+		score_data = (int *)PyByteArray_AS_STRING(scores);
+		op_data = PyByteArray_AS_STRING(ops);
+		offset_data = (long long *)PyByteArray_AS_STRING(offsets);
+
+		//the buffers are new, so nothing else can touch them yet
+		Py_BEGIN_ALLOW_THREADS
+		offset_data[0] = 0;
+		for (i=0; i<pairs.count; i++) {
+			score_data[i] = pairs.scores[i];
+			offset_data[i+1] = offset_data[i]+strlen(pairs.ops[i]);
+			memcpy(op_data+offset_data[i], pairs.ops[i], offset_data[i+1]-offset_data[i]);
+		}
+		Py_END_ALLOW_THREADS
+		ret = Py_BuildValue("(OOO)", scores, ops, offsets);
+	}
 
-	//printf("Done\n");
+	Py_XDECREF(scores);
+	Py_XDECREF(ops);
+	Py_XDECREF(offsets);
+	FreePairs(&pairs);
+	ReleaseStrings(&strings1);
+	ReleaseStrings(&strings2);
 
 	return ret;
+}
 
+//handler for score_batch method from python. Returns the int32 score
+//of every pair as a buffer, pairs that cannot reach min_score getting
+//a value below it
+static PyObject * ScoreBatch(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"strings1", "strings2", "match", "mismatch", "gap",
+		"gap_extend", "threads", "engine", "min_score", NULL};
+	Pairs pairs;
+	Strings strings1;
+	Strings strings2;
+	PyObject *seqs1;
+	PyObject *seqs2;
+	PyObject *scores;
+	char *engine = "dp";
+	int threads = 1;
+	bool ok;
+
+	pairs.gap_extend = INT_MIN;
+	pairs.min_score = INT_MIN;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOiii|iisi", kwlist,
+		&seqs1, &seqs2, &pairs.match, &pairs.mismatch, &pairs.gap,
+		&pairs.gap_extend, &threads, &engine, &pairs.min_score))
+		return NULL;
+	if (!GetEngine(engine, &pairs.engine))
+		return NULL;
+	if (threads < 1) {
+		PyErr_SetString(PyExc_ValueError, "threads must be positive");
+		return NULL;
+	}
+	if (pairs.gap_extend == INT_MIN)
+		pairs.gap_extend = pairs.gap;
+	pairs.align = false;
+
+	if (!GetPairs(seqs1, seqs2, &strings1, &strings2, &pairs))
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	ok = RunPairs(&pairs, threads);
+	Py_END_ALLOW_THREADS
+	ReleaseStrings(&strings1);
+	ReleaseStrings(&strings2);
+	if (!ok)
+		return PyErr_NoMemory();
+
+	scores = PyByteArray_FromStringAndSize((char *)pairs.scores, pairs.count*sizeof(int));
+	FreePairs(&pairs);
+
+	return scores;
 }
 
-PartitionReturn Partition(ScoreReturn ScoreL, ScoreReturn ScoreR, size_t width,
-	int gap, int gap_extend) {
+//handler for msa method from python
+static PyObject * NWMsa(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"strings", "match", "mismatch", "gap", "gap_extend",
+		"threads", NULL};
+	Msa msa;
+	Strings strings;
+	PyObject *seqs;
+	PyObject *ret;
+	PyObject *row;
+	int threads = 1;
 	size_t i;
-	size_t j=width;
-	int best = INT_MIN;
-	int score;
-	PartitionReturn ret;
+	bool ok;
 
-	/*
-	for (i=0; i<=width; i++,j--) {
-		printf("%d, ", ScoreL.cur[i]);
-	}
-	j=width;
-	printf("\n");
-	for (i=0; i<=width; i++,j--) {
-		printf("%d, ", ScoreL.cur_down[i]);
-	}
-	j=width;
-	printf("\n");
-	for (i=0; i<=width; i++,j--) {
-		printf("%d, ", ScoreL.cur_right[i]);
+	msa.gap_extend = INT_MIN;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oiii|ii", kwlist,
+		&seqs, &msa.match, &msa.mismatch, &msa.gap, &msa.gap_extend, &threads))
+		return NULL;
+	if (threads < 1) {
+		PyErr_SetString(PyExc_ValueError, "threads must be positive");
+		return NULL;
 	}
-	j=width;
-	printf("\n");
-	for (i=0; i<=width; i++,j--) {
-		printf("%d, ", ScoreR.cur[i]);
+	if (msa.gap_extend == INT_MIN)
+		msa.gap_extend = msa.gap;
+
+	if (!GetStrings(seqs, "strings must be a sequence of strings", &strings))
+		return NULL;
+	msa.seqs = strings.seqs;
+	msa.lengths = strings.lengths;
+	msa.count = strings.count;
+
+	Py_BEGIN_ALLOW_THREADS
+	ok = RunMsa(&msa, threads);
+	Py_END_ALLOW_THREADS
+	ReleaseStrings(&strings);
+	if (!ok)
+		return PyErr_NoMemory();
+
+	ret = PyList_New(msa.count);
+	for (i=0; ret!=NULL && i<msa.count; i++) {
+		row = Py_BuildValue("s", msa.out[i]);
+		if (row == NULL) {
+			Py_DECREF(ret);
+			ret = NULL;
+		} else {
+			PyList_SET_ITEM(ret, i, row);
+		}
 	}
-	j=width;
-	printf("\n");
-	for (i=0; i<=width; i++,j--) {
-		printf("%d, ", ScoreR.cur_down[i]);
+	FreeMsa(&msa);
+
+	return ret;
+}
+
+//handler for memory_estimate method from python
+static PyObject * MemoryEstimate(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"length1", "length2", "method", "engine",
+		"max_memory", NULL};
+	Py_ssize_t length1;
+	Py_ssize_t length2;
+	Py_ssize_t max_memory = 0;
+	char *name = "align";
+	char *engine_name = "dp";
+	Method method;
+	Engine engine;
+	size_t ret;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "nn|ssn", kwlist,
+		&length1, &length2, &name, &engine_name, &max_memory))
+		return NULL;
+	if (!GetEngine(engine_name, &engine))
+		return NULL;
+	if (length1 < 0 || length2 < 0 || max_memory < 0) {
+		PyErr_SetString(PyExc_ValueError, "lengths and max_memory must not be negative");
+		return NULL;
 	}
-	j=width;
-	printf("\n");
-	for (i=0; i<=width; i++,j--) {
-		printf("%d, ", ScoreR.cur_right[i]);
+	if (strcmp(name, "score") == 0) {
+		method = FASTNW_SCORE;
+	} else if (strcmp(name, "align") == 0) {
+		method = FASTNW_ALIGN;
+	} else if (strcmp(name, "qalign") == 0) {
+		method = FASTNW_QALIGN;
+	} else {
+		PyErr_SetString(PyExc_ValueError, "method must be 'score', 'align' or 'qalign'");
+		return NULL;
 	}
-	j=width;
-	printf("\n");
-	*/
-
-	//need some way to force other partitions into ending in gap or not
-	for (i=0; i<=width; i++, j--) {
-		//neither gap
-		score = ScoreL.cur[i] + ScoreR.cur[j];
-		if (score > best) {
-			best = score;
-			ret.index = i;
-			ret.left = NONE;
-			ret.right = NONE;
-		}
 
-		//both down gaps. Have to correct scores
-		score = ScoreL.cur_down[i] + ScoreR.cur_down[j] - gap + gap_extend;
-		if (score > best) {
-			best = score;
-			ret.index = i;
-			ret.left = DOWN;
-			ret.right = DOWN;
-		}
+	ret = FastNWMemory(length1, length2, method, engine, max_memory);
+	if (ret == 0)
+		return PyErr_NoMemory();
 
-		//one is down, other is not
-		score = ScoreL.cur[i] + ScoreR.cur_down[j];
-		if (score > best) {
-			best = score;
-			ret.index = i;
-			ret.left = NONE;
-			ret.right = DOWN;
-		}
+	return PyLong_FromSize_t(ret);
+}
 
-		//one is down, other is not
-		score = ScoreL.cur_down[i] + ScoreR.cur[j];
-		if (score > best) {
-			best = score;
-			ret.index = i;
-			ret.left = DOWN;
-			ret.right = NONE;
-		}
+//handler for set_cache method from python
+static PyObject * SetCache(PyObject *self, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"max_bytes", NULL};
+	Py_ssize_t max_bytes;
 
-		//any combination of right and cur can be represented here
-		score = ScoreL.cur_right[i] + ScoreR.cur[j];
-		if (score > best) {
-			best = score;
-			ret.index = i;
-			ret.left = RIGHT;
-			ret.right = NONE;
-		}
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "n", kwlist, &max_bytes))
+		return NULL;
+	if (max_bytes < 0) {
+		PyErr_SetString(PyExc_ValueError, "max_bytes must not be negative");
+		return NULL;
+	}
+	SetCacheBudget(&GetState(self)->cache, max_bytes);
 
-		/*
-		score = ScoreL.cur_right[i] + ScoreR.cur_right[j];
-		if (score > best) {
-			best = score;
-			ret.index = i;
-			ret.left = RIGHT;
-			ret.right = RIGHT;
-		}
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+//handler for cache_info method from python
+static PyObject * CacheInfo(PyObject *self) {
+	Cache *cache = &GetState(self)->cache;
+	PyObject *ret;
+
+	pthread_mutex_lock(&cache->lock);
+	ret = Py_BuildValue("{s:L,s:L,s:n,s:n,s:n}",
+		"hits", cache->hits,
+		"misses", cache->misses,
+		"entries", (Py_ssize_t)cache->count,
+		"bytes", (Py_ssize_t)cache->bytes,
+		"max_bytes", (Py_ssize_t)cache->max_bytes);
+	pthread_mutex_unlock(&cache->lock);
 
-		score = ScoreL.cur[i] + ScoreR.cur_right[j];
-		if (score > best) {
-			best = score;
-			ret.index = i;
-			ret.left = NONE;
-			ret.right = RIGHT;
-		}
-		*/
-	}
-	//printf("score = %d, %d\n", best, ret.index);
-
-	free(ScoreL.cur);
-	free(ScoreL.cur_right);
-	free(ScoreL.cur_down);
-	free(ScoreR.cur);
-	free(ScoreR.cur_right);
-	free(ScoreR.cur_down);
-	
 	return ret;
 }
 
-//recursive function for hirshberg algorithm
-HirschReturn Hirsch(char *Z, char *W, size_t Z_spot,
-	const char *horizontal, const char *rev_hor, size_t hl, size_t hr,
-	const char *vertical, const char *rev_vert, size_t vl, size_t vr,
-	int match, int mismatch, int gap, int gap_extend,
-	Direction start_direction, Direction end_direction) {
+//handler for cache_clear method from python
+static PyObject * CacheClear(PyObject *self) {
+	ClearCache(&GetState(self)->cache);
 
-	//get input string lengths
-	size_t width = hr-hl;
-	size_t height = vr-vl;
+	Py_INCREF(Py_None);
+	return Py_None;
+}
 
-	//for indexing
-	//size_t i;
-	//size_t j;
-	size_t h_mid;
-	size_t v_mid;
+/************************ Async calls ***********************
+* score_async, align_async and qalign_async queue their call for a
+* pool of native threads and return a concurrent.futures.Future
+* straight away. The future stays pending while the call runs, so
+* cancelling it sets job->cancel, which the call checks between rows
+* and Hirschberg nodes. Workers only take the GIL to hand over results.
+*/
+
+void InitPool(Pool *pool) {
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	pool->first = NULL;
+	pool->last = NULL;
+	pool->workers = NULL;
+	pool->worker_count = 0;
+	pool->stopping = false;
+	pool->interpreter = NULL;
+}
+
+void FreePool(Pool *pool) {
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->wake);
+}
 
-	//alignment scores fo partitioning
-	ScoreReturn ScoreL;
-	ScoreReturn ScoreR;
+static void JobDestructor(PyObject *capsule) {
+	Job *job = PyCapsule_GetPointer(capsule, "FastNW.job");
 
-	PartitionReturn pres;
+	Py_XDECREF(job->args);
+	Py_XDECREF(job->kwds);
+	Py_XDECREF(job->future);
+	free(job);
+}
 
-	HirschReturn ret; //return value
-	HirschReturn res; //result from NeedlemanWunsch
+//done callback of the future, which sees it cancelled before the job
+//has finished
+static PyObject *JobDone(PyObject *capsule, PyObject *future) {
+	Job *job = PyCapsule_GetPointer(capsule, "FastNW.job");
+	PyObject *cancelled = PyObject_CallMethod(future, "cancelled", NULL);
 
-	ret.score = 0; //the relative score of this recursion call
-	ret.index = Z_spot; //the absolute position in aligned strings
-	//printf("hor: %d, %d\n", hl, hr);
-	//printf("vert: %d, %d\n", vl, vr);
-	//printf("width: %d\n", width);
-	//printf("height: %d\n", height);
+	if (cancelled == NULL)
+		return NULL;
+	if (PyObject_IsTrue(cancelled))
+		job->cancel = 1;
+	Py_DECREF(cancelled);
 
-	if (width*height <= 1000000 || width==1 || height==1) {
-		//printf("Args: %d, %d, %d, %d, %d\n", hl, hr, vl, vr, Z_spot);
+	Py_INCREF(Py_None);
+	return Py_None;
+}
 
-		/*		
-		printf("start = %d\n", start_direction);
-		printf("end = %d\n", end_direction);
+static PyMethodDef JobDoneDef = {"job_done", (PyCFunction)JobDone, METH_O, NULL};
 
-		for (i=hl; i<hr; i++)  {
-			printf("%c", horizontal[i]);
-		}
-		printf("\n");
-		for (j=vl; j<vr; j++)  {
-			printf("%c", vertical[j]);
-		}
-		printf("\n");
-		*/
+void CancelJob(Job *job) {
+	job->cancel = 1;
+	job->score = CANCELLED;
+	job->alignment.align1 = NULL;
+	job->alignment.align2 = NULL;
+	job->alignment.score = CANCELLED;
+}
+
+bool JobCancelled(Job *job) {
+	if (job->method == FASTNW_SCORE)
+		return job->score == CANCELLED;
+	return job->alignment.align1 == NULL && job->alignment.score == CANCELLED;
+}
 
-		res = NeedlemanWunsch(Z, W, Z_spot, horizontal, hl, hr,
-			vertical, vl, vr,
-			match, mismatch, gap, gap_extend,
-			start_direction, end_direction);
+//runs a job on a worker, without the GIL
+void RunJob(ModuleState *state, Job *job) {
+	if (job->cancel)
+		CancelJob(job);
+	else if (job->method == FASTNW_SCORE)
+		job->score = RunScore(&state->cache, job->arguments, &job->profile, &job->cancel);
+	else
+		job->alignment = RunAlignment(&state->cache, job->arguments, job->method,
+			&job->profile, &job->cancel);
+}
 
-		ret.score = res.score;
-		ret.index = res.index;
+//hands the result of a job to its future and drops the pool's reference
+//to the job. Called with the GIL
+void FinishJob(Job *job) {
+	PyObject *capsule = job->capsule;
+	PyObject *result = NULL;
+	PyObject *type = NULL;
+	PyObject *error = NULL;
+	PyObject *traceback = NULL;
+	PyObject *ret;
+
+	if (JobCancelled(job)) {
+		ret = PyObject_CallMethod(job->future, "cancel", NULL);
 	} else {
-		v_mid = (vl+vr)/2; //split vertical in half
-
-		ScoreL = Score(horizontal, hl, hr,
-			vertical, vl, v_mid,
-			match, mismatch, gap, gap_extend, start_direction);
-		ScoreR = Score(rev_hor, strlen(rev_hor)-hr, strlen(rev_hor)-hl,
-			rev_vert, strlen(rev_vert)-vr, strlen(rev_vert)-v_mid,
-			match, mismatch, gap, gap_extend, end_direction);
-
-		//partition horizontal
-		pres = Partition(ScoreL, ScoreR, width, gap, gap_extend);
-		h_mid = hl+pres.index;
-		//printf("pres.left = %d\n", pres.left);
-		//printf("pres.right = %d\n", pres.right);
-		
-		/*
-		for (i=hl; i<hr; i++)  {
-			printf("%c", horizontal[i]);
+		if (job->method == FASTNW_SCORE)
+			result = ScoreResult(job->score, job->arguments, &job->profile);
+		else
+			result = AlignmentResult(job->alignment, job->arguments, &job->profile);
+		if (result == NULL) {
+			PyErr_Fetch(&type, &error, &traceback);
+			PyErr_NormalizeException(&type, &error, &traceback);
 		}
-		printf("\n");
-		printf("%d\n", h_mid);
 
-		for (j=vl; j<vr; j++)  {
-			printf("%c", vertical[j]);
+		//false if it was cancelled after all, too late to stop the call
+		ret = PyObject_CallMethod(job->future, "set_running_or_notify_cancel", NULL);
+		if (ret != NULL && PyObject_IsTrue(ret)) {
+			Py_DECREF(ret);
+			if (result != NULL)
+				ret = PyObject_CallMethod(job->future, "set_result", "(O)", result);
+			else
+				ret = PyObject_CallMethod(job->future, "set_exception", "(O)", error);
 		}
-		printf("\n");
-		*/
-		/*
-		printf("hor: %d, %d, %d\n", hl, h_mid, hr);
-		printf("vert: %d, %d, %d\n", vl, v_mid, vr);
-		printf(rev_hor);
-		printf("\n");
-		printf(rev_vert);
-		printf("\n");
-		*/
-
-		res = Hirsch(Z, W, Z_spot,
-			horizontal, rev_hor, hl, h_mid,
-			vertical, rev_vert, vl, v_mid,
-			match, mismatch, gap, gap_extend,
-			start_direction, pres.left);
-		ret.score = res.score;
-		Z_spot = res.index;
-
-		res = Hirsch(Z, W, Z_spot,
-			horizontal, rev_hor, h_mid, hr,
-			vertical, rev_vert, v_mid, vr,
-			match, mismatch, gap, gap_extend,
-			pres.right, end_direction);
-		ret.score += res.score;
-		ret.index = res.index;
-
-		//have to remember that this is actually 1 gap, not 2
-		if (pres.left == DOWN && pres.right == DOWN)
-			ret.score += gap_extend-gap;
 	}
+	if (ret == NULL)
+		PyErr_WriteUnraisable(job->future);
+
+	Py_XDECREF(ret);
+	Py_XDECREF(result);
+	Py_XDECREF(type);
+	Py_XDECREF(error);
+	Py_XDECREF(traceback);
+	//the future holds the job through its callback
+	Py_CLEAR(job->future);
+	Py_DECREF(capsule);
+}
 
-	return ret;
+static void *PoolWorker(void *arg) {
+	Worker *worker = arg;
+	Pool *pool = &worker->state->pool;
+	PyThreadState *thread = PyThreadState_New(pool->interpreter);
+	Job *job;
+
+	while (true) {
+		pthread_mutex_lock(&pool->lock);
+		while (pool->first == NULL && !pool->stopping)
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		//the pool empties the queue itself when it stops
+		job = pool->first;
+		if (job == NULL) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		pool->first = job->next;
+		if (pool->first == NULL)
+			pool->last = NULL;
+		worker->job = job;
+		pthread_mutex_unlock(&pool->lock);
 
-}
+		RunJob(worker->state, job);
 
-//interprets python arguments
-Arguments GetArguments(PyObject *args) {
-	char *temp; //for switching longer and shorter
-	Arguments arguments; //return value
-	arguments.gap_extend = INT_MIN;
-	
-	//parse python args
-	if (!PyArg_ParseTuple(args, "ssiii|i",
-		&arguments.shorter, &arguments.longer, &arguments.match,
-		&arguments.mismatch, &arguments.gap, &arguments.gap_extend))
-		return FAILED;
+		pthread_mutex_lock(&pool->lock);
+		worker->job = NULL;
+		pthread_mutex_unlock(&pool->lock);
 
-	//find shorter and longer inputs
-	if (arguments.switched = (strlen(arguments.shorter) > strlen(arguments.longer))) {
-		temp = arguments.shorter;
-		arguments.shorter = arguments.longer;
-		arguments.longer = temp;
+		PyEval_RestoreThread(thread);
+		FinishJob(job);
+		PyEval_SaveThread();
 	}
 
-	//if gap_extend isn't specified, must be equal to gap
-	if (arguments.gap_extend == INT_MIN) {
-		arguments.gap_extend = arguments.gap;
-	}
+	PyEval_RestoreThread(thread);
+	PyThreadState_Clear(thread);
+	PyThreadState_DeleteCurrent();
 
-	return arguments;
+	return NULL;
 }
 
-//handler for score method from python
-static PyObject * NWScore(PyObject *self, PyObject *args) {
-	ScoreReturn res; //return value
-	int width;
-	int ret;
-
-	Arguments arguments = GetArguments(args);
-	if (!arguments.shorter)
-		return NULL;
-	width = strlen(arguments.shorter);
+//starts a worker per processor. Called with the pool locked, returns
+//false if none would start
+bool StartPool(ModuleState *state, PyInterpreterState *interpreter) {
+	Pool *pool = &state->pool;
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	int i;
+
+	if (count < 1)
+		count = 1;
+	pool->workers = calloc(count, sizeof(Worker));
+	if (pool->workers == NULL)
+		return false;
+	pool->interpreter = interpreter;
+
+	for (i=0; i<count; i++) {
+		pool->workers[pool->worker_count].state = state;
+		if (pthread_create(&pool->workers[pool->worker_count].id, NULL,
+			PoolWorker, &pool->workers[pool->worker_count]) == 0)
+			pool->worker_count++;
+	}
+	if (pool->worker_count == 0) {
+		free(pool->workers);
+		pool->workers = NULL;
+		return false;
+	}
 
-	res = Score(arguments.shorter, 0, strlen(arguments.shorter),
-		arguments.longer, 0, strlen(arguments.longer),
-		arguments.match, arguments.mismatch, arguments.gap, arguments.gap_extend,
-		ANY);
+	return true;
+}
 
-	ret = mymax(res.cur[width], mymax(res.cur_right[width], res.cur_down[width]));
-	free(res.cur);
-	free(res.cur_right);
-	free(res.cur_down);
+//registered with atexit: cancels every job not yet finished and waits
+//for the workers, which need the interpreter to hand over their results
+static PyObject *PoolShutdown(PyObject *module, PyObject *unused) {
+	Pool *pool = &GetState(module)->pool;
+	Job *queued;
+	Job *job;
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = true;
+	queued = pool->first;
+	pool->first = NULL;
+	pool->last = NULL;
+	for (i=0; i<pool->worker_count; i++) {
+		if (pool->workers[i].job != NULL)
+			pool->workers[i].job->cancel = 1;
+	}
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	Py_BEGIN_ALLOW_THREADS
+	for (i=0; i<pool->worker_count; i++)
+		pthread_join(pool->workers[i].id, NULL);
+	Py_END_ALLOW_THREADS
+	free(pool->workers);
+	pool->workers = NULL;
+	pool->worker_count = 0;
+
+	while (queued != NULL) {
+		job = queued;
+		queued = job->next;
+		CancelJob(job);
+		FinishJob(job);
+	}
 
-	return Py_BuildValue("i", ret);
+	Py_INCREF(Py_None);
+	return Py_None;
 }
 
-//handler for align method from python
-static PyObject * Align(PyObject *self, PyObject *args) {
-	HirschReturn res; //result from hirschberg algorithm
-	PyObject *ret; //return value
+static PyMethodDef PoolShutdownDef = {"shutdown", (PyCFunction)PoolShutdown, METH_NOARGS, NULL};
 
-	char *Z; //short alignment
-	char *W; //long alignment
+bool RegisterShutdown(PyObject *module) {
+	PyObject *atexit = PyImport_ImportModule("atexit");
+	PyObject *shutdown;
+	PyObject *ret = NULL;
 
-	char *rev_hor; //reverse of input strings
-	char *rev_vert;
+	if (atexit == NULL)
+		return false;
+	shutdown = PyCFunction_NewEx(&PoolShutdownDef, module, NULL);
+	if (shutdown != NULL)
+		ret = PyObject_CallMethod(atexit, "register", "(O)", shutdown);
+	Py_XDECREF(shutdown);
+	Py_DECREF(atexit);
+	Py_XDECREF(ret);
 
-	//input string sizes
-	size_t width;
-	size_t height;
-
-	size_t i;
+	return ret != NULL;
+}
 
-	Arguments arguments = GetArguments(args);
+//queues a call of method for the pool, returning its future
+PyObject *Submit(PyObject *module, PyObject *args, PyObject *kwds, Method method) {
+	ModuleState *state = GetState(module);
+	Pool *pool = &state->pool;
+	PyInterpreterState *interpreter;
+	PyObject *futures;
+	PyObject *future;
+	PyObject *callback;
+	PyObject *ret = NULL;
+	Job *job;
+	bool queued = false;
+
+	Arguments arguments = GetArguments(args, kwds);
 	if (!arguments.shorter)
 		return NULL;
 
-	width = strlen(arguments.shorter);
-	height = strlen(arguments.longer);
-	rev_hor = malloc((width+1)*sizeof(char));
-	rev_vert = malloc((height+1)*sizeof(char)); // extra +1 for \0 to use strlen
-	Z = malloc((width+height)*sizeof(char));
-	W = malloc((width+height)*sizeof(char));
+	futures = PyImport_ImportModule("concurrent.futures");
+	if (futures == NULL)
+		return NULL;
+	future = PyObject_CallMethod(futures, "Future", NULL);
+	Py_DECREF(futures);
+	if (future == NULL)
+		return NULL;
 
-	for (i=0; i<width; i++) {
-		rev_hor[width-i-1] = arguments.shorter[i];
+	job = calloc(1, sizeof(Job));
+	if (job == NULL) {
+		Py_DECREF(future);
+		return PyErr_NoMemory();
 	}
-	rev_hor[width] = '\0';
-	for (i=0; i<height; i++) {
-		rev_vert[height-i-1] = arguments.longer[i];
+	job->capsule = PyCapsule_New(job, "FastNW.job", JobDestructor);
+	if (job->capsule == NULL) {
+		free(job);
+		Py_DECREF(future);
+		return NULL;
+	}
+	job->method = method;
+	job->arguments = arguments;
+	//the strings in arguments belong to these
+	Py_INCREF(args);
+	job->args = args;
+	Py_XINCREF(kwds);
+	job->kwds = kwds;
+	Py_INCREF(future);
+	job->future = future;
+
+	callback = PyCFunction_New(&JobDoneDef, job->capsule);
+	if (callback != NULL)
+		ret = PyObject_CallMethod(future, "add_done_callback", "(O)", callback);
+	Py_XDECREF(callback);
+
+#if PY_VERSION_HEX < 0x03070000
+	PyEval_InitThreads();
+#endif
+#if PY_VERSION_HEX >= 0x03090000
+	interpreter = PyInterpreterState_Get();
+#else
+	interpreter = PyThreadState_Get()->interp;
+#endif
+
+	if (ret != NULL) {
+		Py_DECREF(ret);
+		pthread_mutex_lock(&pool->lock);
+		if (!pool->stopping && (pool->workers != NULL || StartPool(state, interpreter))) {
+			if (pool->last != NULL)
+				pool->last->next = job;
+			else
+				pool->first = job;
+			pool->last = job;
+			queued = true;
+			pthread_cond_signal(&pool->wake);
+		}
+		pthread_mutex_unlock(&pool->lock);
+		if (!queued)
+			PyErr_SetString(PyExc_RuntimeError, pool->stopping ?
+				"cannot start a call after interpreter shutdown" :
+				"cannot start worker threads");
 	}
-	rev_vert[height] = '\0';
 
+	//the queue keeps the reference to the job
+	if (!queued) {
+		Py_CLEAR(job->future);
+		Py_DECREF(job->capsule);
+		Py_DECREF(future);
+		return NULL;
+	}
 
-	res = Hirsch(Z, W, 0,
-		arguments.shorter, rev_hor, 0, width,
-		arguments.longer, rev_vert, 0, height,
-		arguments.match, arguments.mismatch, arguments.gap, arguments.gap_extend,
-		ANY, ANY);
+	return future;
+}
 
-	Z[res.index] = '\0';
-	W[res.index] = '\0';
+//handler for score_async method from python
+static PyObject * NWScoreAsync(PyObject *self, PyObject *args, PyObject *kwds) {
+	return Submit(self, args, kwds, FASTNW_SCORE);
+}
 
-	if (arguments.switched)
-		ret = Py_BuildValue("[s,s,i]", W, Z, res.score);
-	else
-		ret = Py_BuildValue("[s,s,i]", Z, W, res.score);
+//handler for align_async method from python
+static PyObject * AlignAsync(PyObject *self, PyObject *args, PyObject *kwds) {
+	return Submit(self, args, kwds, FASTNW_ALIGN);
+}
 
-	free(Z);
-	free(W);
+//handler for qalign_async method from python
+static PyObject * QAlignAsync(PyObject *self, PyObject *args, PyObject *kwds) {
+	return Submit(self, args, kwds, FASTNW_QALIGN);
+}
 
-	return ret;
+/************************ Stream type ***********************/
+
+typedef struct {
+	PyObject_HEAD
+	Stream *stream;
+	pthread_mutex_t lock; //held by the append running, if any
+} StreamObject;
+
+static PyObject *StreamNew(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+	static char *kwlist[] = {"string1", "match", "mismatch", "gap", "gap_extend", NULL};
+	StreamObject *self;
+	char *string1;
+	int match;
+	int mismatch;
+	int gap;
+	int gap_extend = INT_MIN;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "siii|i", kwlist,
+		&string1, &match, &mismatch, &gap, &gap_extend))
+		return NULL;
+	if (gap_extend == INT_MIN)
+		gap_extend = gap;
+
+	self = (StreamObject *)type->tp_alloc(type, 0);
+	if (self == NULL)
+		return NULL;
+	pthread_mutex_init(&self->lock, NULL);
+	self->stream = FastNWStreamNew(string1, strlen(string1),
+		match, mismatch, gap, gap_extend);
+	if (self->stream == NULL) {
+		Py_DECREF(self);
+		return PyErr_NoMemory();
+	}
+
+	return (PyObject *)self;
 }
 
-//handler for qalign method from python
-static PyObject * QAlign(PyObject *self, PyObject *args) {
-	HirschReturn res; //result from hirschberg algorithm
-	PyObject *ret; //return value
+static void StreamDealloc(StreamObject *self) {
+	PyTypeObject *type = Py_TYPE(self);
 
-	char *Z; //short alignment
-	char *W; //long alignment
+	FastNWStreamFree(self->stream);
+	pthread_mutex_destroy(&self->lock);
+	type->tp_free((PyObject *)self);
+#if PY_MAJOR_VERSION >= 3
+	Py_DECREF(type); //instances of heap types hold a reference to them
+#endif
+}
 
-	//input string sizes
-	size_t width;
-	size_t height;
+//handler for Stream.append, returning the score so far
+static PyObject *StreamAppend(StreamObject *self, PyObject *args) {
+	char *chunk;
+	size_t length;
+	int score;
 
-	Arguments arguments = GetArguments(args);
-	if (!arguments.shorter)
+	if (!PyArg_ParseTuple(args, "s", &chunk))
+		return NULL;
+	if (pthread_mutex_trylock(&self->lock) != 0) {
+		PyErr_SetString(PyExc_RuntimeError, "stream is being appended to by another thread");
 		return NULL;
+	}
+	length = strlen(chunk);
 
-	width = strlen(arguments.shorter);
-	height = strlen(arguments.longer);
-	Z = malloc((width+height)*sizeof(char));
-	W = malloc((width+height)*sizeof(char));
+	//the chunk belongs to args, which outlives the call
+	Py_BEGIN_ALLOW_THREADS
+	FastNWStreamAppend(self->stream, chunk, length);
+	score = FastNWStreamScore(self->stream);
+	Py_END_ALLOW_THREADS
+	pthread_mutex_unlock(&self->lock);
 
-	res = NeedlemanWunsch(Z, W, 0,
-		arguments.shorter, 0, width,
-		arguments.longer, 0, height,
-		arguments.match, arguments.mismatch, arguments.gap, arguments.gap_extend,
-		ANY, ANY);
+	return Py_BuildValue("i", score);
+}
 
-	//printf("Done2\n");
+//score and len wait out an append in progress, without the GIL since
+//the append takes it back before letting go of the lock
+static PyObject *StreamScore(StreamObject *self) {
+	int score;
 
-	Z[res.index] = '\0';
-	W[res.index] = '\0';
+	Py_BEGIN_ALLOW_THREADS
+	pthread_mutex_lock(&self->lock);
+	score = FastNWStreamScore(self->stream);
+	pthread_mutex_unlock(&self->lock);
+	Py_END_ALLOW_THREADS
 
-	if (arguments.switched)
-		ret = Py_BuildValue("[s,s,i]", W, Z, res.score);
-	else
-		ret = Py_BuildValue("[s,s,i]", Z, W, res.score);
+	return Py_BuildValue("i", score);
+}
 
-	free(Z);
-	free(W);
+static Py_ssize_t StreamLength(StreamObject *self) {
+	Py_ssize_t length;
 
-	return ret;
+	Py_BEGIN_ALLOW_THREADS
+	pthread_mutex_lock(&self->lock);
+	length = self->stream->height;
+	pthread_mutex_unlock(&self->lock);
+	Py_END_ALLOW_THREADS
+
+	return length;
 }
 
+static PyMethodDef StreamMethods[] = {
+	{"append", (PyCFunction)StreamAppend, METH_VARARGS,
+	 "Append a chunk of string2 and return the score so far"},
+	{"score", (PyCFunction)StreamScore, METH_NOARGS,
+	 "Score of string1 against everything appended so far"},
+	{NULL, NULL, 0, NULL}
+};
+
+static const char StreamDoc[] = "Stream(string1, match, mismatch, gap, gap_extend=gap)\n\n"
+	"Global score of string1 against a second string that arrives in chunks.\n"
+	"Each append costs len(string1) times the chunk length; len() is the\n"
+	"length of the second string so far.";
+
+#if PY_MAJOR_VERSION >= 3
+//a heap type, one per module object
+static PyType_Slot StreamSlots[] = {
+	{Py_tp_new, (void *)StreamNew},
+	{Py_tp_dealloc, (void *)StreamDealloc},
+	{Py_tp_methods, StreamMethods},
+	{Py_sq_length, (void *)StreamLength},
+	{Py_tp_doc, (void *)StreamDoc},
+	{0, NULL}
+};
+
+static PyType_Spec StreamSpec = {
+	"FastNW.Stream",
+	sizeof(StreamObject),
+	0,
+	Py_TPFLAGS_DEFAULT,
+	StreamSlots
+};
+#else
+static PySequenceMethods StreamSequence;
+
+static PyTypeObject StreamType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"FastNW.Stream",
+	sizeof(StreamObject),
+};
+#endif
+
 static PyMethodDef NWMethods[] = {
-    {"score",  NWScore, METH_VARARGS,
+    {"score",  (PyCFunction)NWScore, METH_VARARGS | METH_KEYWORDS,
      "Compute a Needleman–Wunsch score"},
-    {"align", Align, METH_VARARGS,
+    {"align", (PyCFunction)Align, METH_VARARGS | METH_KEYWORDS,
 	 "Compute a Needleman-Wunsch alignment using the Hirschberg Algorithm"},
-	{"qalign", QAlign, METH_VARARGS,
+	{"qalign", (PyCFunction)QAlign, METH_VARARGS | METH_KEYWORDS,
 	 "Force a Needleman-Wunsch alignment"},
+	{"search", (PyCFunction)NWSearch, METH_VARARGS | METH_KEYWORDS,
+	 "Score a query against a FASTA database and align the best k records"},
+	{"pairwise_scores", (PyCFunction)PairwiseScores, METH_VARARGS | METH_KEYWORDS,
+	 "Compute the matrix of scores between every pair of strings"},
+	{"align_batch", (PyCFunction)AlignBatch, METH_VARARGS | METH_KEYWORDS,
+	 "Align pairs of strings into flat score, operation and offset buffers"},
+	{"score_batch", (PyCFunction)ScoreBatch, METH_VARARGS | METH_KEYWORDS,
+	 "Score pairs of strings into a flat int32 buffer"},
+	{"msa", (PyCFunction)NWMsa, METH_VARARGS | METH_KEYWORDS,
+	 "Align a list of strings to each other along a guide tree"},
+	{"memory_estimate", (PyCFunction)MemoryEstimate, METH_VARARGS | METH_KEYWORDS,
+	 "Estimate the peak memory of a call, in bytes"},
+	{"set_cache", (PyCFunction)SetCache, METH_VARARGS | METH_KEYWORDS,
+	 "Cache results of score, align and qalign within max_bytes, 0 to turn off"},
+	{"cache_info", (PyCFunction)CacheInfo, METH_NOARGS,
+	 "Hits, misses, entries and bytes of the result cache"},
+	{"cache_clear", (PyCFunction)CacheClear, METH_NOARGS,
+	 "Empty the result cache and zero its counters"},
+	{"score_async", (PyCFunction)NWScoreAsync, METH_VARARGS | METH_KEYWORDS,
+	 "Start score on a worker thread and return a concurrent.futures.Future"},
+	{"align_async", (PyCFunction)AlignAsync, METH_VARARGS | METH_KEYWORDS,
+	 "Start align on a worker thread and return a concurrent.futures.Future"},
+	{"qalign_async", (PyCFunction)QAlignAsync, METH_VARARGS | METH_KEYWORDS,
+	 "Start qalign on a worker thread and return a concurrent.futures.Future"},
     {NULL, NULL, 0, NULL}        /* Sentinel */
 };
 
-PyMODINIT_FUNC initFastNW(void) {
-    (void) Py_InitModule("FastNW", NWMethods);
-}
+#if PY_MAJOR_VERSION >= 3
+static int ModuleExec(PyObject *module) {
+	PyObject *type;
+
+	InitCache(&GetState(module)->cache);
+	InitPool(&GetState(module)->pool);
+	if (!RegisterShutdown(module))
+		return -1;
+
+	type = PyType_FromSpec(&StreamSpec);
+	if (type == NULL)
+		return -1;
+	if (PyModule_AddObject(module, "Stream", type) < 0) {
+		Py_DECREF(type);
+		return -1;
+	}
 
-int main(int argc, char *argv[]) {
-	Py_SetProgramName(argv[0]);
-	Py_Initialize();
-	initFastNW();
 	return 0;
 }
+
+static void ModuleFree(void *module) {
+	FreeCache(&GetState(module)->cache);
+	FreePool(&GetState(module)->pool);
+}
+
+static PyModuleDef_Slot NWSlots[] = {
+	{Py_mod_exec, (void *)ModuleExec},
+#ifdef Py_mod_multiple_interpreters
+	{Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_mod_gil
+	//every call works on its own workspace, the cache, pool and streams lock
+	{Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+	{0, NULL}
+};
+
+static struct PyModuleDef NWModule = {
+	PyModuleDef_HEAD_INIT,
+	"FastNW",
+	NULL,
+	sizeof(ModuleState),
+	NWMethods,
+	NWSlots,
+	NULL,
+	NULL,
+	ModuleFree
+};
+
+PyMODINIT_FUNC PyInit_FastNW(void) {
+	return PyModuleDef_Init(&NWModule);
+}
+#else
+PyMODINIT_FUNC initFastNW(void) {
+	PyObject *module;
+
+	InitCache(&python2_state.cache);
+	StreamSequence.sq_length = (lenfunc)StreamLength;
+	StreamType.tp_flags = Py_TPFLAGS_DEFAULT;
+	StreamType.tp_doc = StreamDoc;
+	StreamType.tp_new = StreamNew;
+	StreamType.tp_dealloc = (destructor)StreamDealloc;
+	StreamType.tp_methods = StreamMethods;
+	StreamType.tp_as_sequence = &StreamSequence;
+	if (PyType_Ready(&StreamType) < 0)
+		return;
+
+	module = Py_InitModule("FastNW", NWMethods);
+	if (module == NULL)
+		return;
+	InitPool(&python2_state.pool);
+	if (!RegisterShutdown(module))
+		return;
+	Py_INCREF(&StreamType);
+	PyModule_AddObject(module, "Stream", (PyObject *)&StreamType);
+}
+#endif
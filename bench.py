@@ -0,0 +1,253 @@
+#!/usr/bin/env python
+"""
+FastNW: Fast Needleman-Wunsch
+Copyright (C) 2014 Jonathan Richards
+
+Benchmarks for the FastNW module.
+
+Generates random and mutated pairs of DNA strings over a grid of lengths,
+divergences and gap models, times score, align and qalign on each pair and
+reports cells per second (GCUPS), wall time, peak memory and Hirschberg
+recursion statistics as JSON. Every case runs in a fresh process so its
+peak RSS is its own. Datasets only depend on --seed, so runs on the same
+machine can be compared against a saved baseline:
+
+    python bench.py --out base.json
+    (change something, rebuild)
+    python bench.py --baseline base.json
+
+which prints the speedup of every case and exits with status 1 if any case
+got slower than --tolerance allows.
+"""
+
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import platform
+import random
+import resource
+import subprocess
+import sys
+import time
+
+#the scoring schemes benchmarked, as (match, mismatch, gap, gap_extend)
+GAP_MODELS = {
+	"linear": (1, -1, -2, -2),
+	"affine": (2, -3, -5, -2),
+}
+
+#baseline cases faster than this are never reported as slower
+MIN_SECONDS = 0.001
+
+def parse_list(text, kind):
+	return [kind(x) for x in text.split(",") if x]
+
+def divergence_kind(text):
+	return text if text == "random" else float(text)
+
+#a random string, and a copy of it with the given fraction of positions
+#substituted, deleted or inserted in equal measure
+def make_pair(length, divergence, seed):
+	rnd = random.Random(seed)
+	first = "".join(rnd.choice("ACGT") for _ in range(length))
+	if divergence == "random":
+		return first, "".join(rnd.choice("ACGT") for _ in range(length))
+
+	second = []
+	for c in first:
+		r = rnd.random()
+		if r < divergence/3:
+			continue
+		elif r < 2*divergence/3:
+			second.append(rnd.choice("ACGT"))
+		elif r < divergence:
+			second.append(c)
+			second.append(rnd.choice("ACGT"))
+		else:
+			second.append(c)
+	return first, "".join(second)
+
+def peak_rss_kb():
+	peak = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+	if sys.platform == "darwin":
+		peak //= 1024
+	return peak
+
+#runs one case in this process and returns its result
+def run_case(case):
+	import FastNW
+
+	first, second = make_pair(case["length"], case["divergence"], case["seed"])
+	match, mismatch, gap, gap_extend = GAP_MODELS[case["gaps"]]
+	method = getattr(FastNW, case["method"])
+	kwargs = {}
+	if case["engine"] != "dp":
+		kwargs["engine"] = case["engine"]
+
+	width = min(len(first), len(second))
+	height = max(len(first), len(second))
+	rss_before = peak_rss_kb()
+
+	times = []
+	for _ in range(case["repeat"]):
+		start = time.time()
+		result = method(first, second, match, mismatch, gap, gap_extend, **kwargs)
+		times.append(time.time()-start)
+	times.sort()
+
+	out = dict(case)
+	#one more run for the recursion and workspace counters, untimed
+	profile = method(first, second, match, mismatch, gap, gap_extend,
+		profile=True, **kwargs)[1]
+
+	out.update({
+		"width": width,
+		"height": height,
+		"cells": width*height,
+		"score": result if case["method"] == "score" else result[2],
+		"seconds": times[0],
+		"median_seconds": times[len(times)//2],
+		"gcups": width*height/times[0]/1e9 if times[0] > 0 else None,
+		"peak_rss_kb": peak_rss_kb(),
+		"rss_growth_kb": peak_rss_kb()-rss_before,
+	})
+	out.update({
+		"kernel": profile["kernel"],
+		"hirsch_nodes": profile["nodes"],
+		"hirsch_leaves": profile["leaves"],
+		"hirsch_depth": profile["depth"],
+		"score_cells": profile["score_cells"],
+		"leaf_cells": profile["leaf_cells"],
+		"workspace_peak_bytes": profile["peak"],
+	})
+	return out
+
+def case_key(case):
+	return "%s/%s/%d/%s/%s" % (case["method"], case["engine"], case["length"],
+		case["divergence"], case["gaps"])
+
+def make_cases(args):
+	cases = []
+	pairs = 0 #every method and engine gets the same pair
+	for gaps in args.gaps:
+		for length in args.lengths:
+			for divergence in args.divergences:
+				pairs += 1
+				for method in args.methods:
+					for engine in args.engines:
+						if engine != "dp" and method == "qalign":
+							continue
+						if method == "qalign" and length*length > args.qalign_cells:
+							continue
+						cases.append({
+							"method": method,
+							"engine": engine,
+							"length": length,
+							"divergence": divergence,
+							"gaps": gaps,
+							"repeat": args.repeat,
+							"seed": args.seed*1000003+pairs,
+						})
+	return cases
+
+def machine():
+	info = {
+		"python": platform.python_version(),
+		"platform": platform.platform(),
+		"processor": platform.processor() or platform.machine(),
+		"time": time.strftime("%Y-%m-%dT%H:%M:%S"),
+	}
+	try:
+		info["cpus"] = os.sysconf("SC_NPROCESSORS_ONLN")
+	except (ValueError, OSError, AttributeError):
+		pass
+	return info
+
+#prints how every case compares with the baseline. Returns whether
+#none of them got slower than the tolerance allows
+def compare(results, baseline, tolerance):
+	old = dict((case_key(r), r) for r in baseline["results"])
+	ok = True
+
+	print("%-40s %10s %10s %8s %8s" % ("case", "base s", "new s", "speedup", "rss"), file=sys.stderr)
+	for r in results:
+		key = case_key(r)
+		if key not in old:
+			print("%-40s %10s %10.4f" % (key, "-", r["seconds"]), file=sys.stderr)
+			continue
+		b = old[key]
+		speedup = b["seconds"]/r["seconds"] if r["seconds"] > 0 else float("inf")
+		flag = ""
+		#cases this short are mostly timer noise
+		if speedup < 1/(1+tolerance) and b["seconds"] >= MIN_SECONDS:
+			flag = " SLOWER"
+			ok = False
+		if b["score"] != r["score"]:
+			flag += " SCORE CHANGED"
+			ok = False
+		print("%-40s %10.4f %10.4f %7.2fx %7.2fx%s" % (key, b["seconds"], r["seconds"],
+			speedup, float(r["peak_rss_kb"])/max(b["peak_rss_kb"], 1), flag), file=sys.stderr)
+	return ok
+
+def main():
+	parser = argparse.ArgumentParser(description="Benchmark the FastNW module.")
+	parser.add_argument("--lengths", type=lambda t: parse_list(t, int),
+		default=[100, 1000, 5000, 20000])
+	parser.add_argument("--divergences", type=lambda t: parse_list(t, divergence_kind),
+		default=[0.01, 0.1, 0.3, "random"],
+		help="fractions of mutated positions, or random for unrelated pairs")
+	parser.add_argument("--gaps", type=lambda t: parse_list(t, str),
+		default=sorted(GAP_MODELS), help="gap models: " + ", ".join(sorted(GAP_MODELS)))
+	parser.add_argument("--methods", type=lambda t: parse_list(t, str),
+		default=["score", "align", "qalign"])
+	parser.add_argument("--engines", type=lambda t: parse_list(t, str), default=["dp"])
+	parser.add_argument("--repeat", type=int, default=3, help="best of this many runs")
+	parser.add_argument("--seed", type=int, default=1)
+	parser.add_argument("--qalign-cells", type=int, default=25000000,
+		help="skip qalign above this many cells, it keeps the whole matrix")
+	parser.add_argument("--out", help="write results here as well as to stdout")
+	parser.add_argument("--baseline", help="results of an earlier run to compare against")
+	parser.add_argument("--tolerance", type=float, default=0.1,
+		help="slowdown allowed against the baseline (0.1 is 10%%)")
+	parser.add_argument("--case", help=argparse.SUPPRESS)
+	args = parser.parse_args()
+
+	#child process: run a single case
+	if args.case:
+		print(json.dumps(run_case(json.loads(args.case))))
+		return 0
+
+	for gaps in args.gaps:
+		if gaps not in GAP_MODELS:
+			parser.error("unknown gap model %s" % gaps)
+
+	results = []
+	for case in make_cases(args):
+		child = subprocess.Popen([sys.executable, os.path.abspath(__file__),
+			"--case", json.dumps(case)], stdout=subprocess.PIPE)
+		output = child.communicate()[0]
+		if child.returncode != 0:
+			print("%s failed" % case_key(case), file=sys.stderr)
+			return 2
+		results.append(json.loads(output.decode()))
+		print("%-40s %10.4f s %8.3f GCUPS %8d KB" % (case_key(case),
+			results[-1]["seconds"], results[-1]["gcups"] or 0,
+			results[-1]["peak_rss_kb"]), file=sys.stderr)
+
+	report = {"machine": machine(), "results": results}
+	text = json.dumps(report, indent=1, sort_keys=True)
+	print(text)
+	if args.out:
+		with open(args.out, "w") as f:
+			f.write(text + "\n")
+
+	if args.baseline:
+		with open(args.baseline) as f:
+			if not compare(results, json.load(f), args.tolerance):
+				return 1
+	return 0
+
+if __name__ == "__main__":
+	sys.exit(main())
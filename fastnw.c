@@ -0,0 +1,4436 @@
+/**********************************************************************
+* FastNW: Fast Needleman-Wunsch
+* Copyright (C) 2014 Jonathan Richards
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+* 
+* Written by Jonathan Richards, jonrds@gmail.com
+**********************************************************************/
+
+//clock_gettime and CLOCK_MONOTONIC under strict ISO C
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 199309L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <float.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include "fastnw_internal.h"
+
+const HirschReturn NEED_MEM = {
+	0, -1
+};
+
+const HirschReturn LOW_SCORE = {
+	0, -2
+};
+
+const HirschReturn TRACE_ERROR = {
+	0, -3
+};
+
+const ScoreReturn NO_MEM = {
+	NULL, NULL, NULL, false
+};
+
+const ScoreReturn PRUNED = {
+	NULL, NULL, NULL, true
+};
+
+/************************ Profiling *************************/
+
+//seconds on a clock that only goes forward
+double Now(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec*1e-9;
+}
+
+static __inline void ProfileAlloc(Profile *profile, size_t bytes) {
+	if (profile == NULL)
+		return;
+	profile->allocated += bytes;
+	profile->workspace += bytes;
+	if (profile->workspace > profile->peak)
+		profile->peak = profile->workspace;
+}
+
+static __inline void ProfileFree(Profile *profile, size_t bytes) {
+	if (profile != NULL)
+		profile->workspace -= bytes;
+}
+
+//the three rows handed back by Score, once freed
+static __inline void ProfileFreeRows(Profile *profile, size_t width) {
+	ProfileFree(profile, 3*(width+1)*sizeof(int));
+}
+
+/************************ Sequences *************************
+* The DP kernels only ever compare symbols for equality, so DNA can be
+* held at 2 bits a base (or 4 with N and the IUPAC codes) instead of a
+* byte, and read backwards in place instead of from reversed copies.
+* Each call unpacks the symbols of its own window of the horizontal
+* string into a byte row once and reads one vertical symbol a row, so
+* the inner loops stay as they were.
+*/
+
+//symbol codes of the packed encodings, the first four fitting 2 bits
+#define NUCLEOTIDES "ACGTURYSWKMBDHVN"
+
+//symbol of a character in an encoding, -1 if it has none
+static __inline int SymbolCode(int bits, char c) {
+	const char *code;
+
+	if (bits == 8)
+		return (unsigned char)c;
+	code = memchr(NUCLEOTIDES, c, 1 << bits);
+	return code == NULL ? -1 : code-NUCLEOTIDES;
+}
+
+//bits a symbol needed to encode a string
+int SequenceBits(const char *string, size_t length) {
+	int bits = 2;
+	const char *code;
+	size_t i;
+
+	for (i=0; i<length; i++) {
+		code = memchr(NUCLEOTIDES, string[i], 16);
+		if (code == NULL)
+			return 8;
+		if (code-NUCLEOTIDES >= 4)
+			bits = 4;
+	}
+
+	return bits;
+}
+
+bool PackSequence(Sequence *seq, const char *string, size_t length, int bits) {
+	unsigned char *packed;
+	size_t i;
+
+	seq->length = length;
+	seq->bits = bits;
+	seq->reverse = false;
+	if (bits == 8) {
+		seq->symbols = (const unsigned char *)string;
+		return true;
+	}
+
+	packed = calloc(PackedMemory(length), sizeof(unsigned char));
+	if (packed == NULL)
+		return false;
+	for (i=0; i<length; i++)
+		packed[i*bits/8] |= (unsigned char)SymbolCode(bits, string[i]) << (i*bits%8);
+	seq->symbols = packed;
+
+	return true;
+}
+
+bool PackSequences(Sequence *horizontal, const char *string1, size_t length1,
+	Sequence *vertical, const char *string2, size_t length2) {
+
+	int bits = mymax(SequenceBits(string1, length1), SequenceBits(string2, length2));
+
+	if (!PackSequence(horizontal, string1, length1, bits))
+		return false;
+	if (!PackSequence(vertical, string2, length2, bits)) {
+		FreeSequence(*horizontal);
+		return false;
+	}
+
+	return true;
+}
+
+void FreeSequence(Sequence seq) {
+	if (seq.bits < 8)
+		free((unsigned char *)seq.symbols);
+}
+
+Sequence Reversed(Sequence seq) {
+	seq.reverse = !seq.reverse;
+	return seq;
+}
+
+size_t PackedMemory(size_t length) {
+	return length/2+1;
+}
+
+static __inline int Symbol(Sequence seq, size_t i) {
+	if (seq.reverse)
+		i = seq.length-1-i;
+	switch (seq.bits) {
+		case 2 :
+			return (seq.symbols[i/4] >> (i%4*2)) & 3;
+		case 4 :
+			return (seq.symbols[i/2] >> (i%2*4)) & 15;
+		default :
+			return seq.symbols[i];
+	}
+}
+
+//symbols from to to into out, one a byte
+void Unpack(Sequence seq, size_t from, size_t to, unsigned char *out) {
+	size_t i;
+
+	if (seq.bits == 8 && !seq.reverse) {
+		memcpy(out, seq.symbols+from, to-from);
+		return;
+	}
+	for (i=from; i<to; i++)
+		out[i-from] = Symbol(seq, i);
+}
+
+//character a symbol stands for
+static __inline char SymbolChar(Sequence seq, int symbol) {
+	return seq.bits == 8 ? (char)symbol : NUCLEOTIDES[symbol];
+}
+
+/************************** Memory **************************
+* Workspace the DP functions allocate, in bytes, for strings of the
+* given lengths. Hirsch holds at most the rows of one Partition at a
+* time, freed before it recurses, or one NeedlemanWunsch leaf, so its
+* peak is whichever of those is larger.
+*/
+
+size_t ScoreMemory(size_t width) {
+	return 6*(width+1)*sizeof(int) + (width+1)*sizeof(unsigned char);
+}
+
+size_t LeafMemory(size_t width, size_t height) {
+	return 6*(width+1)*(height+1)*sizeof(int) + 3*(width+height+2)*sizeof(char);
+}
+
+/********************* Early termination ********************/
+
+//rows of Score between checks against min_score
+#define PRUNE_ROWS 32
+
+//best score any alignment through a row of Score can still reach,
+//with rows more rows to go. Every remaining diagonal step gains at
+//most the better of match and mismatch and every gap character at
+//most the better of gap and gap_extend
+long long RowBound(const int *cur, const int *cur_right, const int *cur_down,
+	size_t width, size_t rows,
+	int match, int mismatch, int gap, int gap_extend) {
+
+	long long step = mymax(match, mismatch);
+	long long gap_step = mymax(gap, gap_extend);
+	long long best = LLONG_MIN;
+	long long bound;
+	size_t cols;
+	size_t diagonal;
+	size_t i;
+
+	for (i=0; i<width; i++) {
+		cols = width-1-i;
+		diagonal = cols < rows ? cols : rows;
+		bound = diagonal*step + (rows+cols-2*diagonal)*gap_step;
+		if ((long long)(rows+cols)*gap_step > bound)
+			bound = (long long)(rows+cols)*gap_step;
+		bound += mymax(cur[i], mymax(cur_right[i], cur_down[i]));
+		if (bound > best)
+			best = bound;
+	}
+
+	return best;
+}
+
+//fills the row below prev, whose vertical character has the given
+//symbol. Shared by Score and the streaming scorer
+static __inline void ScoreRow(int *cur, int *cur_right, int *cur_down,
+	const int *prev, const int *prev_right, const int *prev_down,
+	const unsigned char *symbols, int symbol, size_t width,
+	int match, int mismatch, int gap, int gap_extend) {
+
+	size_t i;
+
+	cur[0] = INT_MIN/4;
+	cur_right[0] = INT_MIN/4;
+	cur_down[0] = mymax(prev[0]+gap, prev_down[0]+gap_extend);
+
+	//calculate current row
+	for (i=1; i<width; i++) {
+		
+		//calculate score after diagonal path
+		if (symbols[i-1] == symbol) {
+			cur[i] = mymax(prev[i-1], mymax(prev_right[i-1], prev_down[i-1])) + match;
+		} else {
+			cur[i] = mymax(prev[i-1], mymax(prev_right[i-1], prev_down[i-1])) + mismatch;
+		}
+
+		//calculate score after downward path
+		cur_down[i] = mymax(prev[i] + gap, prev_down[i] + gap_extend);
+
+		//calculate score after rightward path
+		cur_right[i] = mymax(cur[i-1] + gap, cur_right[i-1] + gap_extend);
+	}
+}
+
+//for quickly counting a Needleman Wunsch _score_
+//returns a ScoreReturn object that must be freed after use
+//returning entire bottom row allows use in Partition
+ScoreReturn Score(Sequence horizontal, size_t hl, size_t hr,
+	Sequence vertical, size_t vl, size_t vr,
+	int match, int mismatch, int gap, int gap_extend,
+	Direction start_direction, int min_score, size_t more_rows,
+	Profile *profile,
+	const volatile int *cancel) {
+
+	//dimensions of matrix
+	size_t width = hr-hl+1;
+	size_t height = vr-vl+1;
+
+	//loop variables
+	size_t i;
+	size_t j;
+
+	//return value
+	ScoreReturn ret;
+
+	//current and previous row given not in a gap, in a down gap, and in a right gap
+	int *cur = malloc(width*sizeof(int));
+	int *prev = malloc(width*sizeof(int));
+	int *cur_right = malloc(width*sizeof(int));
+	int *prev_right = malloc(width*sizeof(int));
+	int *cur_down = malloc(width*sizeof(int));
+	int *prev_down = malloc(width*sizeof(int));
+	int *temp; //for switching cur and prev
+
+	//horizontal symbols, and the vertical one of the current row
+	unsigned char *symbols = malloc(width*sizeof(unsigned char));
+	int symbol;
+
+	/******************** Check Memory ***********************/
+	if (cur==NULL || prev==NULL || cur_right==NULL
+		|| prev_right==NULL || cur_down==NULL || prev_down==NULL
+		|| symbols==NULL) {
+
+		free(cur);
+		free(prev);
+		free(cur_right);
+		free(prev_right);
+		free(cur_down);
+		free(prev_down);
+		free(symbols);
+		return NO_MEM;
+	}
+	ProfileAlloc(profile, ScoreMemory(width-1));
+	Unpack(horizontal, hl, hr, symbols);
+
+	/*************** Initial assignment of cur ***************/
+	cur[0] = 0;
+	cur_right[0] = INT_MIN/4;
+	cur_down[0] = INT_MIN/4;
+	for (i=1; i<width; i++) {
+		cur[i] = INT_MIN/4;
+		cur_right[i] = mymax(cur[i-1] + gap, cur_right[i-1] + gap_extend);
+		cur_down[i] = INT_MIN/4;
+	}
+
+	/******** Second row depends on start_direction **********/
+	if (height > 1) {
+		temp = prev;
+		prev = cur;
+		cur = temp;
+
+		temp = prev_down;
+		prev_down = cur_down;
+		cur_down = temp;
+
+		temp = prev_right;
+		prev_right = cur_right;
+		cur_right = temp;
+
+		cur[0] = INT_MIN/4;
+		cur_right[0] = INT_MIN/4;
+		symbol = Symbol(vertical, vl);
+		switch (start_direction) {
+			case NONE : //cant use prev_right or cur_down
+				cur_down[0] = INT_MIN/4;
+				for (i=1; i<width; i++) {
+					if (symbols[i-1] == symbol)
+						cur[i] = prev[i-1]+match;
+					else
+						cur[i] = prev[i-1]+mismatch;
+					cur_right[i] = mymax(cur[i-1] + gap, cur_right[i-1] + gap_extend);
+					cur_down[i] = INT_MIN/4;
+				}
+				break;
+			case DOWN : //can only use cur_down
+				cur_down[0] = gap;
+				for (i=1; i<width; i++) {
+					cur[i] = INT_MIN/4;
+					cur_right[i] = INT_MIN/4;
+					cur_down[i] = INT_MIN/4;
+				}
+				break;
+			case RIGHT : //cant use prev or cur_down
+				cur_down[0] = INT_MIN/4;
+				for (i=1; i<width; i++) {
+					if (symbols[i-1] == symbol)
+						cur[i] = prev_right[i-1]+match;
+					else
+						cur[i] = prev_right[i-1]+mismatch;
+					cur_right[i] = mymax(cur[i-1] + gap, cur_right[i-1] + gap_extend);
+					cur_down[i] = INT_MIN/4;
+				}
+				break;
+			case ANY : //can use arrays as normal
+				cur_down[0] = gap;
+				for (i=1; i<width; i++) {
+					if (symbols[i-1] == symbol)
+						cur[i] = mymax(prev[i-1], prev_right[i-1])+match;
+					else
+						cur[i] = mymax(prev[i-1], prev_right[i-1])+mismatch;
+					cur_right[i] = mymax(cur[i-1] + gap, cur_right[i-1] + gap_extend);
+					cur_down[i] = INT_MIN/4;
+				}
+				break;
+			default :
+				printf("ERROR: Initial direction error\n");
+				break;
+		}
+	}
+
+	/***************** Assign rest of matrix *****************/
+	for (j=2; j<height; j++) {
+		//current becomes previous
+		temp = prev;
+		prev = cur;
+		cur = temp;
+
+		temp = prev_down;
+		prev_down = cur_down;
+		cur_down = temp;
+
+		temp = prev_right;
+		prev_right = cur_right;
+		cur_right = temp;
+
+		symbol = Symbol(vertical, vl+j-1);
+		ScoreRow(cur, cur_right, cur_down, prev, prev_right, prev_down,
+			symbols, symbol, width, match, mismatch, gap, gap_extend);
+
+		//give up once min_score is out of reach or the caller gives up
+		if (j%PRUNE_ROWS == 0 && ((cancel != NULL && *cancel)
+			|| (min_score != INT_MIN
+			&& RowBound(cur, cur_right, cur_down, width, height-1-j+more_rows,
+				match, mismatch, gap, gap_extend) < min_score))) {
+
+			free(cur);
+			free(prev);
+			free(cur_right);
+			free(prev_right);
+			free(cur_down);
+			free(prev_down);
+			free(symbols);
+			ProfileFree(profile, ScoreMemory(width-1));
+			if (profile != NULL)
+				profile->score_cells += (long long)(width-1)*j;
+			return PRUNED;
+		}
+	}
+
+	free(prev);
+	free(prev_right);
+	free(prev_down);
+	free(symbols);
+	ProfileFree(profile, 3*width*sizeof(int) + width*sizeof(unsigned char));
+	if (profile != NULL)
+		profile->score_cells += (long long)(width-1)*(height-1);
+
+	ret.cur = cur;
+	ret.cur_right = cur_right;
+	ret.cur_down = cur_down;
+	ret.pruned = false;
+
+	return ret;
+}
+
+//Full Needleman Wunsch algorithm, with added capability
+//for starting and ending requirements (allowing it to be used with Hirsch)
+HirschReturn NeedlemanWunsch(char *Z, char *W, size_t Z_spot,
+	Sequence horizontal, size_t hl, size_t hr,
+	Sequence vertical, size_t vl, size_t vr,
+	int match, int mismatch, int gap, int gap_extend,
+	Direction start_direction, Direction end_direction, Profile *profile) {
+
+	//for indexing
+	size_t i;
+	size_t j;
+
+	//when each phase began, if profiling
+	double start = 0;
+
+	//matrix dimensions
+	size_t width = hr-hl+1;
+	size_t height = vr-vl+1;
+
+	//temporary calculations
+	int from;
+	int from_right;
+	int from_down;
+
+	//score matrix
+	int *mat = malloc(width*height*sizeof(int));
+	int *mat_right = malloc(width*height*sizeof(int));
+	int *mat_down = malloc(width*height*sizeof(int));
+
+	//0=none, 1=right, 2=down
+	int trace;
+	int *mat_dir = malloc(width*height*sizeof(int));
+	int *mat_right_dir = malloc(width*height*sizeof(int));
+	int *mat_down_dir = malloc(width*height*sizeof(int));
+
+	//backwards alignments
+	size_t rev_spot;
+	char *rev_Z = malloc((width+height)*sizeof(char));
+	char *rev_W = malloc((width+height)*sizeof(char));
+
+	//symbols of both strings, one a byte
+	unsigned char *h_symbols = malloc(width*sizeof(unsigned char));
+	unsigned char *v_symbols = malloc(height*sizeof(unsigned char));
+
+	HirschReturn ret;
+
+	if (mat==NULL || mat_right==NULL || mat_down==NULL
+		|| mat_dir==NULL || mat_right_dir==NULL || mat_down_dir==NULL
+		|| rev_Z==NULL || rev_W==NULL || h_symbols==NULL || v_symbols==NULL) {
+
+		free(mat);
+		free(mat_right);
+		free(mat_down);
+		free(mat_dir);
+		free(mat_right_dir);
+		free(mat_down_dir);
+		free(rev_Z);
+		free(rev_W);
+		free(h_symbols);
+		free(v_symbols);
+		return NEED_MEM;
+	}
+	if (profile != NULL) {
+		ProfileAlloc(profile, LeafMemory(width-1, height-1));
+		start = Now();
+	}
+	Unpack(horizontal, hl, hr, h_symbols);
+	Unpack(vertical, vl, vr, v_symbols);
+
+/*
+	printf(horizontal);
+	printf("\n");
+	printf(vertical);
+	printf("\n");
+
+	printf("width = %d\n", width);
+	printf("height = %d\n", height);
+*/
+
+	/********************** First row ************************/
+	mat[0] = 0;
+	mat_dir[0] = -1;
+
+	mat_right[0] = INT_MIN/4;
+	mat_right_dir[0] = -1;
+	
+	mat_down[0] = INT_MIN/4;
+	mat_down_dir[0] = -1;
+	
+	for (i=1; i<width; i++) {
+		mat[i] = INT_MIN/4;
+		mat_dir[i] = -1;
+
+		from = mat[i-1] + gap;
+		from_right = mat_right[i-1] + gap_extend;
+		if (from > from_right) {
+			mat_right[i] = from;
+			mat_right_dir[i] = 0;
+		} else {
+			mat_right[i] = from_right;
+			mat_right_dir[i] = 1;
+		}
+
+		mat_down[i] = INT_MIN/4;
+		mat_down_dir[i] = -1; //added down
+	}
+
+	/******** Second row depends on start_direction **********/
+	if (height > 1) {
+		j = width;
+
+		mat[j] = INT_MIN/4;
+		mat_dir[j] = -1;
+
+		mat_right[j] = INT_MIN/4;
+		mat_right_dir[j] = -1;
+
+		switch (start_direction) {
+			case NONE : //cant use prev_right or cur_down
+				mat_down[j] = INT_MIN/4;
+				mat_down_dir[j] = -1;
+
+				for (i=1; i<width; i++) {
+					if (h_symbols[i-1] == v_symbols[0])
+						mat[j+i] = mat[i-1]+match;
+					else
+						mat[j+i] = mat[i-1]+mismatch;
+					mat_dir[j+i] = 0;
+
+					from = mat[j+i-1] + gap;
+					from_right = mat_right[j+i-1] + gap_extend;
+					if (from > from_right) {
+						mat_right[j+i] = from;
+						mat_right_dir[j+i] = 0;
+					} else {
+						mat_right[j+i] = from_right;
+						mat_right_dir[j+i] = 1;
+					}
+					
+					mat_down[j+i] = INT_MIN/4;
+					mat_down_dir[j+i] = -1;
+				}
+				break;
+			case DOWN : //can only use cur_down
+				//printf("Starting down\n");
+				mat_down[j] = gap;
+				mat_down_dir[j] = 0;
+
+				for (i=1; i<width; i++) {
+					mat[j+i] = INT_MIN/4;
+					mat_dir[j+i] = -1;
+
+					mat_right[j+i] = INT_MIN/4;
+					mat_right_dir[j+i] = -1;
+
+					mat_down[j+i] = INT_MIN/4;
+					mat_down_dir[j+i] = -1;
+				}
+				break;
+			case RIGHT : //cant use prev or cur_down
+				mat_down[j] = INT_MIN/4;
+				mat_down_dir[j] = -1;
+
+				for (i=1; i<width; i++) {
+					if (h_symbols[i-1] == v_symbols[0])
+						mat[j+i] = mat_right[i-1]+match;
+					else
+						mat[j+i] = mat_right[i-1]+mismatch;
+					mat_dir[j+i] = 0;
+
+					from = mat[j+i-1] + gap;
+					from_right = mat_right[j+i-1] + gap_extend;
+					if (from > from_right) {
+						mat_right[j+i] = from;
+						mat_right_dir[j+i] = 0;
+					} else {
+						mat_right[j+i] = from_right;
+						mat_right_dir[j+i] = 1;
+					}
+					
+					mat_down[j+i] = INT_MIN/4;
+					mat_down_dir[j+i] = -1;
+				}
+				break;
+			case ANY : //can use arrays as normal
+				mat_down[j] = gap;
+				mat_down_dir[j] = 0;
+
+				for (i=1; i<width; i++) {
+					from = mat[i-1];
+					from_right = mat_right[i-1];
+					if (from > from_right) {
+						mat[j+i] = from;
+						mat_dir[j+i] = 0;
+					} else {
+						mat[j+i] = from_right;
+						mat_dir[j+i] = 1;
+					}
+					if (h_symbols[i-1] == v_symbols[0])
+						mat[j+i] += match;
+					else
+						mat[j+i] += mismatch;
+
+					from = mat[j+i-1] + gap; //added j
+					from_right = mat_right[j+i-1] + gap_extend; //added j
+					if (from > from_right) {
+						mat_right[j+i] = from;
+						mat_right_dir[j+i] = 0;
+					} else {
+						mat_right[j+i] = from_right;
+						mat_right_dir[j+i] = 1;
+					}
+
+					mat_down[j+i] = INT_MIN/4;
+					mat_down_dir[j+i] = -1;
+				}
+				break;
+			default :
+				printf("ERROR: Initial direction error\n");
+				break;
+		}
+	}
+
+	/***************** Assign rest of matrix *****************/
+	for (j=2*width; j<width*height; j+=width) {
+
+		mat[j] = INT_MIN/4;
+		mat_dir[j] = -1;
+
+		mat_right[j] = INT_MIN/4;
+		mat_right_dir[j] = -1;
+
+		from = mat[j-width]+gap;
+		from_down = mat_down[j-width]+gap_extend;
+		if (from > from_down) {
+			mat_down[j] = from;
+			mat_down_dir[j] = 0;
+		} else {
+			mat_down[j] = from_down;
+			mat_down_dir[j] = 2;
+		}
+
+		//calculate current row
+		for (i=1; i<width; i++) {
+			
+			//calculate score after diagonal path
+			from = mat[j-width+i-1];
+			from_right = mat_right[j-width+i-1];
+			from_down = mat_down[j-width+i-1];
+			if (from > from_right && from > from_down) {
+				mat[j+i] = from;
+				mat_dir[j+i] = 0;
+			} else if (from_right > from_down) {
+				mat[j+i] = from_right;
+				mat_dir[j+i] = 1;
+			} else {
+				mat[j+i] = from_down;
+				mat_dir[j+i] = 2;
+			}
+			if (h_symbols[i-1] == v_symbols[j/width-1]) {
+				mat[j+i] += match;
+			} else {
+				mat[j+i] += mismatch;
+			}
+
+			//calculate score after rightward path
+			from = mat[j+i-1] + gap; //removed -width
+			from_right = mat_right[j+i-1] + gap_extend; //removed -width
+			if (from > from_right) {
+				mat_right[j+i] = from;
+				mat_right_dir[j+i] = 0;
+			} else {
+				mat_right[j+i] = from_right;
+				mat_right_dir[j+i] = 1;
+			}
+
+			//calculate score after downward path
+			from = mat[j-width+i] + gap;
+			from_down = mat_down[j-width+i] + gap_extend;
+			if (from > from_down) {
+				mat_down[j+i] = from;
+				mat_down_dir[j+i] = 0;
+			} else {
+				mat_down[j+i] = from_down;
+				mat_down_dir[j+i] = 2;
+			}
+		}
+	}
+
+	/*
+	for (j=0; j<width*height; j+=width) {
+		for (i=0; i<width; i++) {
+			printf("%d, ", mat[j+i]);
+		}
+		printf("\n");
+	}
+	for (j=0; j<width*height; j+=width) {
+		for (i=0; i<width; i++) {
+			printf("%d, ", mat_dir[j+i]);
+		}
+		printf("\n");
+	}
+	for (j=0; j<width*height; j+=width) {
+		for (i=0; i<width; i++) {
+			printf("%d, ", mat_right[j+i]);
+		}
+		printf("\n");
+	}
+	for (j=0; j<width*height; j+=width) {
+		for (i=0; i<width; i++) {
+			printf("%d, ", mat_right_dir[j+i]);
+		}
+		printf("\n");
+	}
+	for (j=0; j<width*height; j+=width) {
+		for (i=0; i<width; i++) {
+			printf("%d, ", mat_down[j+i]);
+		}
+		printf("\n");
+	}
+	for (j=0; j<width*height; j+=width) {
+		for (i=0; i<width; i++) {
+			printf("%d, ", mat_down_dir[j+i]);
+		}
+		printf("\n");
+	}
+	*/
+	
+
+	/*********** Matrix completed, begin backtrace **************/
+	if (profile != NULL) {
+		profile->fill += Now()-start;
+		profile->leaf_cells += (long long)(width-1)*(height-1);
+		start = Now();
+	}
+
+	//calculate backtrace starting position
+	i = width*height-1;
+	switch (end_direction) {
+		case NONE :
+			ret.score = mat[i];
+			trace = 0;
+			//rev_Z[0] = horizontal[hr-1];
+			//rev_W[0] = vertical[vr-1];
+			break;
+		case RIGHT :
+			ret.score = mat_right[i];
+			trace = 1;
+			//rev_Z[0] = horizontal[hr-1];
+			//rev_W[0] = '-';
+			break;
+		case DOWN :
+			//printf("start trace down\n");
+			ret.score = mat_down[i];
+			trace = 2;
+			//rev_Z[0] = '-';
+			//rev_W[0] = vertical[vr-1];
+			break;
+		case ANY :
+			if (mat[i] > mat_right[i] && mat[i] > mat_down[i]) {
+				ret.score = mat[i];
+				trace = 0;
+				//rev_Z[0] = horizontal[hr-1];
+				//rev_W[0] = vertical[vr-1];
+			} else if (mat_right[i] > mat_down[i]) {
+				ret.score = mat_right[i];
+				trace = 1;
+				//rev_Z[0] = horizontal[hr-1];
+				//rev_W[0] = '-';
+			} else {
+				//printf("hi\n");
+				ret.score = mat_down[i];
+				trace = 2;
+				//rev_Z[0] = '-';
+				//rev_W[0] = vertical[vr-1];
+				//printf("Trace = %d\n", trace);
+			}
+			break;
+		default :
+			//no way in, which the traceback below turns into TRACE_ERROR
+			trace = -1;
+			break;
+	}
+
+	//printf("Populating\n");
+
+	//populate rev alignments
+	j = height-1;
+	i = width-1;
+	rev_spot = 0;
+	while (j > 0 || i > 0) {
+		//printf("i=%d, j=%d, t=%d\n", i, j, trace);
+		switch (trace) {
+			case 0 :
+				trace = mat_dir[j*width+i];
+				i--;
+				j--;
+				rev_Z[rev_spot] = SymbolChar(horizontal, h_symbols[i]);
+				rev_W[rev_spot] = SymbolChar(vertical, v_symbols[j]);
+				break;
+			case 1 :
+				trace = mat_right_dir[j*width+i];
+				i--;
+				rev_Z[rev_spot] = SymbolChar(horizontal, h_symbols[i]);
+				rev_W[rev_spot] = '-';
+				break;
+			case 2 :
+				trace = mat_down_dir[j*width+i];
+				j--;
+				rev_Z[rev_spot] = '-';
+				rev_W[rev_spot] = SymbolChar(vertical, v_symbols[j]);
+				break;
+			default :
+				//unreachable cell, give up rather than take the process down
+				free(mat);
+				free(mat_right);
+				free(mat_down);
+				free(mat_dir);
+				free(mat_right_dir);
+				free(mat_down_dir);
+				free(rev_Z);
+				free(rev_W);
+				free(h_symbols);
+				free(v_symbols);
+				ProfileFree(profile, LeafMemory(width-1, height-1));
+				return TRACE_ERROR;
+		}
+		
+		rev_spot++;
+	}
+
+	ret.index = Z_spot + rev_spot;
+
+	/************ Put rev alignments into Z and W ************/
+
+	rev_Z[rev_spot] = '\0';
+	rev_W[rev_spot] = '\0';
+
+/*
+	printf("Aligning ");
+	printf(rev_Z);
+	printf(" and ");
+	printf(rev_W);
+	printf("\n");
+*/
+
+	for (rev_spot; rev_spot > 0; rev_spot--, Z_spot++) {
+		//printf("%d, %d\n", rev_spot, Z_spot);
+		Z[Z_spot] = rev_Z[rev_spot-1];
+		W[Z_spot] = rev_W[rev_spot-1];
+	}
+
+	free(mat);
+	free(mat_right);
+	free(mat_down);
+	free(mat_dir);
+	free(mat_right_dir);
+	free(mat_down_dir);
+	free(rev_Z);
+	free(rev_W);
+	free(h_symbols);
+	free(v_symbols);
+	if (profile != NULL) {
+		ProfileFree(profile, LeafMemory(width-1, height-1));
+		profile->traceback += Now()-start;
+	}
+
+	//printf("Done\n");
+
+	return ret;
+
+}
+
+PartitionReturn Partition(ScoreReturn ScoreL, ScoreReturn ScoreR, size_t width,
+	int gap, int gap_extend) {
+	size_t i;
+	size_t j=width;
+	int best = INT_MIN;
+	int score;
+	PartitionReturn ret;
+
+	/*
+	for (i=0; i<=width; i++,j--) {
+		printf("%d, ", ScoreL.cur[i]);
+	}
+	j=width;
+	printf("\n");
+	for (i=0; i<=width; i++,j--) {
+		printf("%d, ", ScoreL.cur_down[i]);
+	}
+	j=width;
+	printf("\n");
+	for (i=0; i<=width; i++,j--) {
+		printf("%d, ", ScoreL.cur_right[i]);
+	}
+	j=width;
+	printf("\n");
+	for (i=0; i<=width; i++,j--) {
+		printf("%d, ", ScoreR.cur[i]);
+	}
+	j=width;
+	printf("\n");
+	for (i=0; i<=width; i++,j--) {
+		printf("%d, ", ScoreR.cur_down[i]);
+	}
+	j=width;
+	printf("\n");
+	for (i=0; i<=width; i++,j--) {
+		printf("%d, ", ScoreR.cur_right[i]);
+	}
+	j=width;
+	printf("\n");
+	*/
+
+	//need some way to force other partitions into ending in gap or not
+	for (i=0; i<=width; i++, j--) {
+		//neither gap
+		score = ScoreL.cur[i] + ScoreR.cur[j];
+		if (score > best) {
+			best = score;
+			ret.index = i;
+			ret.left = NONE;
+			ret.right = NONE;
+		}
+
+		//both down gaps. Have to correct scores
+		score = ScoreL.cur_down[i] + ScoreR.cur_down[j] - gap + gap_extend;
+		if (score > best) {
+			best = score;
+			ret.index = i;
+			ret.left = DOWN;
+			ret.right = DOWN;
+		}
+
+		//one is down, other is not
+		score = ScoreL.cur[i] + ScoreR.cur_down[j];
+		if (score > best) {
+			best = score;
+			ret.index = i;
+			ret.left = NONE;
+			ret.right = DOWN;
+		}
+
+		//one is down, other is not
+		score = ScoreL.cur_down[i] + ScoreR.cur[j];
+		if (score > best) {
+			best = score;
+			ret.index = i;
+			ret.left = DOWN;
+			ret.right = NONE;
+		}
+
+		//any combination of right and cur can be represented here
+		score = ScoreL.cur_right[i] + ScoreR.cur[j];
+		if (score > best) {
+			best = score;
+			ret.index = i;
+			ret.left = RIGHT;
+			ret.right = NONE;
+		}
+
+		/*
+		score = ScoreL.cur_right[i] + ScoreR.cur_right[j];
+		if (score > best) {
+			best = score;
+			ret.index = i;
+			ret.left = RIGHT;
+			ret.right = RIGHT;
+		}
+
+		score = ScoreL.cur[i] + ScoreR.cur_right[j];
+		if (score > best) {
+			best = score;
+			ret.index = i;
+			ret.left = NONE;
+			ret.right = RIGHT;
+		}
+		*/
+	}
+	//printf("score = %d, %d\n", best, ret.index);
+
+	free(ScoreL.cur);
+	free(ScoreL.cur_right);
+	free(ScoreL.cur_down);
+	free(ScoreR.cur);
+	free(ScoreR.cur_right);
+	free(ScoreR.cur_down);
+	
+	return ret;
+}
+
+//recursive function for hirshberg algorithm
+HirschReturn Hirsch(char *Z, char *W, size_t Z_spot,
+	Sequence horizontal, size_t hl, size_t hr,
+	Sequence vertical, size_t vl, size_t vr,
+	int match, int mismatch, int gap, int gap_extend,
+	Direction start_direction, Direction end_direction,
+	size_t leaf_cells, int min_score, int depth, Profile *profile,
+	const volatile int *cancel) {
+
+	//get input string lengths
+	size_t width = hr-hl;
+	size_t height = vr-vl;
+
+	//for indexing
+	//size_t i;
+	//size_t j;
+	size_t h_mid;
+	size_t v_mid;
+
+	//alignment scores fo partitioning
+	ScoreReturn ScoreL;
+	ScoreReturn ScoreR;
+
+	PartitionReturn pres;
+
+	HirschReturn ret; //return value
+	HirschReturn res; //result from NeedlemanWunsch
+
+	double start = 0; //when the current phase began, if profiling
+
+	if (cancel != NULL && *cancel)
+		return LOW_SCORE;
+	if (profile != NULL) {
+		profile->nodes++;
+		if (depth > profile->depth)
+			profile->depth = depth;
+	}
+
+	ret.score = 0; //the relative score of this recursion call
+	ret.index = Z_spot; //the absolute position in aligned strings
+	//printf("hor: %d, %d\n", hl, hr);
+	//printf("vert: %d, %d\n", vl, vr);
+	//printf("width: %d\n", width);
+	//printf("height: %d\n", height);
+
+	if (width*height <= leaf_cells || width==1 || height==1) {
+		//printf("Args: %d, %d, %d, %d, %d\n", hl, hr, vl, vr, Z_spot);
+
+		/*		
+		printf("start = %d\n", start_direction);
+		printf("end = %d\n", end_direction);
+
+		for (i=hl; i<hr; i++)  {
+			printf("%c", horizontal[i]);
+		}
+		printf("\n");
+		for (j=vl; j<vr; j++)  {
+			printf("%c", vertical[j]);
+		}
+		printf("\n");
+		*/
+
+		if (profile != NULL)
+			profile->leaves++;
+		res = NeedlemanWunsch(Z, W, Z_spot, horizontal, hl, hr,
+			vertical, vl, vr,
+			match, mismatch, gap, gap_extend,
+			start_direction, end_direction, profile);
+
+		ret.score = res.score;
+		ret.index = res.index;
+	} else {
+		v_mid = (vl+vr)/2; //split vertical in half
+
+		if (profile != NULL)
+			start = Now();
+		//min_score only bounds the whole problem, so the top call passes
+		//it on with the other half of the rows still to come
+		ScoreL = Score(horizontal, hl, hr,
+			vertical, vl, v_mid,
+			match, mismatch, gap, gap_extend, start_direction,
+			min_score, vr-v_mid, profile, cancel);
+		if (profile != NULL) {
+			profile->forward += Now()-start;
+			start = Now();
+		}
+		if (ScoreL.cur == NULL)
+			return ScoreL.pruned ? LOW_SCORE : NEED_MEM;
+		ScoreR = Score(Reversed(horizontal), horizontal.length-hr, horizontal.length-hl,
+			Reversed(vertical), vertical.length-vr, vertical.length-v_mid,
+			match, mismatch, gap, gap_extend, end_direction,
+			min_score, v_mid-vl, profile, cancel);
+		if (profile != NULL) {
+			profile->reverse += Now()-start;
+			start = Now();
+		}
+		if (ScoreR.cur == NULL) {
+			free(ScoreL.cur);
+			free(ScoreL.cur_right);
+			free(ScoreL.cur_down);
+			ProfileFreeRows(profile, width);
+			return ScoreR.pruned ? LOW_SCORE : NEED_MEM;
+		}
+
+		//partition horizontal
+		pres = Partition(ScoreL, ScoreR, width, gap, gap_extend);
+		h_mid = hl+pres.index;
+		if (profile != NULL) {
+			ProfileFreeRows(profile, width);
+			ProfileFreeRows(profile, width);
+			profile->partition += Now()-start;
+		}
+		//printf("pres.left = %d\n", pres.left);
+		//printf("pres.right = %d\n", pres.right);
+		
+		/*
+		for (i=hl; i<hr; i++)  {
+			printf("%c", horizontal[i]);
+		}
+		printf("\n");
+		printf("%d\n", h_mid);
+
+		for (j=vl; j<vr; j++)  {
+			printf("%c", vertical[j]);
+		}
+		printf("\n");
+		*/
+		/*
+		printf("hor: %d, %d, %d\n", hl, h_mid, hr);
+		printf("vert: %d, %d, %d\n", vl, v_mid, vr);
+		printf(rev_hor);
+		printf("\n");
+		printf(rev_vert);
+		printf("\n");
+		*/
+
+		res = Hirsch(Z, W, Z_spot,
+			horizontal, hl, h_mid,
+			vertical, vl, v_mid,
+			match, mismatch, gap, gap_extend,
+			start_direction, pres.left, leaf_cells, INT_MIN, depth+1, profile, cancel);
+		if (res.index == NEED_MEM.index || res.index == LOW_SCORE.index
+			|| res.index == TRACE_ERROR.index)
+			return res;
+		ret.score = res.score;
+		Z_spot = res.index;
+
+		res = Hirsch(Z, W, Z_spot,
+			horizontal, h_mid, hr,
+			vertical, v_mid, vr,
+			match, mismatch, gap, gap_extend,
+			pres.right, end_direction, leaf_cells, INT_MIN, depth+1, profile, cancel);
+		if (res.index == NEED_MEM.index || res.index == LOW_SCORE.index
+			|| res.index == TRACE_ERROR.index)
+			return res;
+		ret.score += res.score;
+		ret.index = res.index;
+
+		//have to remember that this is actually 1 gap, not 2
+		if (pres.left == DOWN && pres.right == DOWN)
+			ret.score += gap_extend-gap;
+	}
+
+	return ret;
+
+}
+
+/******************** Wavefront alignment *******************
+* The WFA engine works on penalties rather than scores. Each column
+* of an alignment uses one character of each string unless it is a
+* gap, so 2*score = match*(len1+len2) - penalty, where a mismatch
+* costs 2*(match-mismatch), opening a gap costs 2*(gap_extend-gap)
+* and every gap character costs match-2*gap_extend. The wavefront
+* for penalty s holds, for every diagonal k = h-v, the furthest
+* horizontal offset h reachable with exactly that penalty, so the
+* work grows with the edit score rather than the matrix size.
+*
+* WFA itself lets deletions follow insertions directly. The engine
+* is only used when a mismatch is never worse than such a pair,
+* in which case the pair can always be folded into a mismatch
+* without lowering the score (see FoldAdjacentGaps).
+*/
+
+#define WFA_NULL (INT_MIN/2)
+
+//wavefronts allowed to be kept for a full traceback, and the part
+//of the DP matrix the engine may touch before falling back to it
+#define WFA_FULL_CELLS 1000000
+#define WFA_DP_FRACTION 8
+
+//part of max_cells after which a pass that looks set to go over it
+//gives up, so divergent pairs fall back to the DP matrix early
+#define WFA_PROBE_FRACTION 16
+
+//wavefronts of a full traceback at most
+#define WFA_MEMORY (3*WFA_FULL_CELLS*sizeof(int))
+
+//WFAScore result when the penalty would go over max_penalty
+#define WFA_PRUNED -2
+
+//highest penalty an alignment scoring at least min_score can have
+long MaxPenalty(int min_score, size_t width, size_t height, int match) {
+	if (min_score == INT_MIN)
+		return LONG_MAX;
+	return (long)match*(long)(width+height) - 2*(long)min_score;
+}
+
+typedef struct {
+	int mismatch;
+	int gap_open;
+	int gap_extend;
+	bool valid;
+} Penalties;
+
+typedef struct {
+	int lo; //diagonal range, empty when lo > hi
+	int hi;
+	int *M; //best offset in any state
+	int *I; //best offset ending in a right gap
+	int *D; //best offset ending in a down gap
+} Wavefront;
+
+typedef struct {
+	const char *horizontal;
+	size_t hl;
+	int width;
+	const char *vertical;
+	size_t vl;
+	int height;
+	Penalties pen;
+	Direction start_direction;
+
+	//every wavefront for a traceback, or a ring of the last few
+	Wavefront *wfs;
+	int size;
+	bool full;
+
+	int score; //highest penalty computed so far
+	long cells; //wavefront cells computed so far
+} WFA;
+
+typedef struct {
+	int score; //penalty of the two halves put together
+	int score_forward;
+	int score_reverse;
+	int k;
+	int offset;
+	Direction direction; //NONE, or the gap spanning the breakpoint
+} Breakpoint;
+
+const Wavefront EMPTY_WAVEFRONT = {
+	0, -1, NULL, NULL, NULL
+};
+
+//converts scores into WFA penalties
+Penalties GetPenalties(int match, int mismatch, int gap, int gap_extend) {
+	Penalties pen;
+
+	pen.mismatch = 2*(match-mismatch);
+	pen.gap_open = 2*(gap_extend-gap);
+	pen.gap_extend = match-2*gap_extend;
+	pen.valid = pen.mismatch > 0 && pen.gap_extend > 0 && pen.gap_open >= 0
+		&& pen.mismatch <= 2*pen.gap_extend;
+
+	return pen;
+}
+
+//turns a WFA penalty back into a score
+int PenaltyToScore(int penalty, size_t width, size_t height, int match) {
+	return (int)(((long long)match*(long long)(width+height) - penalty)/2);
+}
+
+//how far back in penalty a wavefront may look, either to be computed
+//or to meet the opposite wavefront on the optimal path
+int WFAScope(Penalties pen) {
+	return mymax(pen.mismatch, pen.gap_open+pen.gap_extend)+pen.gap_open;
+}
+
+Wavefront *GetWavefront(WFA *wfa, int s) {
+	if (s < 0 || s > wfa->score)
+		return NULL;
+	if (wfa->full)
+		return &wfa->wfs[s];
+	if (s <= wfa->score-wfa->size)
+		return NULL;
+	return &wfa->wfs[s%wfa->size];
+}
+
+static __inline int WavefrontM(const Wavefront *wf, int k) {
+	return (wf==NULL || k < wf->lo || k > wf->hi) ? WFA_NULL : wf->M[k-wf->lo];
+}
+
+static __inline int WavefrontI(const Wavefront *wf, int k) {
+	return (wf==NULL || k < wf->lo || k > wf->hi) ? WFA_NULL : wf->I[k-wf->lo];
+}
+
+static __inline int WavefrontD(const Wavefront *wf, int k) {
+	return (wf==NULL || k < wf->lo || k > wf->hi) ? WFA_NULL : wf->D[k-wf->lo];
+}
+
+//offsets leaving the matrix are dropped
+static __inline int WFAValid(const WFA *wfa, int k, int h) {
+	if (h < 0 || h > wfa->width || h-k < 0 || h-k > wfa->height)
+		return WFA_NULL;
+	return h;
+}
+
+void FreeWFA(WFA *wfa) {
+	int s;
+	for (s=0; s<wfa->size; s++)
+		free(wfa->wfs[s].M);
+	free(wfa->wfs);
+	wfa->wfs = NULL;
+}
+
+//sets up penalty 0, with the start direction deciding whether the
+//path is already inside a gap (whose opening was paid for elsewhere)
+bool InitWFA(WFA *wfa, const char *horizontal, size_t hl, size_t hr,
+	const char *vertical, size_t vl, size_t vr,
+	Penalties pen, Direction start_direction, bool full) {
+
+	int s;
+	Wavefront *wf;
+
+	wfa->horizontal = horizontal;
+	wfa->hl = hl;
+	wfa->width = hr-hl;
+	wfa->vertical = vertical;
+	wfa->vl = vl;
+	wfa->height = vr-vl;
+	wfa->pen = pen;
+	wfa->start_direction = start_direction;
+	wfa->full = full;
+	wfa->size = full ? 64 : WFAScope(pen)+1;
+	wfa->score = -1;
+	wfa->cells = 0;
+
+	wfa->wfs = malloc(wfa->size*sizeof(Wavefront));
+	if (wfa->wfs==NULL)
+		return false;
+	for (s=0; s<wfa->size; s++)
+		wfa->wfs[s] = EMPTY_WAVEFRONT;
+
+	wf = &wfa->wfs[0];
+	wf->M = malloc(3*sizeof(int));
+	if (wf->M==NULL) {
+		FreeWFA(wfa);
+		return false;
+	}
+	wf->I = wf->M+1;
+	wf->D = wf->M+2;
+	wf->lo = 0;
+	wf->hi = 0;
+	wf->M[0] = 0;
+	wf->I[0] = start_direction==RIGHT ? 0 : WFA_NULL;
+	wf->D[0] = start_direction==DOWN ? 0 : WFA_NULL;
+	wfa->score = 0;
+
+	while (wf->M[0] < wfa->width && wf->M[0] < wfa->height
+		&& horizontal[hl+wf->M[0]] == vertical[vl+wf->M[0]])
+		wf->M[0]++;
+
+	return true;
+}
+
+//the three ways of reaching diagonal k with penalty s,
+//shared by the forward pass and the traceback
+void WFASources(WFA *wfa, int s, int k, int *mis, int *ins, int *del) {
+	Wavefront *wf_mis = GetWavefront(wfa, s-wfa->pen.mismatch);
+	Wavefront *wf_open = GetWavefront(wfa, s-wfa->pen.gap_open-wfa->pen.gap_extend);
+	Wavefront *wf_ext = GetWavefront(wfa, s-wfa->pen.gap_extend);
+
+	*mis = WFAValid(wfa, k, WavefrontM(wf_mis, k)+1);
+	*ins = WFAValid(wfa, k, mymax(WavefrontM(wf_open, k-1), WavefrontI(wf_ext, k-1))+1);
+	*del = WFAValid(wfa, k, mymax(WavefrontM(wf_open, k+1), WavefrontD(wf_ext, k+1)));
+}
+
+//computes the wavefront for the next penalty
+bool WFANext(WFA *wfa) {
+	int s = wfa->score+1;
+	int i;
+	int k;
+	int h;
+	int v;
+	int mis;
+	int ins;
+	int del;
+	int lo = INT_MAX;
+	int hi = INT_MIN;
+	Wavefront *wf;
+	Wavefront *src[3];
+	Wavefront *grown;
+
+	//make room for the new wavefront
+	if (wfa->full && s >= wfa->size) {
+		grown = realloc(wfa->wfs, 2*wfa->size*sizeof(Wavefront));
+		if (grown==NULL)
+			return false;
+		wfa->wfs = grown;
+		for (k=wfa->size; k<2*wfa->size; k++)
+			wfa->wfs[k] = EMPTY_WAVEFRONT;
+		wfa->size *= 2;
+	}
+
+	//new diagonals come from gaps on either side
+	src[0] = GetWavefront(wfa, s-wfa->pen.mismatch);
+	src[1] = GetWavefront(wfa, s-wfa->pen.gap_open-wfa->pen.gap_extend);
+	src[2] = GetWavefront(wfa, s-wfa->pen.gap_extend);
+	if (src[0]!=NULL && src[0]->lo <= src[0]->hi) {
+		lo = src[0]->lo;
+		hi = src[0]->hi;
+	}
+	for (i=1; i<3; i++) {
+		if (src[i]!=NULL && src[i]->lo <= src[i]->hi) {
+			lo = lo < src[i]->lo-1 ? lo : src[i]->lo-1;
+			hi = hi > src[i]->hi+1 ? hi : src[i]->hi+1;
+		}
+	}
+	lo = mymax(lo, -wfa->height);
+	hi = hi < wfa->width ? hi : wfa->width;
+	wf = wfa->full ? &wfa->wfs[s] : &wfa->wfs[s%wfa->size];
+	free(wf->M);
+	*wf = EMPTY_WAVEFRONT;
+	wfa->score = s;
+
+	if (lo > hi)
+		return true;
+
+	wf->M = malloc(3*(hi-lo+1)*sizeof(int));
+	if (wf->M==NULL)
+		return false;
+	wf->I = wf->M+(hi-lo+1);
+	wf->D = wf->I+(hi-lo+1);
+	wf->lo = lo;
+	wf->hi = hi;
+	wfa->cells += hi-lo+1;
+
+	for (k=lo; k<=hi; k++) {
+		WFASources(wfa, s, k, &mis, &ins, &del);
+		wf->I[k-lo] = ins;
+		wf->D[k-lo] = del;
+		h = mymax(mis, mymax(ins, del));
+
+		//extend along matches
+		if (h >= 0) {
+			v = h-k;
+			while (h < wfa->width && v < wfa->height
+				&& wfa->horizontal[wfa->hl+h] == wfa->vertical[wfa->vl+v]) {
+				h++;
+				v++;
+			}
+		}
+		wf->M[k-lo] = h;
+	}
+
+	return true;
+}
+
+//whether the path has reached the bottom right corner in end_direction
+bool WFADone(WFA *wfa, Direction end_direction) {
+	Wavefront *wf = GetWavefront(wfa, wfa->score);
+	int k = wfa->width-wfa->height;
+
+	switch (end_direction) {
+		case RIGHT :
+			return WavefrontI(wf, k) == wfa->width;
+		case DOWN :
+			return WavefrontD(wf, k) == wfa->width;
+		default :
+			return WavefrontM(wf, k) == wfa->width;
+	}
+}
+
+//furthest antidiagonal h+v reached by a wavefront
+int WFAReach(WFA *wfa) {
+	Wavefront *wf = GetWavefront(wfa, wfa->score);
+	int k;
+	int best = 0;
+
+	if (wf==NULL)
+		return 0;
+	for (k=wf->lo; k<=wf->hi; k++)
+		if (wf->M[k-wf->lo] >= 0)
+			best = mymax(best, 2*wf->M[k-wf->lo]-k);
+	return best;
+}
+
+//whether a pass that has filled cells and reached reach of the total
+//antidiagonals looks set to go over max_cells. Wavefronts widen about
+//linearly with the penalty, and on divergent pairs so does the reach,
+//so the cells grow with the square of the reach
+bool WFAHopeless(long cells, long reach, long total, long max_cells) {
+	double left = (double)total/mymax(reach, 1);
+
+	return cells*left*left > (double)max_cells;
+}
+
+//score-only wavefront pass over the whole of both strings.
+//returns -1 when it runs out of memory, passes max_cells or looks
+//set to (see WFAHopeless)
+int WFAScore(const char *horizontal, size_t width,
+	const char *vertical, size_t height,
+	Penalties pen, long max_cells, long max_penalty) {
+
+	WFA wfa;
+	long probe = max_cells/WFA_PROBE_FRACTION; //cells at the next check
+	int ret;
+
+	if (!InitWFA(&wfa, horizontal, 0, width, vertical, 0, height, pen, ANY, false))
+		return -1;
+
+	while (!WFADone(&wfa, ANY)) {
+		if (wfa.score >= max_penalty) {
+			FreeWFA(&wfa);
+			return WFA_PRUNED;
+		}
+		if (wfa.cells > probe) {
+			if (WFAHopeless(wfa.cells, WFAReach(&wfa), (long)width+height, max_cells)) {
+				FreeWFA(&wfa);
+				return -1;
+			}
+			probe *= 2;
+		}
+		if (wfa.cells > max_cells || !WFANext(&wfa)) {
+			FreeWFA(&wfa);
+			return -1;
+		}
+	}
+	ret = wfa.score;
+	FreeWFA(&wfa);
+
+	return ret;
+}
+
+//keeps every wavefront and traces the path back, writing it to
+//Z and W from Z_spot. The returned score is a penalty
+HirschReturn WFATrace(char *Z, char *W, size_t Z_spot,
+	const char *horizontal, size_t hl, size_t hr,
+	const char *vertical, size_t vl, size_t vr,
+	Penalties pen, Direction start_direction, Direction end_direction) {
+
+	WFA wfa;
+	HirschReturn ret;
+
+	int s;
+	int k;
+	int h;
+	int mis;
+	int ins;
+	int del;
+	int from;
+	Direction trace;
+
+	//backwards alignments
+	size_t rev_spot = 0;
+	char *rev_Z = malloc((hr-hl+vr-vl+1)*sizeof(char));
+	char *rev_W = malloc((hr-hl+vr-vl+1)*sizeof(char));
+
+	if (rev_Z==NULL || rev_W==NULL
+		|| !InitWFA(&wfa, horizontal, hl, hr, vertical, vl, vr, pen, start_direction, true)) {
+		free(rev_Z);
+		free(rev_W);
+		return NEED_MEM;
+	}
+
+	while (!WFADone(&wfa, end_direction)) {
+		if (!WFANext(&wfa)) {
+			FreeWFA(&wfa);
+			free(rev_Z);
+			free(rev_W);
+			return NEED_MEM;
+		}
+	}
+	ret.score = wfa.score;
+
+	/******************** Traceback ***********************/
+	s = wfa.score;
+	k = wfa.width-wfa.height;
+	h = wfa.width;
+	trace = end_direction==RIGHT || end_direction==DOWN ? end_direction : NONE;
+	while (s > 0 || k != 0 || h != 0) {
+		switch (trace) {
+			case NONE :
+				if (s == 0) {
+					from = 0;
+				} else {
+					WFASources(&wfa, s, k, &mis, &ins, &del);
+					from = mymax(mis, mymax(ins, del));
+				}
+				for (; h > from; h--, rev_spot++) {
+					rev_Z[rev_spot] = horizontal[hl+h-1];
+					rev_W[rev_spot] = vertical[vl+h-k-1];
+				}
+				if (s == 0) {
+					break;
+				} else if (from == mis) {
+					rev_Z[rev_spot] = horizontal[hl+h-1];
+					rev_W[rev_spot] = vertical[vl+h-k-1];
+					rev_spot++;
+					h--;
+					s -= pen.mismatch;
+				} else if (from == ins) {
+					trace = RIGHT;
+				} else {
+					trace = DOWN;
+				}
+				break;
+			case RIGHT :
+				rev_Z[rev_spot] = horizontal[hl+h-1];
+				rev_W[rev_spot] = '-';
+				rev_spot++;
+				if (WavefrontM(GetWavefront(&wfa, s-pen.gap_open-pen.gap_extend), k-1)+1 == h) {
+					s -= pen.gap_open+pen.gap_extend;
+					trace = NONE;
+				} else {
+					s -= pen.gap_extend;
+				}
+				h--;
+				k--;
+				break;
+			case DOWN :
+				rev_Z[rev_spot] = '-';
+				rev_W[rev_spot] = vertical[vl+h-k-1];
+				rev_spot++;
+				if (WavefrontM(GetWavefront(&wfa, s-pen.gap_open-pen.gap_extend), k+1) == h) {
+					s -= pen.gap_open+pen.gap_extend;
+					trace = NONE;
+				} else {
+					s -= pen.gap_extend;
+				}
+				k++;
+				break;
+			default :
+				break;
+		}
+	}
+	FreeWFA(&wfa);
+
+	ret.index = Z_spot + rev_spot;
+	for (; rev_spot > 0; rev_spot--, Z_spot++) {
+		Z[Z_spot] = rev_Z[rev_spot-1];
+		W[Z_spot] = rev_W[rev_spot-1];
+	}
+
+	free(rev_Z);
+	free(rev_W);
+
+	return ret;
+}
+
+//records a meeting point if it beats the best one so far
+void WFAMeet(Breakpoint *bp, int score, int score_forward, int score_reverse,
+	int k, int offset, Direction direction) {
+	if (score < bp->score) {
+		bp->score = score;
+		bp->score_forward = score_forward;
+		bp->score_reverse = score_reverse;
+		bp->k = k;
+		bp->offset = offset;
+		bp->direction = direction;
+	}
+}
+
+//checks a forward wavefront against a reverse one for a better breakpoint.
+//paths meeting inside the same gap only pay for opening it once
+void WFAOverlap(Wavefront *forward, int score_forward,
+	Wavefront *reverse, int score_reverse,
+	int width, int height, Penalties pen, Breakpoint *bp) {
+
+	int k;
+	int kr;
+	int lo;
+	int hi;
+	int score = score_forward+score_reverse;
+
+	if (forward==NULL || reverse==NULL)
+		return;
+
+	//reverse diagonal kr lines up with forward diagonal width-height-kr
+	lo = mymax(forward->lo, width-height-reverse->hi);
+	hi = forward->hi < width-height-reverse->lo ? forward->hi : width-height-reverse->lo;
+
+	for (k=lo; k<=hi; k++) {
+		kr = width-height-k;
+		if (WavefrontM(forward, k) >= 0 && WavefrontM(reverse, kr) >= 0
+			&& WavefrontM(forward, k)+WavefrontM(reverse, kr) >= width)
+			WFAMeet(bp, score, score_forward, score_reverse,
+				k, WavefrontM(forward, k), NONE);
+		if (WavefrontI(forward, k) >= 0 && WavefrontI(reverse, kr) >= 0
+			&& WavefrontI(forward, k)+WavefrontI(reverse, kr) >= width)
+			WFAMeet(bp, score-pen.gap_open, score_forward, score_reverse,
+				k, WavefrontI(forward, k), RIGHT);
+		if (WavefrontD(forward, k) >= 0 && WavefrontD(reverse, kr) >= 0
+			&& WavefrontD(forward, k)+WavefrontD(reverse, kr) >= width)
+			WFAMeet(bp, score-pen.gap_open, score_forward, score_reverse,
+				k, WavefrontD(forward, k), DOWN);
+	}
+}
+
+//runs wavefronts from both corners until they meet on the optimal path.
+//returns false when out of memory, past max_cells or set to pass it
+bool WFABreakpoint(const char *horizontal, const char *rev_hor, size_t hl, size_t hr, size_t hn,
+	const char *vertical, const char *rev_vert, size_t vl, size_t vr, size_t vn,
+	Penalties pen, Direction start_direction, Direction end_direction,
+	long max_cells, Breakpoint *bp) {
+
+	WFA forward;
+	WFA reverse;
+	int width = hr-hl;
+	int height = vr-vl;
+	int scope = WFAScope(pen);
+	int s;
+	int min_score;
+	int reach_forward;
+	int reach_reverse;
+	bool ok = true;
+
+	if (!InitWFA(&forward, horizontal, hl, hr, vertical, vl, vr,
+		pen, start_direction, false))
+		return false;
+	if (!InitWFA(&reverse, rev_hor, hn-hr, hn-hl, rev_vert, vn-vr, vn-vl,
+		pen, end_direction, false)) {
+		FreeWFA(&forward);
+		return false;
+	}
+	bp->score = INT_MAX;
+
+	//no overlap is possible until the antidiagonals cross
+	reach_forward = WFAReach(&forward);
+	reach_reverse = WFAReach(&reverse);
+	while (reach_forward+reach_reverse < width+height) {
+		if (forward.cells+reverse.cells > max_cells/WFA_PROBE_FRACTION
+			&& WFAHopeless(forward.cells+reverse.cells, reach_forward+reach_reverse,
+			width+height, max_cells)) {
+			ok = false;
+			break;
+		}
+		if (forward.cells+reverse.cells > max_cells || !WFANext(&forward)) {
+			ok = false;
+			break;
+		}
+		reach_forward = mymax(reach_forward, WFAReach(&forward));
+		if (reach_forward+reach_reverse >= width+height)
+			break;
+		if (!WFANext(&reverse)) {
+			ok = false;
+			break;
+		}
+		reach_reverse = mymax(reach_reverse, WFAReach(&reverse));
+	}
+
+	//look for the best meeting point until no better one can appear
+	while (ok) {
+		min_score = mymax(0, reverse.score-scope);
+		if (bp->score != INT_MAX && forward.score+min_score-pen.gap_open >= bp->score)
+			break;
+		for (s=min_score; s<=reverse.score; s++) {
+			WFAOverlap(GetWavefront(&forward, forward.score), forward.score,
+				GetWavefront(&reverse, s), s, width, height, pen, bp);
+		}
+		if (forward.cells+reverse.cells > max_cells || !WFANext(&forward)) {
+			ok = false;
+			break;
+		}
+
+		min_score = mymax(0, forward.score-scope);
+		if (bp->score != INT_MAX && min_score+reverse.score-pen.gap_open >= bp->score)
+			break;
+		for (s=min_score; s<=forward.score; s++) {
+			WFAOverlap(GetWavefront(&forward, s), s,
+				GetWavefront(&reverse, reverse.score), reverse.score,
+				width, height, pen, bp);
+		}
+		if (forward.cells+reverse.cells > max_cells || !WFANext(&reverse)) {
+			ok = false;
+			break;
+		}
+	}
+
+	FreeWFA(&forward);
+	FreeWFA(&reverse);
+
+	return ok;
+}
+
+//recursive bidirectional WFA (BiWFA), splitting on breakpoints found
+//by WFABreakpoint the way Hirsch splits on Partition. Halves whose
+//penalty is known to be small are traced back directly
+HirschReturn BiWFA(char *Z, char *W, size_t Z_spot,
+	const char *horizontal, const char *rev_hor, size_t hl, size_t hr, size_t hn,
+	const char *vertical, const char *rev_vert, size_t vl, size_t vr, size_t vn,
+	Penalties pen, Direction start_direction, Direction end_direction,
+	int max_score, long max_cells) {
+
+	Breakpoint bp;
+	HirschReturn ret;
+	HirschReturn res;
+	size_t h_mid;
+	size_t v_mid;
+	long diagonals = 2*(long)max_score/pen.gap_extend+3;
+
+	if (max_score >= 0 && (max_score+1)*diagonals <= WFA_FULL_CELLS) {
+		return WFATrace(Z, W, Z_spot, horizontal, hl, hr, vertical, vl, vr,
+			pen, start_direction, end_direction);
+	}
+
+	if (!WFABreakpoint(horizontal, rev_hor, hl, hr, hn,
+		vertical, rev_vert, vl, vr, vn,
+		pen, start_direction, end_direction, max_cells, &bp))
+		return NEED_MEM;
+
+	h_mid = hl+bp.offset;
+	v_mid = vl+bp.offset-bp.k;
+
+	//a breakpoint in a corner would not make the problem any smaller
+	if ((h_mid==hl && v_mid==vl) || (h_mid==hr && v_mid==vr)) {
+		return WFATrace(Z, W, Z_spot, horizontal, hl, hr, vertical, vl, vr,
+			pen, start_direction, end_direction);
+	}
+
+	ret = BiWFA(Z, W, Z_spot,
+		horizontal, rev_hor, hl, h_mid, hn,
+		vertical, rev_vert, vl, v_mid, vn,
+		pen, start_direction, bp.direction,
+		bp.score_forward, LONG_MAX);
+	if (ret.index == NEED_MEM.index)
+		return NEED_MEM;
+
+	res = BiWFA(Z, W, ret.index,
+		horizontal, rev_hor, h_mid, hr, hn,
+		vertical, rev_vert, v_mid, vr, vn,
+		pen, bp.direction, end_direction,
+		bp.score_reverse+pen.gap_open, LONG_MAX);
+	if (res.index == NEED_MEM.index)
+		return NEED_MEM;
+
+	ret.score += res.score;
+	ret.index = res.index;
+
+	return ret;
+}
+
+//WFA lets a right gap and a down gap touch, which this module does
+//not. Folds each such pair into a single mismatch column, which never
+//lowers the score when the penalties are valid. Returns the new length
+size_t FoldAdjacentGaps(char *Z, char *W, size_t length) {
+	size_t i;
+	size_t spot = 0;
+
+	for (i=0; i<length; i++) {
+		if (spot > 0 && ((Z[i] == '-' && W[spot-1] == '-')
+			|| (W[i] == '-' && Z[spot-1] == '-'))) {
+			if (Z[spot-1] == '-')
+				Z[spot-1] = Z[i];
+			else
+				W[spot-1] = W[i];
+		} else {
+			Z[spot] = Z[i];
+			W[spot] = W[i];
+			spot++;
+		}
+	}
+
+	return spot;
+}
+
+//global alignment with the wavefront engine. Returns NEED_MEM if the
+//penalties are unsuitable or the alignment is too divergent, in which
+//case the caller should fall back to Hirsch
+HirschReturn WFAAlign(char *Z, char *W,
+	const char *horizontal, const char *rev_hor, size_t width,
+	const char *vertical, const char *rev_vert, size_t height,
+	int match, int mismatch, int gap, int gap_extend, int min_score) {
+
+	HirschReturn ret;
+	Penalties pen = GetPenalties(match, mismatch, gap, gap_extend);
+	long max_cells = (long)(width+1)*(long)(height+1)/WFA_DP_FRACTION;
+	int hint = -1; //penalty of the alignment, if known
+
+	if (!pen.valid)
+		return NEED_MEM;
+
+	//scoring first rules out alignments below min_score cheaply, and
+	//the penalty it finds lets small alignments go straight to a traceback
+	if (min_score != INT_MIN) {
+		hint = WFAScore(horizontal, width, vertical, height,
+			pen, max_cells, MaxPenalty(min_score, width, height, match));
+		if (hint == WFA_PRUNED)
+			return LOW_SCORE;
+		if (hint < 0)
+			return NEED_MEM;
+	}
+
+	ret = BiWFA(Z, W, 0,
+		horizontal, rev_hor, 0, width, width,
+		vertical, rev_vert, 0, height, height,
+		pen, ANY, ANY, hint, max_cells);
+	if (ret.index == NEED_MEM.index)
+		return NEED_MEM;
+
+	ret.score = PenaltyToScore(ret.score, width, height, match);
+	ret.index = FoldAdjacentGaps(Z, W, ret.index);
+
+	return ret;
+}
+
+/************************* Banded DP ************************
+* The band engine fills only the cells within b diagonals of the core
+* ones joining the two corners, doubling b as Ukkonen does until the
+* band provably holds an optimal alignment. An alignment that leaves
+* the band has at least 2(b+1) more gap characters than the lengths
+* differ by, which caps its score; once the banded score reaches that
+* cap it is exact. The traceback then runs over the band alone, so
+* mostly similar pairs cost close to their length times b. A band as
+* wide as the matrix, one that would take the bands tried past a part
+* of the matrix, or one whose traceback would not fit the leaf budget,
+* is left to Score and Hirsch.
+*/
+
+//first half width of the band, and the part of the matrix the bands
+//tried may fill before giving up on them
+#define BAND_START 32
+#define BAND_DP_FRACTION 4
+
+//best score of an alignment with the given number of gap characters
+//(in at least one run each way) and as many diagonal steps as remain
+static __inline long long GapPathBound(long long gaps, size_t width, size_t height,
+	int match, int mismatch, int gap, int gap_extend) {
+
+	long long diagonal = ((long long)width+height-gaps)/2;
+
+	//fewest runs is best unless opening one costs less than extending
+	if (gap > gap_extend)
+		return diagonal*mymax(match, mismatch) + gaps*gap;
+	return diagonal*mymax(match, mismatch) + 2*(long long)(gap-gap_extend) + gaps*gap_extend;
+}
+
+//best score any alignment leaving a band of half width b can reach
+long long BandBound(size_t width, size_t height, size_t b,
+	int match, int mismatch, int gap, int gap_extend) {
+
+	long long least = (long long)(height-width) + 2*((long long)b+1);
+	long long most = (long long)width+height;
+	long long bound;
+
+	//linear in the number of gap characters, so best at one end
+	bound = GapPathBound(least, width, height, match, mismatch, gap, gap_extend);
+	if (GapPathBound(most, width, height, match, mismatch, gap, gap_extend) > bound)
+		bound = GapPathBound(most, width, height, match, mismatch, gap, gap_extend);
+	return bound;
+}
+
+//cells a row of the band holds
+size_t BandWidth(size_t width, size_t height, size_t b) {
+	return height-width+2*b+1;
+}
+
+//score of the best alignment within b diagonals of the core, the
+//horizontal string being no longer, filling rows first to last of the
+//band (the score is only the corner's once last is the height). With
+//rows, every row a multiple of every is kept there, 3*(band+2) ints
+//each, and a first row above 0 is read back from it rather than
+//filled. With trace it also records, one byte a cell from row first
+//on, the state a diagonal step came from (bits 0-1: 0 diagonal, 1
+//right, 2 down) and whether a step down followed one down (bit 2) or
+//a step right one right (bit 3), and end_state gets the state the
+//best alignment ends in. INT_MIN when out of memory or cancelled
+int BandScore(Sequence horizontal, Sequence vertical, size_t b,
+	int match, int mismatch, int gap, int gap_extend,
+	size_t first, size_t last, int *rows, size_t every,
+	unsigned char *trace, int *end_state, Profile *profile,
+	const volatile int *cancel) {
+
+	size_t width = horizontal.length;
+	size_t height = vertical.length;
+	size_t band = BandWidth(width, height, b);
+	size_t bytes = 6*(band+2)*sizeof(int) + (width+1)*sizeof(unsigned char);
+
+	//rows of the band with a cell of padding each side: cell o of row
+	//j is column j+o-1+width-height-b
+	int *cur = malloc((band+2)*sizeof(int));
+	int *prev = malloc((band+2)*sizeof(int));
+	int *cur_right = malloc((band+2)*sizeof(int));
+	int *prev_right = malloc((band+2)*sizeof(int));
+	int *cur_down = malloc((band+2)*sizeof(int));
+	int *prev_down = malloc((band+2)*sizeof(int));
+	int *temp;
+	unsigned char *symbols = malloc((width+1)*sizeof(unsigned char));
+	int *kept;
+	unsigned char from;
+	int symbol;
+	long long base;
+	size_t lo;
+	size_t hi;
+	size_t i;
+	size_t j;
+	size_t o;
+	int ret;
+
+	if (cur==NULL || prev==NULL || cur_right==NULL
+		|| prev_right==NULL || cur_down==NULL || prev_down==NULL
+		|| symbols==NULL) {
+
+		free(cur);
+		free(prev);
+		free(cur_right);
+		free(prev_right);
+		free(cur_down);
+		free(prev_down);
+		free(symbols);
+		return INT_MIN;
+	}
+	ProfileAlloc(profile, bytes);
+	Unpack(horizontal, 0, width, symbols);
+
+	for (j=first; j<=last; j++) {
+		temp = prev; prev = cur; cur = temp;
+		temp = prev_right; prev_right = cur_right; cur_right = temp;
+		temp = prev_down; prev_down = cur_down; cur_down = temp;
+		kept = rows != NULL ? rows + 3*(band+2)*(j/every) : NULL;
+		if (j == first && j > 0) {
+			memcpy(cur, kept, (band+2)*sizeof(int));
+			memcpy(cur_right, kept+band+2, (band+2)*sizeof(int));
+			memcpy(cur_down, kept+2*(band+2), (band+2)*sizeof(int));
+			continue;
+		}
+
+		for (o=0; o<band+2; o++) {
+			cur[o] = INT_MIN/4;
+			cur_right[o] = INT_MIN/4;
+			cur_down[o] = INT_MIN/4;
+		}
+
+		//the previous row starts a column earlier, so (j-1, i-1) is
+		//at o in it and (j-1, i) at o+1
+		base = (long long)j+width-height-b;
+		lo = base > 0 ? base : 0;
+		hi = j+b < width ? j+b : width;
+		symbol = j > 0 ? Symbol(vertical, j-1) : -1;
+		for (i=lo; i<=hi; i++) {
+			o = i-base+1;
+			from = 0;
+			if (j == 0 && i == 0)
+				cur[o] = 0;
+
+			if (j > 0 && i > 0) {
+				if (prev_right[o] > prev[o])
+					from = 1;
+				if (prev_down[o] > (from ? prev_right[o] : prev[o]))
+					from = 2;
+				cur[o] = (from == 0 ? prev[o] : from == 1 ? prev_right[o] : prev_down[o])
+					+ (symbols[i-1] == symbol ? match : mismatch);
+			}
+			if (j > 0) {
+				cur_down[o] = mymax(prev[o+1] + gap, prev_down[o+1] + gap_extend);
+				if (prev_down[o+1] + gap_extend > prev[o+1] + gap)
+					from |= 4;
+			}
+			if (i > 0) {
+				cur_right[o] = mymax(cur[o-1] + gap, cur_right[o-1] + gap_extend);
+				if (cur_right[o-1] + gap_extend > cur[o-1] + gap)
+					from |= 8;
+			}
+			if (trace != NULL)
+				trace[(j-first)*band+o-1] = from;
+		}
+
+		if (kept != NULL && j%every == 0) {
+			memcpy(kept, cur, (band+2)*sizeof(int));
+			memcpy(kept+band+2, cur_right, (band+2)*sizeof(int));
+			memcpy(kept+2*(band+2), cur_down, (band+2)*sizeof(int));
+		}
+		if (j%PRUNE_ROWS == 0 && cancel != NULL && *cancel)
+			break;
+	}
+
+	o = b+1; //column width of the last row
+	ret = mymax(cur[o], mymax(cur_right[o], cur_down[o]));
+	if (end_state != NULL)
+		*end_state = ret == cur[o] ? 0 : ret == cur_right[o] ? 1 : 2;
+	if (j <= last)
+		ret = INT_MIN;
+
+	free(cur);
+	free(prev);
+	free(cur_right);
+	free(prev_right);
+	free(cur_down);
+	free(prev_down);
+	free(symbols);
+	ProfileFree(profile, bytes);
+	if (profile != NULL)
+		profile->score_cells += (long long)band*(last-first);
+
+	return ret;
+}
+
+//the smallest doubling of BAND_START whose band provably holds an
+//optimal alignment, with its score in score (BELOW_MIN_SCORE once
+//even the bound falls short of min_score). 0 when only a band as wide
+//as the matrix would, or the next doubling would take the cells filled
+//past 1/BAND_DP_FRACTION of it, divergent pairs being cheaper in full
+size_t ProveBand(Sequence horizontal, Sequence vertical,
+	int match, int mismatch, int gap, int gap_extend,
+	int min_score, int *score, Profile *profile, const volatile int *cancel) {
+
+	size_t width = horizontal.length;
+	size_t height = vertical.length;
+	long long max_cells = (long long)(width+1)*(long long)(height+1)/BAND_DP_FRACTION;
+	long long cells = 0;
+	long long bound;
+	size_t b;
+
+	for (b=BAND_START; b<width && BandWidth(width, height, b)<=width; b*=2) {
+		cells += (long long)BandWidth(width, height, b)*(long long)(height+1);
+		if (cells > max_cells)
+			return 0;
+		*score = BandScore(horizontal, vertical, b, match, mismatch, gap, gap_extend,
+			0, height, NULL, 0, NULL, NULL, profile, cancel);
+		if (*score == INT_MIN)
+			return 0;
+		bound = BandBound(width, height, b, match, mismatch, gap, gap_extend);
+		if (*score >= bound)
+			return b;
+		if (*score < min_score && bound < min_score) {
+			*score = BELOW_MIN_SCORE;
+			return b;
+		}
+	}
+
+	return 0;
+}
+
+//alignment within a proven band, or NEED_MEM to leave it to Hirsch.
+//Z and W as for GlobalAlign, horizontal and vertical being the strings
+//hor and vert pack. One pass keeps every'th row of the band, then the
+//trace is refilled a block of every rows at a time from the bottom,
+//so the band costs about twice its cells in time and its width times
+//the square root of the height in memory
+HirschReturn BandAlign(char *Z, char *W,
+	const char *horizontal, Sequence hor, const char *vertical, Sequence vert,
+	int match, int mismatch, int gap, int gap_extend,
+	size_t leaf_cells, int min_score, Profile *profile, const volatile int *cancel) {
+
+	HirschReturn ret;
+	size_t width = hor.length;
+	size_t height = vert.length;
+	size_t band;
+	size_t b;
+	size_t every;
+	size_t bytes;
+	size_t first;
+	size_t i = width;
+	size_t j = height;
+	size_t k;
+	int *rows;
+	unsigned char *trace;
+	unsigned char from;
+	int state; //0 diagonal, 1 right, 2 down
+	char temp;
+
+	b = ProveBand(hor, vert, match, mismatch, gap, gap_extend,
+		min_score, &ret.score, profile, cancel);
+	if (b == 0)
+		return NEED_MEM;
+	if (ret.score < min_score)
+		return LOW_SCORE;
+
+	//balance the kept rows, 12 bytes a cell, against a block of trace
+	band = BandWidth(width, height, b);
+	for (every=1; every*every < 12*height; every++)
+		;
+	bytes = (height/every+1)*3*(band+2)*sizeof(int) + (every+1)*band*sizeof(unsigned char);
+	//no more memory than a leaf would get
+	if (bytes > 6*sizeof(int)*leaf_cells)
+		return NEED_MEM;
+	rows = malloc((height/every+1)*3*(band+2)*sizeof(int));
+	trace = malloc((every+1)*band*sizeof(unsigned char));
+	if (rows==NULL || trace==NULL) {
+		free(rows);
+		free(trace);
+		return NEED_MEM;
+	}
+	ProfileAlloc(profile, bytes);
+
+	ret.score = BandScore(hor, vert, b, match, mismatch, gap, gap_extend,
+		0, height, rows, every, NULL, &state, profile, cancel);
+
+	//follow the trace back from the corner a block at a time, writing
+	//Z and W backwards. Steps right along a block's first row belong
+	//to the block above, whose last row it is
+	ret.index = 0;
+	while (ret.score != INT_MIN && (i > 0 || j > 0)) {
+		first = j > 0 ? (j-1)/every*every : 0;
+		if (BandScore(hor, vert, b, match, mismatch, gap, gap_extend,
+			first, j, rows, every, trace, NULL, profile, cancel) == INT_MIN) {
+
+			ret.score = INT_MIN;
+			break;
+		}
+
+		while (j > first || (first == 0 && i > 0)) {
+			from = trace[(j-first)*band + i+height-width+b-j];
+			if (state == 0) {
+				Z[ret.index] = horizontal[--i];
+				W[ret.index++] = vertical[--j];
+				state = from & 3;
+			} else if (state == 1) {
+				Z[ret.index] = horizontal[--i];
+				W[ret.index++] = '-';
+				state = (from & 8) ? 1 : 0;
+			} else {
+				Z[ret.index] = '-';
+				W[ret.index++] = vertical[--j];
+				state = (from & 4) ? 2 : 0;
+			}
+		}
+	}
+
+	free(rows);
+	free(trace);
+	ProfileFree(profile, bytes);
+	if (ret.score == INT_MIN)
+		return NEED_MEM;
+
+	for (k=0; k<ret.index/2; k++) {
+		temp = Z[k];
+		Z[k] = Z[ret.index-1-k];
+		Z[ret.index-1-k] = temp;
+		temp = W[k];
+		W[k] = W[ret.index-1-k];
+		W[ret.index-1-k] = temp;
+	}
+
+	return ret;
+}
+
+/*********************** Four Russians **********************
+* With gap equal to gap_extend, and a mismatch no worse than two gaps
+* (so the ban on a gap each way in a row never matters), neighbouring
+* cells of the score matrix differ by between gap and
+* max(match, mismatch)-gap, across or down. A t by t block is then
+* fixed by the t differences along its top, the t down its left side
+* and which of its symbol pairs match, and so are the differences
+* along its bottom and right side. The russians engine works those out
+* for every block at the start of the call and then advances the score
+* pass a block per lookup. Blocks cut short by the edges of the matrix
+* are filled cell by cell.
+*
+* This is a small-block lookup, still quadratic: blocks are 2 by 2,
+* saving the work of four cells per lookup rather than the log factor
+* of the textbook method. Wider blocks need tables that no longer stay
+* in cache, and 3 by 3 ones were slower than filling the cells. The
+* table is built by the call and owned by it, so nothing is shared
+* between threads, and a pair too small to pay for building it is
+* scored the usual way.
+*/
+
+//most entries a table may have, 4 bytes each
+#define RUSSIANS_ENTRIES (1 << 22)
+//width and height of a block
+#define RUSSIANS_T 2
+//least matrix cells per cell filled building the table
+#define RUSSIANS_BUILD_SHARE 16
+
+typedef struct {
+	int t;
+	unsigned int range; //values a difference can take
+	unsigned int sides; //range to the t, the encodings of a side
+	unsigned int *entries; //bottom side | right side << 16
+} Russians;
+
+//block size the russians engine uses for these scores and symbols on
+//a width by height matrix, 0 when it does not apply or the table
+//would cost more than it saves
+int RussiansSize(size_t width, size_t height,
+	int match, int mismatch, int gap, int gap_extend, int bits) {
+
+	long long range = (long long)mymax(match, mismatch) - 2*(long long)gap + 1;
+	long long sides = range*range;
+	long long entries = sides*sides << (RUSSIANS_T*RUSSIANS_T);
+
+	if (gap != gap_extend || gap >= 0 || mismatch < 2*(long long)gap
+		|| bits > 4 || range > 1 << 8 || entries > RUSSIANS_ENTRIES)
+		return 0;
+
+	if ((double)entries*RUSSIANS_T*RUSSIANS_T*RUSSIANS_BUILD_SHARE > (double)width*height)
+		return 0;
+	return RUSSIANS_T;
+}
+
+//the sides leaving an r by c block from those entering it. Digit k
+//(base range) of a side is the difference at its kth cell less gap,
+//across for top and bottom, down for left and right. Bit a*t+b of
+//equal is set when row a and column b of the block match
+unsigned int RussiansBlock(unsigned int top, unsigned int left, unsigned int equal,
+	int r, int c, int t, unsigned int range, int match, int mismatch, int gap) {
+
+	int cells[RUSSIANS_T+1][RUSSIANS_T+1];
+	unsigned int bottom = 0;
+	unsigned int right = 0;
+	int digit;
+	int a;
+	int b;
+
+	cells[0][0] = 0;
+	for (b=0; b<c; b++) {
+		cells[0][b+1] = cells[0][b] + (int)(top%range) + gap;
+		top /= range;
+	}
+	for (a=0; a<r; a++) {
+		cells[a+1][0] = cells[a][0] + (int)(left%range) + gap;
+		left /= range;
+	}
+	for (a=0; a<r; a++) {
+		for (b=0; b<c; b++)
+			cells[a+1][b+1] = mymax(cells[a][b] + ((equal >> (a*t+b)) & 1 ? match : mismatch),
+				mymax(cells[a][b+1], cells[a+1][b]) + gap);
+	}
+
+	//sides that never occur can give digits out of range, which are
+	//clamped so they stay in their own bits
+	for (b=c-1; b>=0; b--) {
+		digit = cells[r][b+1]-cells[r][b]-gap;
+		if (digit < 0 || digit >= (int)range)
+			digit = digit < 0 ? 0 : range-1;
+		bottom = bottom*range + digit;
+	}
+	for (a=r-1; a>=0; a--) {
+		digit = cells[a+1][c]-cells[a][c]-gap;
+		if (digit < 0 || digit >= (int)range)
+			digit = digit < 0 ? 0 : range-1;
+		right = right*range + digit;
+	}
+
+	return bottom | right << 16;
+}
+
+//every t by t block for these scores, entries NULL when out of memory.
+//The caller frees entries
+Russians BuildRussians(int match, int mismatch, int gap, int t) {
+	Russians table;
+	size_t patterns = (size_t)1 << (t*t);
+	unsigned int top;
+	unsigned int left;
+	size_t equal;
+	unsigned int *entry;
+	int k;
+
+	table.t = t;
+	table.range = mymax(match, mismatch) - 2*gap + 1;
+	table.sides = 1;
+	for (k=0; k<t; k++)
+		table.sides *= table.range;
+
+	table.entries = malloc((size_t)table.sides*table.sides*patterns*sizeof(unsigned int));
+	if (table.entries == NULL)
+		return table;
+
+	entry = table.entries;
+	for (top=0; top<table.sides; top++) {
+		for (left=0; left<table.sides; left++) {
+			for (equal=0; equal<patterns; equal++)
+				*entry++ = RussiansBlock(top, left, equal, t, t, t,
+					table.range, match, mismatch, gap);
+		}
+	}
+	return table;
+}
+
+//score of the whole matrix by blocks of RussiansSize. INT_MIN when
+//out of memory, CANCELLED when cancelled
+int RussiansScore(Sequence horizontal, Sequence vertical, int t,
+	int match, int mismatch, int gap, Profile *profile, const volatile int *cancel) {
+
+	size_t width = horizontal.length;
+	size_t height = vertical.length;
+	size_t blocks = (width+t-1)/t;
+	size_t full = width/t; //blocks not cut short
+	Russians table = BuildRussians(match, mismatch, gap, t);
+	size_t bytes = blocks*(sizeof(unsigned int) + 16*sizeof(unsigned char))
+		+ ((size_t)table.sides*table.sides << (t*t))*sizeof(unsigned int);
+	//side leaving the bottom of each block of the last block row
+	unsigned int *tops = calloc(blocks+1, sizeof(unsigned int));
+	//columns of each block holding each symbol, a bit each
+	unsigned char *masks = calloc(16*(blocks+1), sizeof(unsigned char));
+	int symbols[RUSSIANS_T];
+	unsigned int left;
+	unsigned int equal;
+	unsigned int entry;
+	unsigned int top = 0;
+	int r;
+	int a;
+	size_t i;
+	size_t k;
+	long long ret;
+
+	if (tops==NULL || masks==NULL || table.entries==NULL) {
+		free(tops);
+		free(masks);
+		free(table.entries);
+		return INT_MIN;
+	}
+	ProfileAlloc(profile, bytes);
+	for (i=0; i<width; i++)
+		masks[i/t*16 + Symbol(horizontal, i)] |= 1 << (i%t);
+
+	//the edges of the matrix differ by gap a step, digits of 0
+	for (i=0; i<height; i+=t) {
+		r = height-i < (size_t)t ? height-i : (size_t)t;
+		for (a=0; a<r; a++)
+			symbols[a] = Symbol(vertical, i+a);
+		left = 0;
+
+		for (k=0; k<full; k++) {
+			equal = 0;
+			for (a=0; a<r; a++)
+				equal |= masks[k*16 + symbols[a]] << (a*t);
+			if (r == t)
+				entry = table.entries[((size_t)tops[k]*table.sides + left) << (t*t) | equal];
+			else
+				entry = RussiansBlock(tops[k], left, equal, r, t, t,
+					table.range, match, mismatch, gap);
+			tops[k] = entry & 0xffff;
+			left = entry >> 16;
+		}
+		if (full < blocks) {
+			equal = 0;
+			for (a=0; a<r; a++)
+				equal |= masks[k*16 + symbols[a]] << (a*t);
+			tops[k] = RussiansBlock(tops[k], left, equal, r, width-full*t, t,
+				table.range, match, mismatch, gap) & 0xffff;
+		}
+
+		if (cancel != NULL && *cancel)
+			break;
+	}
+
+	//the corner is the bottom left one plus the differences across
+	ret = (long long)height*gap;
+	if (i >= height) {
+		for (i=0; i<width; i++) {
+			if (i%t == 0)
+				top = tops[i/t];
+			ret += (int)(top%table.range) + gap;
+			top /= table.range;
+		}
+	} else {
+		ret = CANCELLED;
+	}
+
+	free(tops);
+	free(masks);
+	free(table.entries);
+	ProfileFree(profile, bytes);
+	if (profile != NULL)
+		profile->score_cells += (long long)width*height;
+
+	return ret;
+}
+
+//peak workspace of GlobalAlign, see the Memory section
+size_t AlignMemory(size_t width, size_t height, size_t leaf_cells, Engine engine) {
+	size_t strings = 2*(width+height+2)*sizeof(char) //Z and W
+		+ PackedMemory(width) + PackedMemory(height);
+	size_t node = 0;
+	size_t leaf;
+	size_t cells; //bound on the matrix cells of any leaf below the top
+
+	if (width*height <= leaf_cells || width <= 1 || height <= 1) {
+		leaf = LeafMemory(width, height);
+	} else {
+		//rows kept from the forward pass while the reverse pass runs
+		node = ScoreMemory(width) + ScoreMemory(width)/2;
+		//a leaf under leaf_cells, or a single row or column of half the height
+		cells = mymax(leaf_cells + width + (height+1)/2 + 1, 2*(mymax(width, (height+1)/2)+1));
+		leaf = 6*cells*sizeof(int) + 3*(width+height+2)*sizeof(char);
+		if (leaf > LeafMemory(width, height))
+			leaf = LeafMemory(width, height);
+	}
+	//the wavefront engine reads reversed copies of the inputs
+	if (engine == FASTNW_WAVEFRONT && leaf < WFA_MEMORY + (width+height+2)*sizeof(char))
+		leaf = WFA_MEMORY + (width+height+2)*sizeof(char);
+
+	return strings + (node > leaf ? node : leaf);
+}
+
+//largest leaf cutoff for Hirsch keeping an alignment within max_memory
+//bytes, the whole matrix if it fits. 0 when nothing fits
+size_t LeafCells(size_t width, size_t height, size_t max_memory) {
+	size_t lo = 1;
+	size_t hi = width*height;
+	size_t mid;
+
+	if (AlignMemory(width, height, hi, FASTNW_DYNAMIC) <= max_memory)
+		return hi > 0 ? hi : 1;
+	if (AlignMemory(width, height, lo, FASTNW_DYNAMIC) > max_memory)
+		return 0;
+
+	//the estimate only grows with the cutoff
+	while (hi-lo > 1) {
+		mid = lo+(hi-lo)/2;
+		if (AlignMemory(width, height, mid, FASTNW_DYNAMIC) <= max_memory)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+//best global score of two strings, the shorter one horizontal.
+//returns INT_MIN when out of memory and CANCELLED once *cancel is set
+int GlobalScore(const char *horizontal, size_t width,
+	const char *vertical, size_t height,
+	int match, int mismatch, int gap, int gap_extend, Engine engine,
+	int min_score, Profile *profile,
+	const volatile int *cancel) {
+
+	ScoreReturn res;
+	Penalties pen; //for the wavefront engine
+	Sequence hor;
+	Sequence vert;
+	int t; //block size for the russians engine
+	int ret;
+
+	//try the wavefront engine first, falling back if it gives up
+	if (engine == FASTNW_WAVEFRONT) {
+		pen = GetPenalties(match, mismatch, gap, gap_extend);
+		if (pen.valid) {
+			ret = WFAScore(horizontal, width, vertical, height,
+				pen, (long)(width+1)*(long)(height+1)/WFA_DP_FRACTION,
+				MaxPenalty(min_score, width, height, match));
+			if (profile != NULL && ret != -1)
+				profile->kernel = "wfa";
+			if (cancel != NULL && *cancel)
+				return CANCELLED;
+			if (ret == WFA_PRUNED)
+				return BELOW_MIN_SCORE;
+			if (ret >= 0) {
+				ret = PenaltyToScore(ret, width, height, match);
+				return ret < min_score ? BELOW_MIN_SCORE : ret;
+			}
+		}
+	}
+
+	if (profile != NULL)
+		profile->kernel = "dp";
+	if (!PackSequences(&hor, horizontal, width, &vert, vertical, height))
+		return INT_MIN;
+
+	//the band engine falls back to Score when no narrower band will do
+	if (engine == FASTNW_BANDED && ProveBand(hor, vert, match, mismatch, gap, gap_extend,
+		min_score, &ret, profile, cancel) > 0) {
+
+		FreeSequence(hor);
+		FreeSequence(vert);
+		if (profile != NULL)
+			profile->kernel = "band";
+		return ret < min_score ? BELOW_MIN_SCORE : ret;
+	}
+
+	//the russians engine only takes scores and symbols it has blocks for,
+	//and pairs big enough to pay for building them
+	if (engine == FASTNW_FOUR_RUSSIANS
+		&& (t = RussiansSize(width, height, match, mismatch, gap, gap_extend, hor.bits)) > 0) {
+
+		ret = RussiansScore(hor, vert, t, match, mismatch, gap, profile, cancel);
+		FreeSequence(hor);
+		FreeSequence(vert);
+		if (ret == INT_MIN || ret == CANCELLED)
+			return ret;
+		if (profile != NULL)
+			profile->kernel = "russians";
+		return ret < min_score ? BELOW_MIN_SCORE : ret;
+	}
+
+	res = Score(hor, 0, width,
+		vert, 0, height,
+		match, mismatch, gap, gap_extend,
+		ANY, min_score, 0, profile, cancel);
+	FreeSequence(hor);
+	FreeSequence(vert);
+	if (res.cur == NULL && res.pruned && cancel != NULL && *cancel)
+		return CANCELLED;
+	if (res.cur == NULL)
+		return res.pruned ? BELOW_MIN_SCORE : INT_MIN;
+	ProfileFreeRows(profile, width);
+
+	ret = mymax(res.cur[width], mymax(res.cur_right[width], res.cur_down[width]));
+	free(res.cur);
+	free(res.cur_right);
+	free(res.cur_down);
+
+	return ret < min_score ? BELOW_MIN_SCORE : ret;
+}
+
+//global alignment of two strings, the shorter one horizontal. Z and W
+//need room for width+height+1 characters and come back terminated
+HirschReturn GlobalAlign(char *Z, char *W,
+	const char *horizontal, size_t width,
+	const char *vertical, size_t height,
+	int match, int mismatch, int gap, int gap_extend, Engine engine,
+	size_t leaf_cells, int min_score, Profile *profile,
+	const volatile int *cancel) {
+
+	HirschReturn res;
+	Sequence hor; //input strings as the DP engine reads them
+	Sequence vert;
+	char *rev_hor; //reverse of input strings, for the wavefront engine
+	char *rev_vert;
+	size_t i;
+
+	res = NEED_MEM;
+	if (engine == FASTNW_WAVEFRONT) {
+		rev_hor = malloc((width+1)*sizeof(char));
+		rev_vert = malloc((height+1)*sizeof(char));
+		if (rev_hor!=NULL && rev_vert!=NULL) {
+			for (i=0; i<width; i++) {
+				rev_hor[width-i-1] = horizontal[i];
+			}
+			rev_hor[width] = '\0';
+			for (i=0; i<height; i++) {
+				rev_vert[height-i-1] = vertical[i];
+			}
+			rev_vert[height] = '\0';
+
+			res = WFAAlign(Z, W,
+				horizontal, rev_hor, width,
+				vertical, rev_vert, height,
+				match, mismatch, gap, gap_extend, min_score);
+			if (profile != NULL)
+				profile->kernel = "biwfa";
+		}
+		free(rev_hor);
+		free(rev_vert);
+	}
+	if (res.index == NEED_MEM.index
+		&& PackSequences(&hor, horizontal, width, &vert, vertical, height)) {
+
+		if (engine == FASTNW_BANDED) {
+			res = BandAlign(Z, W, horizontal, hor, vertical, vert,
+				match, mismatch, gap, gap_extend, leaf_cells, min_score, profile, cancel);
+			if (profile != NULL)
+				profile->kernel = "band";
+		}
+		if (res.index == NEED_MEM.index) {
+			res = Hirsch(Z, W, 0,
+				hor, 0, width,
+				vert, 0, height,
+				match, mismatch, gap, gap_extend,
+				ANY, ANY, leaf_cells, min_score, 0, profile, cancel);
+			if (profile != NULL)
+				profile->kernel = profile->nodes > 1 ? "hirschberg" : "needleman-wunsch";
+		}
+		FreeSequence(hor);
+		FreeSequence(vert);
+	}
+
+	if (res.index != NEED_MEM.index && res.index != LOW_SCORE.index
+		&& res.index != TRACE_ERROR.index && res.score < min_score)
+		res = LOW_SCORE;
+	if (res.index != NEED_MEM.index && res.index != LOW_SCORE.index
+		&& res.index != TRACE_ERROR.index) {
+		Z[res.index] = '\0';
+		W[res.index] = '\0';
+	}
+
+	return res;
+}
+
+/*********************** Thread pool ************************/
+
+typedef struct {
+	void (*work)(void *, size_t);
+	void *data;
+	size_t count;
+	size_t next;
+	pthread_mutex_t lock;
+} Parallel;
+
+void *ParallelWorker(void *arg) {
+	Parallel *parallel = arg;
+	size_t i;
+
+	while (true) {
+		pthread_mutex_lock(&parallel->lock);
+		i = parallel->next++;
+		pthread_mutex_unlock(&parallel->lock);
+		if (i >= parallel->count)
+			break;
+		parallel->work(parallel->data, i);
+	}
+
+	return NULL;
+}
+
+//calls work(data, i) for every i below count, spread over the
+//given number of threads with the calling thread taking part
+void RunParallel(void (*work)(void *, size_t), void *data,
+	size_t count, int threads) {
+
+	Parallel parallel;
+	pthread_t *ids = NULL;
+	int started = 0;
+	int t;
+
+	parallel.work = work;
+	parallel.data = data;
+	parallel.count = count;
+	parallel.next = 0;
+	pthread_mutex_init(&parallel.lock, NULL);
+
+	if ((size_t)threads > count)
+		threads = count;
+	if (threads > 1)
+		ids = malloc((threads-1)*sizeof(pthread_t));
+	if (ids != NULL) {
+		for (t=0; t<threads-1; t++) {
+			if (pthread_create(&ids[started], NULL, ParallelWorker, &parallel) == 0)
+				started++;
+		}
+	}
+
+	ParallelWorker(&parallel);
+
+	for (t=0; t<started; t++)
+		pthread_join(ids[t], NULL);
+	free(ids);
+	pthread_mutex_destroy(&parallel.lock);
+}
+
+/*********************** FASTA input ************************/
+
+bool TextAppend(Text *text, char c) {
+	char *grown;
+
+	if (text->length+1 >= text->capacity) {
+		grown = realloc(text->data, (2*text->capacity+64)*sizeof(char));
+		if (grown==NULL)
+			return false;
+		text->data = grown;
+		text->capacity = 2*text->capacity+64;
+	}
+	text->data[text->length++] = c;
+	text->data[text->length] = '\0';
+
+	return true;
+}
+
+//empties a string, making sure it has storage
+bool TextClear(Text *text) {
+	text->length = 0;
+	if (text->data==NULL && !TextAppend(text, '\0'))
+		return false;
+	text->length = 0;
+	text->data[0] = '\0';
+
+	return true;
+}
+
+int ReaderGet(FastaReader *reader) {
+	if (reader->pos < reader->length)
+		return (unsigned char)reader->data[reader->pos++];
+	if (reader->file == NULL)
+		return EOF;
+
+	reader->length = fread(reader->buffer, 1, FASTA_BUFFER, reader->file);
+	reader->data = reader->buffer;
+	reader->pos = 0;
+	if (reader->length == 0) {
+		if (ferror(reader->file)) {
+			reader->failed = true;
+			reader->error = errno != 0 ? errno : EIO;
+		}
+		return EOF;
+	}
+	return (unsigned char)reader->data[reader->pos++];
+}
+
+//reads the next record into id (up to the first space of the header)
+//and seq (all lines joined). FASTQ qualities are skipped. Returns
+//false at the end of the input, or with failed set on an error
+bool ReadRecord(FastaReader *reader, Text *id, Text *seq) {
+	int c;
+	size_t count;
+	bool in_id = true;
+	bool fastq;
+
+	if (!TextClear(id) || !TextClear(seq)) {
+		reader->failed = true;
+		return false;
+	}
+
+	//skip to the next header
+	while (!reader->header) {
+		c = ReaderGet(reader);
+		if (c == EOF)
+			return false;
+		if ((c == '>' || c == '@') && reader->line_start)
+			reader->header = c;
+		reader->line_start = (c == '\n');
+	}
+	fastq = (reader->header == '@');
+	reader->header = 0;
+
+	//header line
+	while ((c = ReaderGet(reader)) != EOF && c != '\n') {
+		if (isspace(c) && id->length > 0)
+			in_id = false;
+		else if (in_id && !isspace(c) && !TextAppend(id, c))
+			reader->failed = true;
+	}
+
+	//sequence lines, up to the next header or a FASTQ '+' line
+	reader->line_start = true;
+	while ((c = ReaderGet(reader)) != EOF) {
+		if (reader->line_start && ((c == '>' && !fastq) || (c == '+' && fastq))) {
+			reader->header = fastq ? 0 : c;
+			break;
+		}
+		reader->line_start = (c == '\n');
+		if (!isspace(c) && c != '\0' && !TextAppend(seq, c))
+			reader->failed = true;
+	}
+
+	//as many qualities as bases, which may themselves start with '@'
+	if (fastq && c == '+') {
+		while ((c = ReaderGet(reader)) != EOF && c != '\n');
+		for (count=0; count<seq->length && (c = ReaderGet(reader)) != EOF; ) {
+			if (!isspace(c))
+				count++;
+		}
+		reader->line_start = false;
+	}
+
+	return !reader->failed;
+}
+
+/********************* Database search **********************/
+
+//records scored at a time before the next ones are read
+#define SEARCH_BATCH 4096
+
+//whether hit a should rank below hit b
+static __inline bool HitWorse(const Hit *a, const Hit *b) {
+	return a->score < b->score || (a->score == b->score && a->index > b->index);
+}
+
+void HeapDown(Hit *heap, size_t size, size_t i) {
+	size_t child;
+	Hit temp;
+
+	while ((child = 2*i+1) < size) {
+		if (child+1 < size && HitWorse(&heap[child+1], &heap[child]))
+			child++;
+		if (!HitWorse(&heap[child], &heap[i]))
+			break;
+		temp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = temp;
+		i = child;
+	}
+}
+
+void HeapUp(Hit *heap, size_t i) {
+	Hit temp;
+
+	while (i > 0 && HitWorse(&heap[i], &heap[(i-1)/2])) {
+		temp = heap[i];
+		heap[i] = heap[(i-1)/2];
+		heap[(i-1)/2] = temp;
+		i = (i-1)/2;
+	}
+}
+
+//offers a scored record to the top k, copying it if it is kept.
+//called with the search locked
+void SearchOffer(Search *search, int score, long index, const Text *id, const Text *seq) {
+	Hit hit;
+
+	hit.score = score;
+	hit.index = index;
+	if (search->size == search->k && !HitWorse(&search->heap[0], &hit))
+		return;
+
+	hit.id = malloc((id->length+1)*sizeof(char));
+	hit.seq = malloc((seq->length+1)*sizeof(char));
+	if (hit.id==NULL || hit.seq==NULL) {
+		free(hit.id);
+		free(hit.seq);
+		search->failed = true;
+		return;
+	}
+	memcpy(hit.id, id->data, id->length+1);
+	memcpy(hit.seq, seq->data, seq->length+1);
+	hit.length = seq->length;
+	hit.Z = NULL;
+	hit.W = NULL;
+
+	if (search->size == search->k) {
+		free(search->heap[0].id);
+		free(search->heap[0].seq);
+		search->heap[0] = hit;
+		HeapDown(search->heap, search->size, 0);
+	} else {
+		search->heap[search->size] = hit;
+		HeapUp(search->heap, search->size++);
+	}
+}
+
+//scores record i of the current batch
+void SearchScore(void *data, size_t i) {
+	Search *search = data;
+	const Text *seq = &search->seqs[i];
+	int score;
+	int min_score = INT_MIN;
+
+	//once k records are kept, anything scoring below the worst is not
+	pthread_mutex_lock(&search->lock);
+	if (search->size == search->k)
+		min_score = search->heap[0].score;
+	pthread_mutex_unlock(&search->lock);
+
+	if (seq->length < search->query_length)
+		score = GlobalScore(seq->data, seq->length,
+			search->query, search->query_length,
+			search->match, search->mismatch, search->gap, search->gap_extend,
+			search->engine, min_score, NULL, NULL);
+	else
+		score = GlobalScore(search->query, search->query_length,
+			seq->data, seq->length,
+			search->match, search->mismatch, search->gap, search->gap_extend,
+			search->engine, min_score, NULL, NULL);
+
+	pthread_mutex_lock(&search->lock);
+	if (score == INT_MIN)
+		search->failed = true;
+	else if (score != BELOW_MIN_SCORE)
+		SearchOffer(search, score, search->first+i, &search->ids[i], seq);
+	pthread_mutex_unlock(&search->lock);
+}
+
+//aligns hit i once the scan is over
+void SearchAlign(void *data, size_t i) {
+	Search *search = data;
+	Hit *hit = &search->heap[i];
+	size_t length = search->query_length+hit->length+1;
+	HirschReturn res;
+
+
+	hit->Z = malloc(length*sizeof(char));
+	hit->W = malloc(length*sizeof(char));
+	if (hit->Z==NULL || hit->W==NULL) {
+		pthread_mutex_lock(&search->lock);
+		search->failed = true;
+		pthread_mutex_unlock(&search->lock);
+		return;
+	}
+
+	//keep the query in Z whichever way round it is aligned
+	if (hit->length < search->query_length)
+		res = GlobalAlign(hit->W, hit->Z, hit->seq, hit->length,
+			search->query, search->query_length,
+			search->match, search->mismatch, search->gap, search->gap_extend,
+			search->engine, LEAF_CELLS, INT_MIN, NULL, NULL);
+	else
+		res = GlobalAlign(hit->Z, hit->W, search->query, search->query_length,
+			hit->seq, hit->length,
+			search->match, search->mismatch, search->gap, search->gap_extend,
+			search->engine, LEAF_CELLS, INT_MIN, NULL, NULL);
+
+	if (res.index == NEED_MEM.index || res.index == TRACE_ERROR.index) {
+		pthread_mutex_lock(&search->lock);
+		search->failed = true;
+		pthread_mutex_unlock(&search->lock);
+	}
+}
+
+//scores every record against the query, then aligns the best k.
+//the hits come back in search->heap, best first
+bool RunSearch(Search *search, FastaReader *reader, int threads) {
+	size_t count;
+	size_t i;
+	Hit temp;
+
+	search->ids = calloc(SEARCH_BATCH, sizeof(Text));
+	search->seqs = calloc(SEARCH_BATCH, sizeof(Text));
+	search->first = 0;
+	if (search->ids==NULL || search->seqs==NULL)
+		search->failed = true;
+
+	//stream the database a batch at a time
+	while (!search->failed) {
+		for (count=0; count<SEARCH_BATCH; count++) {
+			if (!ReadRecord(reader, &search->ids[count], &search->seqs[count]))
+				break;
+		}
+		if (reader->failed)
+			search->failed = true;
+		if (count == 0 || search->failed)
+			break;
+		RunParallel(SearchScore, search, count, threads);
+		search->first += count;
+	}
+
+	if (search->ids != NULL && search->seqs != NULL) {
+		for (i=0; i<SEARCH_BATCH; i++) {
+			free(search->ids[i].data);
+			free(search->seqs[i].data);
+		}
+	}
+	free(search->ids);
+	free(search->seqs);
+
+	//sort best first, popping the worst to the back
+	for (count=search->size; count>1; count--) {
+		temp = search->heap[0];
+		search->heap[0] = search->heap[count-1];
+		search->heap[count-1] = temp;
+		HeapDown(search->heap, count-1, 0);
+	}
+
+	if (!search->failed)
+		RunParallel(SearchAlign, search, search->size, threads);
+
+	return !search->failed;
+}
+
+/******************** All-vs-all scores *********************/
+
+//sequences per side of a tile of the score matrix
+#define PAIRWISE_TILE 16
+
+//scores one tile of the upper triangle, mirroring it into the lower one
+void PairwiseTile(void *data, size_t t) {
+	Pairwise *pairwise = data;
+	size_t i;
+	size_t j;
+	size_t row_end = (pairwise->tile_rows[t]+1)*PAIRWISE_TILE;
+	size_t col_end = (pairwise->tile_cols[t]+1)*PAIRWISE_TILE;
+	int score;
+
+	if (row_end > pairwise->count)
+		row_end = pairwise->count;
+	if (col_end > pairwise->count)
+		col_end = pairwise->count;
+
+	for (i=pairwise->tile_rows[t]*PAIRWISE_TILE; i<row_end; i++) {
+		j = pairwise->tile_cols[t]*PAIRWISE_TILE;
+		if (j < i)
+			j = i;
+		for (; j<col_end; j++) {
+			if (pairwise->lengths[i] <= pairwise->lengths[j])
+				score = GlobalScore(pairwise->seqs[i], pairwise->lengths[i],
+					pairwise->seqs[j], pairwise->lengths[j],
+					pairwise->match, pairwise->mismatch, pairwise->gap, pairwise->gap_extend,
+					pairwise->engine, INT_MIN, NULL, NULL);
+			else
+				score = GlobalScore(pairwise->seqs[j], pairwise->lengths[j],
+					pairwise->seqs[i], pairwise->lengths[i],
+					pairwise->match, pairwise->mismatch, pairwise->gap, pairwise->gap_extend,
+					pairwise->engine, INT_MIN, NULL, NULL);
+			if (score == INT_MIN) {
+				pthread_mutex_lock(&pairwise->lock);
+				pairwise->failed = true;
+				pthread_mutex_unlock(&pairwise->lock);
+			}
+			pairwise->out[i*pairwise->count+j] = score;
+			pairwise->out[j*pairwise->count+i] = score;
+		}
+	}
+}
+
+//fills pairwise->out with every pairwise score
+bool RunPairwise(Pairwise *pairwise, int threads) {
+	size_t tiles = (pairwise->count+PAIRWISE_TILE-1)/PAIRWISE_TILE;
+	size_t count = 0;
+	size_t i;
+	size_t j;
+
+	pairwise->tile_rows = malloc((tiles*(tiles+1)/2+1)*sizeof(size_t));
+	pairwise->tile_cols = malloc((tiles*(tiles+1)/2+1)*sizeof(size_t));
+	pairwise->failed = false;
+	if (pairwise->tile_rows==NULL || pairwise->tile_cols==NULL) {
+		free(pairwise->tile_rows);
+		free(pairwise->tile_cols);
+		return false;
+	}
+
+	for (i=0; i<tiles; i++) {
+		for (j=i; j<tiles; j++, count++) {
+			pairwise->tile_rows[count] = i;
+			pairwise->tile_cols[count] = j;
+		}
+	}
+	pthread_mutex_init(&pairwise->lock, NULL);
+	RunParallel(PairwiseTile, pairwise, count, threads);
+	pthread_mutex_destroy(&pairwise->lock);
+
+	free(pairwise->tile_rows);
+	free(pairwise->tile_cols);
+
+	return !pairwise->failed;
+}
+
+/********************* Batch alignment **********************/
+
+void PairsAlign(void *data, size_t i) {
+	Pairs *pairs = data;
+	Alignment res;
+	char *ops;
+
+	res = FastNWAlign(pairs->seqs1[i], pairs->lengths1[i],
+		pairs->seqs2[i], pairs->lengths2[i],
+		pairs->match, pairs->mismatch, pairs->gap, pairs->gap_extend,
+		pairs->engine, 0, INT_MIN, NULL, NULL);
+	if (res.align1 == NULL) {
+		pthread_mutex_lock(&pairs->lock);
+		pairs->failed = true;
+		pthread_mutex_unlock(&pairs->lock);
+		return;
+	}
+
+	//a column is read before its operation is written over it, so the
+	//operations replace align1 and the aligned strings only ever exist
+	//for the pairs being worked on
+	FastNWOps(res, res.align1);
+	free(res.align2);
+	ops = realloc(res.align1, (strlen(res.align1)+1)*sizeof(char));
+	pairs->ops[i] = ops != NULL ? ops : res.align1;
+	pairs->scores[i] = res.score;
+}
+
+void PairsScore(void *data, size_t i) {
+	Pairs *pairs = data;
+
+	pairs->scores[i] = FastNWScore(pairs->seqs1[i], pairs->lengths1[i],
+		pairs->seqs2[i], pairs->lengths2[i],
+		pairs->match, pairs->mismatch, pairs->gap, pairs->gap_extend,
+		pairs->engine, 0, pairs->min_score, NULL, NULL);
+	if (pairs->scores[i] == INT_MIN) {
+		pthread_mutex_lock(&pairs->lock);
+		pairs->failed = true;
+		pthread_mutex_unlock(&pairs->lock);
+	}
+}
+
+//aligns or scores every pair
+bool RunPairs(Pairs *pairs, int threads) {
+	pairs->failed = false;
+	pairs->scores = malloc((pairs->count+1)*sizeof(int));
+	pairs->ops = calloc(pairs->count+1, sizeof(char *));
+	if (pairs->scores == NULL || pairs->ops == NULL) {
+		free(pairs->scores);
+		free(pairs->ops);
+		pairs->ops = NULL;
+		return false;
+	}
+
+	pthread_mutex_init(&pairs->lock, NULL);
+	RunParallel(pairs->align ? PairsAlign : PairsScore, pairs, pairs->count, threads);
+	pthread_mutex_destroy(&pairs->lock);
+
+	if (pairs->failed) {
+		FreePairs(pairs);
+		return false;
+	}
+	return true;
+}
+
+void FreePairs(Pairs *pairs) {
+	size_t i;
+
+	if (pairs->ops == NULL)
+		return;
+	for (i=0; i<pairs->count; i++)
+		free(pairs->ops[i]);
+	free(pairs->ops);
+	free(pairs->scores);
+	pairs->ops = NULL;
+}
+
+/******************* Progressive alignment ******************
+* RunMsa builds a guide tree by UPGMA, with distances taken from the
+* pairwise scores, then joins groups of aligned strings along it. Two
+* groups are aligned as profiles. A pair of columns scores the sum
+* over every pair of rows across them: match or mismatch for two
+* characters, gap_extend for a character against a gap already in a
+* group. A column set against new gaps costs gap_extend for each
+* character in it times the rows of the other group, and every run of
+* new gaps (gap-gap_extend) more per pair of rows. Profiles are aligned
+* in linear space by splitting the vertical group in half as Hirsch
+* does, keeping track of a run of gaps that crosses the split (Myers
+* and Miller's form of Hirschberg). Joins whose subtrees are done run
+* in parallel, a level of the tree at a time.
+*/
+
+//profile alignments of at most this many cells are filled whole
+#define MSA_LEAF_CELLS 4096
+
+//low enough never to be the best, high enough to add a few scores to
+#define MSA_NEG (LLONG_MIN/4)
+
+//a profile alignment of group a across and group b down
+typedef struct {
+	const Msa *msa;
+	const Group *a;
+	const Group *b;
+	long long open; //for each run of new gaps
+	long long *across; //column j of a against new gaps
+	long long *down; //column i of b against new gaps
+	char *ops; //'M' a column of each, 'R' a column of a, 'D' one of b
+	size_t spot;
+} Join;
+
+void FreeGroup(Group *group) {
+	size_t i;
+
+	for (i=0; group->rows!=NULL && i<group->count; i++)
+		free(group->rows[i]);
+	free(group->rows);
+	free(group->members);
+	free(group->symbols);
+	free(group->counts);
+	free(group->starts);
+	free(group->residues);
+	memset(group, 0, sizeof(Group));
+}
+
+//fills in the column summary of a group from its rows
+bool SummariseGroup(Group *group) {
+	unsigned int counts[256];
+	size_t entries = 0;
+	size_t most = group->count < 255 ? group->count : 255; //characters a column can have
+	size_t i;
+	size_t j;
+	int c;
+
+	group->symbols = malloc((group->length*most+1)*sizeof(unsigned char));
+	group->counts = malloc((group->length*most+1)*sizeof(unsigned int));
+	group->starts = malloc((group->length+1)*sizeof(size_t));
+	group->residues = malloc((group->length+1)*sizeof(unsigned int));
+	if (group->symbols==NULL || group->counts==NULL
+		|| group->starts==NULL || group->residues==NULL)
+		return false;
+
+	for (j=0; j<group->length; j++) {
+		memset(counts, 0, sizeof(counts));
+		for (i=0; i<group->count; i++)
+			counts[(unsigned char)group->rows[i][j]]++;
+		group->starts[j] = entries;
+		group->residues[j] = group->count-counts['-'];
+		for (c=0; c<256; c++) {
+			if (counts[c] > 0 && c != '-') {
+				group->symbols[entries] = c;
+				group->counts[entries++] = counts[c];
+			}
+		}
+	}
+	group->starts[group->length] = entries;
+
+	return true;
+}
+
+//sum of pairs score of column i of a against column j of b
+static __inline long long ColumnScore(const Msa *msa, const Group *a, size_t i,
+	const Group *b, size_t j) {
+
+	size_t x = a->starts[i];
+	size_t y = b->starts[j];
+	long long same = 0;
+	long long pairs = (long long)a->residues[i]*b->residues[j];
+	long long gapped = (long long)a->residues[i]*(b->count-b->residues[j])
+		+ (long long)(a->count-a->residues[i])*b->residues[j];
+
+	//both columns list their characters in order
+	while (x < a->starts[i+1] && y < b->starts[j+1]) {
+		if (a->symbols[x] < b->symbols[y])
+			x++;
+		else if (a->symbols[x] > b->symbols[y])
+			y++;
+		else
+			same += (long long)a->counts[x++]*b->counts[y++];
+	}
+
+	return same*msa->match + (pairs-same)*msa->mismatch + gapped*msa->gap_extend;
+}
+
+static __inline long long Max3(long long x, long long y, long long z) {
+	if (y > x)
+		x = y;
+	return z > x ? z : x;
+}
+
+//last row of the alignment of columns c0..c1 of a against rows r0..r1
+//of b: the best score in any state into any, and the best ending with
+//a step down into down. When reverse it runs from (r1, c1) back, with
+//any[k] for column c1-k. free_start lets a run of steps down from the
+//start skip open, as it carries on one from across a split. work
+//holds 6 rows of c1-c0+1
+void JoinLastRow(const Join *join, size_t c0, size_t c1, size_t r0, size_t r1,
+	bool reverse, bool free_start, long long *work, long long *any, long long *down) {
+
+	size_t n = c1-c0;
+	long long *dg = work; //ending with a column of each
+	long long *rt = work+(n+1); //ending with a column of a
+	long long *dn = work+2*(n+1); //ending with a column of b
+	long long *prev_dg = work+3*(n+1);
+	long long *prev_rt = work+4*(n+1);
+	long long *prev_dn = work+5*(n+1);
+	long long *temp;
+	long long open = join->open;
+	size_t i;
+	size_t k;
+	size_t col;
+	size_t row;
+
+	dg[0] = 0;
+	rt[0] = MSA_NEG;
+	dn[0] = free_start ? 0 : MSA_NEG;
+	for (k=1; k<=n; k++) {
+		col = reverse ? c1-k : c0+k-1;
+		dg[k] = MSA_NEG;
+		dn[k] = MSA_NEG;
+		rt[k] = Max3(dg[k-1]+open, rt[k-1], dn[k-1]+open) + join->across[col];
+	}
+
+	for (i=1; i<=r1-r0; i++) {
+		temp = prev_dg; prev_dg = dg; dg = temp;
+		temp = prev_rt; prev_rt = rt; rt = temp;
+		temp = prev_dn; prev_dn = dn; dn = temp;
+
+		row = reverse ? r1-i : r0+i-1;
+		dg[0] = MSA_NEG;
+		rt[0] = MSA_NEG;
+		dn[0] = Max3(prev_dg[0]+open, prev_rt[0]+open, prev_dn[0]) + join->down[row];
+		for (k=1; k<=n; k++) {
+			col = reverse ? c1-k : c0+k-1;
+			dg[k] = Max3(prev_dg[k-1], prev_rt[k-1], prev_dn[k-1])
+				+ ColumnScore(join->msa, join->a, col, join->b, row);
+			rt[k] = Max3(dg[k-1]+open, rt[k-1], dn[k-1]+open) + join->across[col];
+			dn[k] = Max3(prev_dg[k]+open, prev_rt[k]+open, prev_dn[k]) + join->down[row];
+		}
+	}
+
+	for (k=0; k<=n; k++) {
+		any[k] = Max3(dg[k], rt[k], dn[k]);
+		down[k] = dn[k];
+	}
+}
+
+//fills the whole matrix of a small part of a profile alignment and
+//appends its ops. free_end lets a run of steps down to the end skip
+//open, as free_start does for the start
+bool JoinLeaf(Join *join, size_t c0, size_t c1, size_t r0, size_t r1,
+	bool free_start, bool free_end) {
+
+	size_t n = c1-c0;
+	size_t m = r1-r0;
+	size_t cells = (n+1)*(m+1);
+	long long *dg = malloc(3*cells*sizeof(long long));
+	long long *rt = dg+cells;
+	long long *dn = dg+2*cells;
+	long long open = join->open;
+	long long value;
+	char *ops = join->ops+join->spot;
+	size_t length = 0;
+	size_t i;
+	size_t k;
+	char temp;
+	int state; //0 a column of each, 1 of a, 2 of b
+
+	if (dg == NULL)
+		return false;
+
+	for (i=0; i<=m; i++) {
+		for (k=0; k<=n; k++) {
+			if (i == 0 && k == 0) {
+				dg[0] = 0;
+				rt[0] = MSA_NEG;
+				dn[0] = free_start ? 0 : MSA_NEG;
+				continue;
+			}
+			dg[i*(n+1)+k] = (i == 0 || k == 0) ? MSA_NEG
+				: Max3(dg[(i-1)*(n+1)+k-1], rt[(i-1)*(n+1)+k-1], dn[(i-1)*(n+1)+k-1])
+				+ ColumnScore(join->msa, join->a, c0+k-1, join->b, r0+i-1);
+			rt[i*(n+1)+k] = k == 0 ? MSA_NEG
+				: Max3(dg[i*(n+1)+k-1]+open, rt[i*(n+1)+k-1], dn[i*(n+1)+k-1]+open)
+				+ join->across[c0+k-1];
+			dn[i*(n+1)+k] = i == 0 ? MSA_NEG
+				: Max3(dg[(i-1)*(n+1)+k]+open, rt[(i-1)*(n+1)+k]+open, dn[(i-1)*(n+1)+k])
+				+ join->down[r0+i-1];
+		}
+	}
+
+	i = m;
+	k = n;
+	state = 0;
+	value = dg[cells-1];
+	if (rt[cells-1] > value) {
+		state = 1;
+		value = rt[cells-1];
+	}
+	if (dn[cells-1] - (free_end ? open : 0) > value)
+		state = 2;
+
+	//trace back, writing the ops backwards
+	while (i > 0 || k > 0) {
+		if (state == 0) {
+			ops[length++] = 'M';
+			i--;
+			k--;
+			value = Max3(dg[i*(n+1)+k], rt[i*(n+1)+k], dn[i*(n+1)+k]);
+			state = value == dg[i*(n+1)+k] ? 0 : value == rt[i*(n+1)+k] ? 1 : 2;
+		} else if (state == 1) {
+			ops[length++] = 'R';
+			value = rt[i*(n+1)+k] - join->across[c0+k-1];
+			k--;
+			state = value == rt[i*(n+1)+k] ? 1 : value == dg[i*(n+1)+k]+open ? 0 : 2;
+		} else {
+			ops[length++] = 'D';
+			value = dn[i*(n+1)+k] - join->down[r0+i-1];
+			i--;
+			state = value == dn[i*(n+1)+k] ? 2 : value == dg[i*(n+1)+k]+open ? 0 : 1;
+		}
+	}
+	for (i=0; i<length/2; i++) {
+		temp = ops[i];
+		ops[i] = ops[length-1-i];
+		ops[length-1-i] = temp;
+	}
+	join->spot += length;
+
+	free(dg);
+	return true;
+}
+
+//aligns columns c0..c1 of a against rows r0..r1 of b in linear space,
+//appending the ops
+bool JoinHirsch(Join *join, size_t c0, size_t c1, size_t r0, size_t r1,
+	bool free_start, bool free_end) {
+
+	size_t n = c1-c0;
+	size_t mid = (r0+r1)/2;
+	size_t k;
+	size_t best_k = 0;
+	long long *work;
+	long long value;
+	long long best = LLONG_MIN;
+	bool crossing = false; //a run of steps down crosses the split
+
+	if (r1-r0 <= 1 || (r1-r0+1)*(n+1) <= MSA_LEAF_CELLS)
+		return JoinLeaf(join, c0, c1, r0, r1, free_start, free_end);
+
+	//6 rows of work, then forward and backward last rows
+	work = malloc(10*(n+1)*sizeof(long long));
+	if (work == NULL)
+		return false;
+	JoinLastRow(join, c0, c1, r0, mid, false, free_start, work,
+		work+6*(n+1), work+7*(n+1));
+	JoinLastRow(join, c0, c1, mid, r1, true, free_end, work,
+		work+8*(n+1), work+9*(n+1));
+
+	for (k=0; k<=n; k++) {
+		value = work[6*(n+1)+k] + work[8*(n+1)+n-k];
+		if (value > best) {
+			best = value;
+			best_k = k;
+			crossing = false;
+		}
+		//both halves paid to open the run
+		value = work[7*(n+1)+k] + work[9*(n+1)+n-k] - join->open;
+		if (value > best) {
+			best = value;
+			best_k = k;
+			crossing = true;
+		}
+	}
+	free(work);
+
+	return JoinHirsch(join, c0, c0+best_k, r0, mid, free_start, crossing)
+		&& JoinHirsch(join, c0+best_k, c1, mid, r1, crossing, free_end);
+}
+
+//aligns group b to group a, into joined with the rows of a first
+bool JoinGroups(const Msa *msa, const Group *a, const Group *b, Group *joined) {
+	Join join;
+	size_t i;
+	size_t j;
+	size_t x;
+	bool ok;
+
+	join.msa = msa;
+	join.a = a;
+	join.b = b;
+	join.open = (long long)(msa->gap-msa->gap_extend)*a->count*b->count;
+	join.across = malloc((a->length+1)*sizeof(long long));
+	join.down = malloc((b->length+1)*sizeof(long long));
+	join.ops = malloc((a->length+b->length+1)*sizeof(char));
+	join.spot = 0;
+	ok = join.across!=NULL && join.down!=NULL && join.ops!=NULL;
+
+	if (ok) {
+		for (j=0; j<a->length; j++)
+			join.across[j] = (long long)msa->gap_extend*a->residues[j]*b->count;
+		for (i=0; i<b->length; i++)
+			join.down[i] = (long long)msa->gap_extend*b->residues[i]*a->count;
+		ok = JoinHirsch(&join, 0, a->length, 0, b->length, false, false);
+	}
+
+	joined->count = a->count+b->count;
+	joined->length = join.spot;
+	joined->rows = ok ? calloc(joined->count, sizeof(char *)) : NULL;
+	joined->members = ok ? malloc(joined->count*sizeof(size_t)) : NULL;
+	ok = ok && joined->rows!=NULL && joined->members!=NULL;
+
+	for (i=0; ok && i<joined->count; i++) {
+		joined->rows[i] = malloc((joined->length+1)*sizeof(char));
+		if (joined->rows[i] == NULL) {
+			ok = false;
+			break;
+		}
+		x = 0;
+		for (j=0; j<joined->length; j++) {
+			if (i < a->count)
+				joined->rows[i][j] = join.ops[j] == 'D' ? '-' : a->rows[i][x++];
+			else
+				joined->rows[i][j] = join.ops[j] == 'R' ? '-' : b->rows[i-a->count][x++];
+		}
+		joined->rows[i][joined->length] = '\0';
+		joined->members[i] = i < a->count ? a->members[i] : b->members[i-a->count];
+	}
+	ok = ok && SummariseGroup(joined);
+
+	free(join.across);
+	free(join.down);
+	free(join.ops);
+
+	return ok;
+}
+
+//runs one of the joins in msa->todo
+void MsaJoin(void *data, size_t t) {
+	Msa *msa = data;
+	size_t join = msa->todo[t];
+	Group *left = &msa->groups[msa->left[join]];
+	Group *right = &msa->groups[msa->right[join]];
+	bool ok;
+
+	//the shorter group goes across
+	if (left->length <= right->length)
+		ok = JoinGroups(msa, left, right, &msa->groups[msa->count+join]);
+	else
+		ok = JoinGroups(msa, right, left, &msa->groups[msa->count+join]);
+	FreeGroup(left);
+	FreeGroup(right);
+
+	if (!ok) {
+		pthread_mutex_lock(&msa->lock);
+		msa->failed = true;
+		pthread_mutex_unlock(&msa->lock);
+	}
+}
+
+//fills msa->left and msa->right by UPGMA, the distance between two
+//strings being how far their score falls short of their self scores.
+//levels gets the height of every node
+bool GuideTree(Msa *msa, int threads, size_t *levels) {
+	Pairwise pairwise;
+	size_t n = msa->count;
+	double *distance = malloc((n*n+1)*sizeof(double));
+	size_t *node = malloc((n+1)*sizeof(size_t)); //in each slot of distance
+	size_t *size = malloc((n+1)*sizeof(size_t)); //strings below it, 0 once joined
+	size_t best_i = 0;
+	size_t best_j = 0;
+	size_t i;
+	size_t j;
+	size_t t;
+	double best;
+	bool ok;
+
+	pairwise.seqs = msa->seqs;
+	pairwise.lengths = msa->lengths;
+	pairwise.count = n;
+	pairwise.match = msa->match;
+	pairwise.mismatch = msa->mismatch;
+	pairwise.gap = msa->gap;
+	pairwise.gap_extend = msa->gap_extend;
+	pairwise.engine = FASTNW_DYNAMIC;
+	pairwise.out = malloc((n*n+1)*sizeof(int));
+	ok = distance!=NULL && node!=NULL && size!=NULL && pairwise.out!=NULL
+		&& RunPairwise(&pairwise, threads);
+
+	for (i=0; ok && i<n; i++) {
+		for (j=0; j<n; j++)
+			distance[i*n+j] = (pairwise.out[i*n+i]+pairwise.out[j*n+j])/2.0
+				- pairwise.out[i*n+j];
+		node[i] = i;
+		size[i] = 1;
+	}
+
+	for (t=0; ok && t+1<n; t++) {
+		best = DBL_MAX;
+		for (i=0; i<n; i++) {
+			for (j=i+1; size[i]>0 && j<n; j++) {
+				if (size[j] > 0 && distance[i*n+j] < best) {
+					best = distance[i*n+j];
+					best_i = i;
+					best_j = j;
+				}
+			}
+		}
+
+		msa->left[t] = node[best_i];
+		msa->right[t] = node[best_j];
+		levels[n+t] = 1+(levels[node[best_i]] > levels[node[best_j]]
+			? levels[node[best_i]] : levels[node[best_j]]);
+		for (i=0; i<n; i++) {
+			if (size[i] == 0 || i == best_i || i == best_j)
+				continue;
+			distance[best_i*n+i] = (size[best_i]*distance[best_i*n+i]
+				+ size[best_j]*distance[best_j*n+i]) / (size[best_i]+size[best_j]);
+			distance[i*n+best_i] = distance[best_i*n+i];
+		}
+		size[best_i] += size[best_j];
+		size[best_j] = 0;
+		node[best_i] = n+t;
+	}
+
+	free(distance);
+	free(node);
+	free(size);
+	free(pairwise.out);
+
+	return ok;
+}
+
+//aligns every string of the msa
+bool RunMsa(Msa *msa, int threads) {
+	size_t n = msa->count;
+	size_t *levels = calloc(2*n+1, sizeof(size_t));
+	size_t level;
+	size_t count;
+	size_t i;
+	size_t t;
+	Group *root;
+
+	msa->failed = false;
+	msa->out = calloc(n+1, sizeof(char *));
+	msa->left = malloc((n+1)*sizeof(size_t));
+	msa->right = malloc((n+1)*sizeof(size_t));
+	msa->groups = calloc(2*n+1, sizeof(Group));
+	msa->todo = malloc((n+1)*sizeof(size_t));
+	if (levels==NULL || msa->out==NULL || msa->left==NULL || msa->right==NULL
+		|| msa->groups==NULL || msa->todo==NULL)
+		msa->failed = true;
+
+	//every string starts as a group of its own
+	for (i=0; !msa->failed && i<n; i++) {
+		msa->groups[i].count = 1;
+		msa->groups[i].length = msa->lengths[i];
+		msa->groups[i].rows = malloc(sizeof(char *));
+		msa->groups[i].members = malloc(sizeof(size_t));
+		if (msa->groups[i].rows == NULL || msa->groups[i].members == NULL) {
+			msa->failed = true;
+			break;
+		}
+		msa->groups[i].rows[0] = malloc((msa->lengths[i]+1)*sizeof(char));
+		if (msa->groups[i].rows[0] == NULL) {
+			msa->failed = true;
+			break;
+		}
+		memcpy(msa->groups[i].rows[0], msa->seqs[i], msa->lengths[i]);
+		msa->groups[i].rows[0][msa->lengths[i]] = '\0';
+		msa->groups[i].members[0] = i;
+		if (!SummariseGroup(&msa->groups[i]))
+			msa->failed = true;
+	}
+
+	if (!msa->failed && n > 1 && !GuideTree(msa, threads, levels))
+		msa->failed = true;
+
+	pthread_mutex_init(&msa->lock, NULL);
+	for (level=1; !msa->failed && n>1 && level<=levels[2*n-2]; level++) {
+		count = 0;
+		for (t=0; t+1<n; t++) {
+			if (levels[n+t] == level)
+				msa->todo[count++] = t;
+		}
+		RunParallel(MsaJoin, msa, count, threads);
+	}
+	pthread_mutex_destroy(&msa->lock);
+
+	//hand the rows of the root over in input order
+	if (!msa->failed && n > 0) {
+		root = &msa->groups[n > 1 ? 2*n-2 : 0];
+		for (i=0; i<n; i++) {
+			msa->out[root->members[i]] = root->rows[i];
+			root->rows[i] = NULL;
+		}
+	}
+
+	for (i=0; msa->groups!=NULL && i<2*n; i++)
+		FreeGroup(&msa->groups[i]);
+	free(msa->groups);
+	free(msa->left);
+	free(msa->right);
+	free(msa->todo);
+	free(levels);
+	msa->groups = NULL;
+	msa->left = NULL;
+	msa->right = NULL;
+	msa->todo = NULL;
+
+	if (msa->failed) {
+		FreeMsa(msa);
+		return false;
+	}
+	return true;
+}
+
+void FreeMsa(Msa *msa) {
+	size_t i;
+
+	if (msa->out == NULL)
+		return;
+	for (i=0; i<msa->count; i++)
+		free(msa->out[i]);
+	free(msa->out);
+	msa->out = NULL;
+}
+
+/*********************** Result cache ***********************/
+
+#define CACHE_BUCKETS 1024
+
+static __inline unsigned long long Rotate(unsigned long long x, int bits) {
+	return (x << bits) | (x >> (64-bits));
+}
+
+//final avalanche of a hash lane
+static __inline unsigned long long MixHash(unsigned long long h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+//feeds bytes into both lanes of a key, eight at a time
+void HashBytes(CacheKey *key, const void *data, size_t length) {
+	const unsigned char *bytes = data;
+	unsigned long long word;
+	size_t i;
+
+	for (i=0; i<length; i+=8) {
+		word = 0;
+		memcpy(&word, bytes+i, length-i < 8 ? length-i : 8);
+		key->hash[0] = Rotate(key->hash[0] ^ word, 31) * 0x9e3779b97f4a7c15ULL;
+		key->hash[1] = Rotate(key->hash[1] + word, 27) * 0xc2b2ae3d27d4eb4fULL + 0x52dce729;
+	}
+}
+
+CacheKey MakeCacheKey(const char *string1, size_t length1,
+	const char *string2, size_t length2, Method method, Engine engine,
+	int match, int mismatch, int gap, int gap_extend) {
+
+	CacheKey key;
+	long long header[8];
+
+	header[0] = length1;
+	header[1] = length2;
+	header[2] = method;
+	header[3] = engine;
+	header[4] = match;
+	header[5] = mismatch;
+	header[6] = gap;
+	header[7] = gap_extend;
+
+	key.hash[0] = 0x243f6a8885a308d3ULL;
+	key.hash[1] = 0x13198a2e03707344ULL;
+	HashBytes(&key, header, sizeof(header));
+	HashBytes(&key, string1, length1);
+	HashBytes(&key, string2, length2);
+	key.hash[0] = MixHash(key.hash[0] ^ key.hash[1]);
+	key.hash[1] = MixHash(key.hash[1] + key.hash[0]);
+
+	return key;
+}
+
+void InitCache(Cache *cache) {
+	memset(cache, 0, sizeof(Cache));
+	pthread_mutex_init(&cache->lock, NULL);
+}
+
+void FreeCache(Cache *cache) {
+	SetCacheBudget(cache, 0);
+	pthread_mutex_destroy(&cache->lock);
+}
+
+//whether the cache has a budget
+bool CacheEnabled(Cache *cache) {
+	bool ret;
+
+	pthread_mutex_lock(&cache->lock);
+	ret = (cache->max_bytes > 0);
+	pthread_mutex_unlock(&cache->lock);
+
+	return ret;
+}
+
+//takes an entry out of the recency list. Called with the cache locked
+void CacheUnlink(Cache *cache, CacheEntry *entry) {
+	if (entry->newer != NULL)
+		entry->newer->older = entry->older;
+	else
+		cache->newest = entry->older;
+	if (entry->older != NULL)
+		entry->older->newer = entry->newer;
+	else
+		cache->oldest = entry->newer;
+}
+
+//puts an entry at the front of the recency list
+void CacheLinkNewest(Cache *cache, CacheEntry *entry) {
+	entry->newer = NULL;
+	entry->older = cache->newest;
+	if (cache->newest != NULL)
+		cache->newest->newer = entry;
+	cache->newest = entry;
+	if (cache->oldest == NULL)
+		cache->oldest = entry;
+}
+
+//removes and frees the least recently used entry
+void CacheEvict(Cache *cache) {
+	CacheEntry *entry = cache->oldest;
+	CacheEntry **spot = &cache->buckets[entry->key.hash[0] % cache->bucket_count];
+
+	while (*spot != entry)
+		spot = &(*spot)->next;
+	*spot = entry->next;
+	CacheUnlink(cache, entry);
+
+	cache->bytes -= entry->bytes;
+	cache->count--;
+	free(entry->cigar);
+	free(entry);
+}
+
+//doubles the buckets once entries outnumber them. Keeps the old ones
+//if there is no memory for more
+void CacheGrow(Cache *cache) {
+	CacheEntry **buckets;
+	CacheEntry *entry;
+	CacheEntry *next;
+	size_t count = cache->bucket_count > 0 ? 2*cache->bucket_count : CACHE_BUCKETS;
+	size_t i;
+
+	buckets = calloc(count, sizeof(CacheEntry *));
+	if (buckets == NULL)
+		return;
+	for (i=0; i<cache->bucket_count; i++) {
+		for (entry=cache->buckets[i]; entry!=NULL; entry=next) {
+			next = entry->next;
+			entry->next = buckets[entry->key.hash[0] % count];
+			buckets[entry->key.hash[0] % count] = entry;
+		}
+	}
+	free(cache->buckets);
+	cache->buckets = buckets;
+	cache->bucket_count = count;
+}
+
+bool CacheGet(Cache *cache, CacheKey key, int *score, char **cigar) {
+	CacheEntry *entry = NULL;
+	bool found;
+
+	if (cigar != NULL)
+		*cigar = NULL;
+
+	pthread_mutex_lock(&cache->lock);
+	if (cache->bucket_count > 0)
+		entry = cache->buckets[key.hash[0] % cache->bucket_count];
+	while (entry != NULL && (entry->key.hash[0] != key.hash[0]
+		|| entry->key.hash[1] != key.hash[1]))
+		entry = entry->next;
+
+	found = (entry != NULL);
+	if (found && cigar != NULL && entry->cigar != NULL) {
+		*cigar = malloc((strlen(entry->cigar)+1)*sizeof(char));
+		if (*cigar == NULL)
+			found = false;
+		else
+			strcpy(*cigar, entry->cigar);
+	}
+	if (found) {
+		*score = entry->score;
+		CacheUnlink(cache, entry);
+		CacheLinkNewest(cache, entry);
+		cache->hits++;
+	} else {
+		cache->misses++;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return found;
+}
+
+void CachePut(Cache *cache, CacheKey key, int score, const char *cigar) {
+	CacheEntry *entry;
+	size_t bytes = sizeof(CacheEntry) + (cigar != NULL ? strlen(cigar)+1 : 0);
+	size_t bucket;
+
+	pthread_mutex_lock(&cache->lock);
+	if (bytes > cache->max_bytes) {
+		pthread_mutex_unlock(&cache->lock);
+		return;
+	}
+
+	//already there, from another thread or as a score only
+	if (cache->bucket_count > 0) {
+		for (entry=cache->buckets[key.hash[0] % cache->bucket_count];
+			entry!=NULL; entry=entry->next) {
+			if (entry->key.hash[0] == key.hash[0] && entry->key.hash[1] == key.hash[1]
+				&& (entry->cigar != NULL || cigar == NULL)) {
+				pthread_mutex_unlock(&cache->lock);
+				return;
+			}
+		}
+	}
+
+	entry = malloc(sizeof(CacheEntry));
+	if (entry != NULL && cigar != NULL) {
+		entry->cigar = malloc((strlen(cigar)+1)*sizeof(char));
+		if (entry->cigar == NULL) {
+			free(entry);
+			entry = NULL;
+		} else {
+			strcpy(entry->cigar, cigar);
+		}
+	} else if (entry != NULL) {
+		entry->cigar = NULL;
+	}
+	if (entry == NULL) {
+		pthread_mutex_unlock(&cache->lock);
+		return;
+	}
+	entry->key = key;
+	entry->score = score;
+	entry->bytes = bytes;
+
+	while (cache->bytes+bytes > cache->max_bytes)
+		CacheEvict(cache);
+	if (cache->count >= cache->bucket_count)
+		CacheGrow(cache);
+	if (cache->bucket_count == 0) {
+		free(entry->cigar);
+		free(entry);
+		pthread_mutex_unlock(&cache->lock);
+		return;
+	}
+
+	bucket = key.hash[0] % cache->bucket_count;
+	entry->next = cache->buckets[bucket];
+	cache->buckets[bucket] = entry;
+	CacheLinkNewest(cache, entry);
+	cache->bytes += bytes;
+	cache->count++;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void SetCacheBudget(Cache *cache, size_t max_bytes) {
+	pthread_mutex_lock(&cache->lock);
+	cache->max_bytes = max_bytes;
+	while (cache->bytes > max_bytes)
+		CacheEvict(cache);
+	if (cache->count == 0) {
+		free(cache->buckets);
+		cache->buckets = NULL;
+		cache->bucket_count = 0;
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+//empties the cache and zeroes its counters, keeping the budget
+void ClearCache(Cache *cache) {
+	size_t max_bytes = cache->max_bytes;
+
+	SetCacheBudget(cache, 0);
+	pthread_mutex_lock(&cache->lock);
+	cache->max_bytes = max_bytes;
+	cache->hits = 0;
+	cache->misses = 0;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+Alignment CigarAlignment(const char *string1, const char *string2,
+	const char *cigar, int score) {
+
+	Alignment ret = NewAlignment(strlen(string1), strlen(string2));
+	size_t spot = 0;
+	unsigned long run;
+	char *end;
+
+	if (ret.align1 == NULL)
+		return ret;
+	ret.score = score;
+
+	while (*cigar != '\0') {
+		run = strtoul(cigar, &end, 10);
+		for (cigar=end; run>0; run--, spot++) {
+			ret.align1[spot] = *cigar == 'D' ? '-' : *string1++;
+			ret.align2[spot] = *cigar == 'I' ? '-' : *string2++;
+		}
+		cigar++;
+	}
+	ret.align1[spot] = '\0';
+	ret.align2[spot] = '\0';
+
+	return ret;
+}
+
+/******************** Public interface **********************/
+
+//clears a profile at the start of a call
+double StartProfile(Profile *profile) {
+	if (profile == NULL)
+		return 0;
+	memset(profile, 0, sizeof(Profile));
+	return Now();
+}
+
+int FastNWScore(const char *string1, size_t length1,
+	const char *string2, size_t length2,
+	int match, int mismatch, int gap, int gap_extend, Engine engine,
+	size_t max_memory, int min_score, Profile *profile,
+	const volatile int *cancel) {
+
+	double start = StartProfile(profile);
+	int ret;
+
+	if (FastNWMemory(length1, length2, FASTNW_SCORE, engine, max_memory) == 0)
+		return INT_MIN;
+
+	if (length1 > length2)
+		ret = GlobalScore(string2, length2, string1, length1,
+			match, mismatch, gap, gap_extend, engine, min_score, profile, cancel);
+	else
+		ret = GlobalScore(string1, length1, string2, length2,
+			match, mismatch, gap, gap_extend, engine, min_score, profile, cancel);
+
+	if (profile != NULL)
+		profile->total = Now()-start;
+	if (cancel != NULL && *cancel)
+		return CANCELLED;
+	return ret;
+}
+
+//sets up an alignment big enough for any path through the matrix
+Alignment NewAlignment(size_t length1, size_t length2) {
+	Alignment ret;
+
+	ret.score = 0;
+	ret.align1 = malloc((length1+length2+1)*sizeof(char));
+	ret.align2 = malloc((length1+length2+1)*sizeof(char));
+	if (ret.align1==NULL || ret.align2==NULL) {
+		free(ret.align1);
+		free(ret.align2);
+		ret.align1 = NULL;
+		ret.align2 = NULL;
+	}
+
+	return ret;
+}
+
+Alignment FastNWAlign(const char *string1, size_t length1,
+	const char *string2, size_t length2,
+	int match, int mismatch, int gap, int gap_extend, Engine engine,
+	size_t max_memory, int min_score, Profile *profile,
+	const volatile int *cancel) {
+
+	HirschReturn res;
+	double start = StartProfile(profile);
+	size_t width = length1 < length2 ? length1 : length2;
+	size_t height = length1 < length2 ? length2 : length1;
+	size_t leaf_cells = LEAF_CELLS;
+	Alignment ret;
+
+	if (max_memory > 0) {
+		//no room for the wavefront engine's traceback means no wavefronts
+		if (engine == FASTNW_WAVEFRONT && AlignMemory(width, height, 1, FASTNW_WAVEFRONT) > max_memory)
+			engine = FASTNW_DYNAMIC;
+		leaf_cells = LeafCells(width, height, max_memory);
+	}
+	ret = NewAlignment(length1, length2);
+	if (ret.align1 == NULL || leaf_cells == 0) {
+		FreeAlignment(ret);
+		ret.align1 = NULL;
+		ret.align2 = NULL;
+		return ret;
+	}
+
+	//the shorter string goes across
+	if (length1 > length2)
+		res = GlobalAlign(ret.align2, ret.align1, string2, length2, string1, length1,
+			match, mismatch, gap, gap_extend, engine, leaf_cells, min_score, profile, cancel);
+	else
+		res = GlobalAlign(ret.align1, ret.align2, string1, length1, string2, length2,
+			match, mismatch, gap, gap_extend, engine, leaf_cells, min_score, profile, cancel);
+	if (profile != NULL)
+		profile->total = Now()-start;
+
+	ret.score = res.score;
+	if (cancel != NULL && *cancel) {
+		FreeAlignment(ret);
+		ret.align1 = NULL;
+		ret.align2 = NULL;
+		ret.score = CANCELLED;
+	} else if (res.index == NEED_MEM.index || res.index == LOW_SCORE.index
+		|| res.index == TRACE_ERROR.index) {
+		FreeAlignment(ret);
+		ret.align1 = NULL;
+		ret.align2 = NULL;
+		if (res.index == LOW_SCORE.index)
+			ret.score = BELOW_MIN_SCORE;
+		else
+			ret.score = res.index == TRACE_ERROR.index ? ENGINE_ERROR : INT_MIN;
+	}
+
+	return ret;
+}
+
+Alignment FastNWQAlign(const char *string1, size_t length1,
+	const char *string2, size_t length2,
+	int match, int mismatch, int gap, int gap_extend,
+	size_t max_memory, int min_score, Profile *profile,
+	const volatile int *cancel) {
+
+	HirschReturn res;
+	double start = StartProfile(profile);
+	Sequence seq1;
+	Sequence seq2;
+	Alignment ret;
+
+	ret = NewAlignment(length1, length2);
+	if (ret.align1 == NULL || FastNWMemory(length1, length2, FASTNW_QALIGN, FASTNW_DYNAMIC, max_memory) == 0) {
+		FreeAlignment(ret);
+		ret.align1 = NULL;
+		ret.align2 = NULL;
+		return ret;
+	}
+
+	if (!PackSequences(&seq1, string1, length1, &seq2, string2, length2)) {
+		FreeAlignment(ret);
+		ret.align1 = NULL;
+		ret.align2 = NULL;
+		return ret;
+	}
+
+	//the matrix is filled in one go, so it is only checked before
+	if (cancel != NULL && *cancel) {
+		FreeSequence(seq1);
+		FreeSequence(seq2);
+		FreeAlignment(ret);
+		ret.align1 = NULL;
+		ret.align2 = NULL;
+		ret.score = CANCELLED;
+		return ret;
+	}
+
+	if (profile != NULL)
+		profile->kernel = "needleman-wunsch";
+	if (length1 > length2)
+		res = NeedlemanWunsch(ret.align2, ret.align1, 0, seq2, 0, length2,
+			seq1, 0, length1, match, mismatch, gap, gap_extend, ANY, ANY, profile);
+	else
+		res = NeedlemanWunsch(ret.align1, ret.align2, 0, seq1, 0, length1,
+			seq2, 0, length2, match, mismatch, gap, gap_extend, ANY, ANY, profile);
+	FreeSequence(seq1);
+	FreeSequence(seq2);
+	if (profile != NULL)
+		profile->total = Now()-start;
+
+	ret.score = res.score;
+	if (res.index == NEED_MEM.index || res.index == TRACE_ERROR.index
+		|| res.score < min_score) {
+		FreeAlignment(ret);
+		ret.align1 = NULL;
+		ret.align2 = NULL;
+		if (res.index == NEED_MEM.index)
+			ret.score = INT_MIN;
+		else
+			ret.score = res.index == TRACE_ERROR.index ? ENGINE_ERROR : BELOW_MIN_SCORE;
+	} else {
+		ret.align1[res.index] = '\0';
+		ret.align2[res.index] = '\0';
+	}
+
+	return ret;
+}
+
+size_t FastNWMemory(size_t length1, size_t length2, Method method,
+	Engine engine, size_t max_memory) {
+
+	size_t width = length1 < length2 ? length1 : length2;
+	size_t height = length1 < length2 ? length2 : length1;
+	size_t leaf_cells = LEAF_CELLS;
+	size_t ret;
+
+	switch (method) {
+		case FASTNW_SCORE :
+			//the wavefront engine keeps only a few wavefronts when scoring
+			ret = ScoreMemory(width) + PackedMemory(width) + PackedMemory(height);
+			break;
+		case FASTNW_QALIGN :
+			ret = LeafMemory(width, height) + 2*(width+height+1)*sizeof(char)
+				+ PackedMemory(width) + PackedMemory(height);
+			break;
+		default :
+			if (max_memory > 0) {
+				if (engine == FASTNW_WAVEFRONT && AlignMemory(width, height, 1, FASTNW_WAVEFRONT) > max_memory)
+					engine = FASTNW_DYNAMIC;
+				leaf_cells = LeafCells(width, height, max_memory);
+				if (leaf_cells == 0)
+					return 0;
+			}
+			ret = AlignMemory(width, height, leaf_cells, engine);
+			break;
+	}
+
+	if (max_memory > 0 && ret > max_memory)
+		return 0;
+	return ret;
+}
+
+//CIGAR operation for column i of an alignment
+char CigarOp(Alignment alignment, size_t i) {
+	if (alignment.align2[i] == '-')
+		return 'I';
+	if (alignment.align1[i] == '-')
+		return 'D';
+	if (alignment.align1[i] == alignment.align2[i])
+		return '=';
+	return 'X';
+}
+
+char *FastNWCigar(Alignment alignment) {
+	size_t length = strlen(alignment.align1);
+	size_t i;
+	size_t run = 0;
+	size_t spot = 0;
+	char op;
+	char *ret = malloc((2*length+1)*sizeof(char)); //a run never takes more than twice its length
+
+	if (ret == NULL)
+		return NULL;
+
+	for (i=0; i<length; i++) {
+		op = CigarOp(alignment, i);
+		run++;
+		if (i+1 == length || CigarOp(alignment, i+1) != op) {
+			spot += sprintf(ret+spot, "%lu%c", (unsigned long)run, op);
+			run = 0;
+		}
+	}
+	ret[spot] = '\0';
+
+	return ret;
+}
+
+void FastNWOps(Alignment alignment, char *ops) {
+	size_t i;
+
+	for (i=0; alignment.align1[i] != '\0'; i++)
+		ops[i] = CigarOp(alignment, i);
+}
+
+void FreeAlignment(Alignment alignment) {
+	free(alignment.align1);
+	free(alignment.align2);
+}
+
+Stream *FastNWStreamNew(const char *string1, size_t length1,
+	int match, int mismatch, int gap, int gap_extend) {
+
+	Stream *stream = calloc(1, sizeof(Stream));
+	size_t width = length1+1;
+	size_t i;
+
+	if (stream == NULL)
+		return NULL;
+	stream->symbols = malloc(width*sizeof(unsigned char));
+	stream->cur = malloc(width*sizeof(int));
+	stream->cur_right = malloc(width*sizeof(int));
+	stream->cur_down = malloc(width*sizeof(int));
+	stream->prev = malloc(width*sizeof(int));
+	stream->prev_right = malloc(width*sizeof(int));
+	stream->prev_down = malloc(width*sizeof(int));
+	if (stream->symbols==NULL || stream->cur==NULL || stream->cur_right==NULL
+		|| stream->cur_down==NULL || stream->prev==NULL
+		|| stream->prev_right==NULL || stream->prev_down==NULL) {
+
+		FastNWStreamFree(stream);
+		return NULL;
+	}
+
+	stream->width = width;
+	stream->height = 0;
+	stream->bits = SequenceBits(string1, length1);
+	stream->match = match;
+	stream->mismatch = mismatch;
+	stream->gap = gap;
+	stream->gap_extend = gap_extend;
+	for (i=0; i<length1; i++)
+		stream->symbols[i] = SymbolCode(stream->bits, string1[i]);
+
+	//first row of Score, nothing of string2 seen yet
+	stream->cur[0] = 0;
+	stream->cur_right[0] = INT_MIN/4;
+	stream->cur_down[0] = INT_MIN/4;
+	for (i=1; i<width; i++) {
+		stream->cur[i] = INT_MIN/4;
+		stream->cur_right[i] = mymax(stream->cur[i-1] + gap,
+			stream->cur_right[i-1] + gap_extend);
+		stream->cur_down[i] = INT_MIN/4;
+	}
+
+	return stream;
+}
+
+void FastNWStreamAppend(Stream *stream, const char *chunk, size_t length) {
+	size_t j;
+	int *temp;
+
+	for (j=0; j<length; j++) {
+		temp = stream->prev;
+		stream->prev = stream->cur;
+		stream->cur = temp;
+
+		temp = stream->prev_right;
+		stream->prev_right = stream->cur_right;
+		stream->cur_right = temp;
+
+		temp = stream->prev_down;
+		stream->prev_down = stream->cur_down;
+		stream->cur_down = temp;
+
+		//characters string1 cannot hold match nothing in it
+		ScoreRow(stream->cur, stream->cur_right, stream->cur_down,
+			stream->prev, stream->prev_right, stream->prev_down,
+			stream->symbols, SymbolCode(stream->bits, chunk[j]), stream->width,
+			stream->match, stream->mismatch, stream->gap, stream->gap_extend);
+	}
+	stream->height += length;
+}
+
+int FastNWStreamScore(const Stream *stream) {
+	size_t i = stream->width-1;
+
+	return mymax(stream->cur[i], mymax(stream->cur_right[i], stream->cur_down[i]));
+}
+
+void FastNWStreamFree(Stream *stream) {
+	if (stream == NULL)
+		return;
+	free(stream->symbols);
+	free(stream->cur);
+	free(stream->cur_right);
+	free(stream->cur_down);
+	free(stream->prev);
+	free(stream->prev_right);
+	free(stream->prev_down);
+	free(stream);
+}
@@ -0,0 +1,158 @@
+/**********************************************************************
+* FastNW: Fast Needleman-Wunsch
+* Copyright (C) 2014 Jonathan Richards
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+* 
+* Written by Jonathan Richards, jonrds@gmail.com
+**********************************************************************/
+
+/*
+* FastNW library. The alignment engine without any Python, shared by
+* the Python module (FastNWModule.c) and the fastnw command-line
+* aligner (fastnw_cli.c).
+*
+* This is the stable interface: the FastNW* functions take the two
+* strings in either order and report alignments the way round they
+* were given. The engine itself is declared in fastnw_internal.h.
+*/
+
+#ifndef FASTNW_H
+#define FASTNW_H
+
+#include <stddef.h>
+#include <limits.h>
+
+#ifdef __cplusplus
+extern "C" {
+#else
+#include <stdbool.h>
+#endif
+
+typedef enum {FASTNW_DYNAMIC, FASTNW_WAVEFRONT, FASTNW_BANDED, FASTNW_FOUR_RUSSIANS} Engine;
+
+typedef enum {FASTNW_SCORE, FASTNW_ALIGN, FASTNW_QALIGN} Method;
+
+typedef struct {
+	int score;
+	char *align1;
+	char *align2;
+} Alignment;
+
+//returned for scores below min_score. INT_MIN as min_score turns it off
+#define BELOW_MIN_SCORE (INT_MIN+1)
+
+//returned once *cancel is set. Calls taking a cancel pointer check it
+//every PRUNE_ROWS rows and at every Hirsch call, NULL for calls that
+//cannot be cancelled
+#define CANCELLED (INT_MIN+2)
+
+//returned when an alignment's traceback runs into a cell it cannot have
+//come from. That is a bug in the engine rather than a lack of memory
+#define ENGINE_ERROR (INT_MIN+3)
+
+//what a call spent its time and memory on. Engine functions take a
+//Profile pointer and only fill it in when it is not NULL, so the
+//counters cost nothing when nobody asks for them
+typedef struct {
+	long long score_cells; //cells filled by Score
+	long long leaf_cells; //cells filled by NeedlemanWunsch
+	long nodes; //Hirsch calls
+	long leaves; //Hirsch calls handed to NeedlemanWunsch
+	int depth; //deepest Hirsch call, the first being 0
+
+	size_t allocated; //bytes of DP workspace allocated in total
+	size_t workspace; //bytes held at the moment
+	size_t peak; //most bytes held at once
+
+	//seconds per phase
+	double forward; //Score before the middle row
+	double reverse; //Score after it, on the reversed strings
+	double partition;
+	double fill; //NeedlemanWunsch matrix
+	double traceback;
+	double total;
+
+	const char *kernel; //"dp", "hirschberg", "needleman-wunsch", "wfa", "biwfa", "band" or "russians"
+} Profile;
+
+//see FastNWStreamNew
+typedef struct Stream Stream;
+
+/******************** Public interface **********************/
+
+//best global score of two strings. INT_MIN when out of memory.
+//max_memory is a budget in bytes, 0 for none: the alignments pick
+//their leaf size to fit it, and anything that cannot fit fails up
+//front. Scores that cannot reach min_score (INT_MIN for any) are
+//abandoned as early as possible and BELOW_MIN_SCORE returned.
+//profile may be NULL, otherwise it is zeroed and filled in. Setting
+//*cancel from another thread stops the call with CANCELLED
+int FastNWScore(const char *string1, size_t length1,
+	const char *string2, size_t length2,
+	int match, int mismatch, int gap, int gap_extend, Engine engine,
+	size_t max_memory, int min_score, Profile *profile,
+	const volatile int *cancel);
+
+//global alignment of two strings, partitioned with Hirschberg (or BiWFA)
+//so memory stays linear. align1 is NULL when out of memory, below
+//min_score, cancelled or on an engine error, told apart by score being
+//INT_MIN, BELOW_MIN_SCORE, CANCELLED or ENGINE_ERROR. Release with
+//FreeAlignment
+Alignment FastNWAlign(const char *string1, size_t length1,
+	const char *string2, size_t length2,
+	int match, int mismatch, int gap, int gap_extend, Engine engine,
+	size_t max_memory, int min_score, Profile *profile,
+	const volatile int *cancel);
+
+//as FastNWAlign, but filling the whole matrix without partitioning
+Alignment FastNWQAlign(const char *string1, size_t length1,
+	const char *string2, size_t length2,
+	int match, int mismatch, int gap, int gap_extend,
+	size_t max_memory, int min_score, Profile *profile,
+	const volatile int *cancel);
+
+//peak bytes a call is expected to allocate under a budget (0 for none),
+//or 0 if the budget is too small for it
+size_t FastNWMemory(size_t length1, size_t length2, Method method,
+	Engine engine, size_t max_memory);
+
+//CIGAR string of an alignment with string1 as the query: '=' match,
+//'X' mismatch, 'I' a character only in string1, 'D' only in string2.
+//must be freed, NULL when out of memory
+char *FastNWCigar(Alignment alignment);
+
+//the CIGAR operation of every column, one a byte and not run-length
+//encoded, into ops, which must hold strlen(alignment.align1) bytes.
+//ops may be alignment.align1 itself
+void FastNWOps(Alignment alignment, char *ops);
+
+void FreeAlignment(Alignment alignment);
+
+//global scoring of string2 as it arrives against string1. Each append
+//only costs length1 times the length appended, and FastNWStreamScore
+//is then the score of string1 against everything appended so far.
+//NULL when out of memory. Release with FastNWStreamFree
+Stream *FastNWStreamNew(const char *string1, size_t length1,
+	int match, int mismatch, int gap, int gap_extend);
+void FastNWStreamAppend(Stream *stream, const char *chunk, size_t length);
+int FastNWStreamScore(const Stream *stream);
+void FastNWStreamFree(Stream *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
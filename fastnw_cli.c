@@ -0,0 +1,305 @@
+/**********************************************************************
+* FastNW: Fast Needleman-Wunsch
+* Copyright (C) 2014 Jonathan Richards
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+* 
+* Written by Jonathan Richards, jonrds@gmail.com
+**********************************************************************/
+
+/*
+* fastnw: command-line front end to the FastNW library.
+*
+* Reads pairs of FASTA or FASTQ records and prints one tab-separated
+* line per pair: both ids, the score and, unless only scores are
+* asked for, the alignment (both aligned strings, or a CIGAR string).
+* With two files, record i of the first is paired with record i of the
+* second. With one file, or none (standard input), consecutive records
+* are paired.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include "fastnw_internal.h"
+
+//pairs read and aligned at a time
+#define CLI_BATCH 1024
+
+typedef enum {ALIGNMENTS, SCORES, CIGARS} Output;
+
+typedef struct {
+	int match;
+	int mismatch;
+	int gap;
+	int gap_extend;
+	Engine engine;
+	Output output;
+	bool quick; //full matrix, as qalign
+	size_t max_memory; //per alignment, 0 for no budget
+	int min_score; //pairs scoring below are left out
+
+	Text ids1[CLI_BATCH];
+	Text seqs1[CLI_BATCH];
+	Text ids2[CLI_BATCH];
+	Text seqs2[CLI_BATCH];
+	Alignment results[CLI_BATCH];
+	pthread_mutex_t lock;
+	bool failed;
+	int failure; //score of the first pair to fail, INT_MIN out of memory
+} Batch;
+
+void Usage(FILE *out) {
+	fprintf(out,
+		"usage: fastnw [options] [pairs.fa | first.fa second.fa]\n"
+		"\n"
+		"Globally aligns pairs of FASTA/FASTQ records, read from standard\n"
+		"input when no file is given (use - for standard input).\n"
+		"\n"
+		"  -m INT  match score (1)\n"
+		"  -x INT  mismatch score (-1)\n"
+		"  -g INT  gap score (-2)\n"
+		"  -e INT  gap extend score (same as gap)\n"
+		"  -w      use the wavefront (WFA) engine\n"
+		"  -b      use the banded engine, widening the band until it is exact\n"
+		"  -r      score DNA with linear gaps by 2x2 block lookups (with -s)\n"
+		"  -q      fill the whole matrix instead of partitioning\n"
+		"  -s      print scores only\n"
+		"  -c      print CIGAR strings instead of aligned sequences\n"
+		"  -M INT  memory budget in bytes for each alignment\n"
+		"  -T INT  leave out pairs scoring below this\n"
+		"  -t INT  threads (1)\n"
+		"  -h      show this help\n");
+}
+
+//aligns or scores pair i of the batch
+void BatchWork(void *data, size_t i) {
+	Batch *batch = data;
+	Alignment *res = &batch->results[i];
+
+	if (batch->output == SCORES) {
+		res->align1 = NULL;
+		res->align2 = NULL;
+		res->score = FastNWScore(batch->seqs1[i].data, batch->seqs1[i].length,
+			batch->seqs2[i].data, batch->seqs2[i].length,
+			batch->match, batch->mismatch, batch->gap, batch->gap_extend,
+			batch->engine, batch->max_memory, batch->min_score, NULL, NULL);
+		if (res->score != INT_MIN)
+			return;
+	} else {
+		if (batch->quick)
+			*res = FastNWQAlign(batch->seqs1[i].data, batch->seqs1[i].length,
+				batch->seqs2[i].data, batch->seqs2[i].length,
+				batch->match, batch->mismatch, batch->gap, batch->gap_extend,
+				batch->max_memory, batch->min_score, NULL, NULL);
+		else
+			*res = FastNWAlign(batch->seqs1[i].data, batch->seqs1[i].length,
+				batch->seqs2[i].data, batch->seqs2[i].length,
+				batch->match, batch->mismatch, batch->gap, batch->gap_extend,
+				batch->engine, batch->max_memory, batch->min_score, NULL, NULL);
+		if (res->align1 != NULL || res->score == BELOW_MIN_SCORE)
+			return;
+	}
+
+	pthread_mutex_lock(&batch->lock);
+	if (!batch->failed)
+		batch->failure = res->score;
+	batch->failed = true;
+	pthread_mutex_unlock(&batch->lock);
+}
+
+//why a batch failed, from the score of its failing pair
+const char *FailureMessage(int failure) {
+	if (failure == ENGINE_ERROR)
+		return "internal error in the alignment engine";
+	return "out of memory";
+}
+
+//prints pair i of the batch
+bool BatchPrint(Batch *batch, size_t i) {
+	Alignment *res = &batch->results[i];
+	char *cigar;
+
+	//left out by -T
+	if (res->score == BELOW_MIN_SCORE)
+		return true;
+
+	printf("%s\t%s\t%d", batch->ids1[i].data, batch->ids2[i].data, res->score);
+	switch (batch->output) {
+		case ALIGNMENTS :
+			printf("\t%s\t%s", res->align1, res->align2);
+			break;
+		case CIGARS :
+			cigar = FastNWCigar(*res);
+			if (cigar == NULL)
+				return false;
+			printf("\t%s", cigar);
+			free(cigar);
+			break;
+		default :
+			break;
+	}
+	printf("\n");
+
+	return true;
+}
+
+//opens a file, or standard input for "-"
+bool OpenReader(FastaReader *reader, const char *path) {
+	memset(reader, 0, sizeof(FastaReader));
+	reader->line_start = true;
+	reader->file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+	if (reader->file == NULL) {
+		perror(path);
+		return false;
+	}
+	reader->buffer = malloc(FASTA_BUFFER*sizeof(char));
+	if (reader->buffer == NULL) {
+		fprintf(stderr, "fastnw: out of memory\n");
+		return false;
+	}
+	return true;
+}
+
+void CloseReader(FastaReader *reader) {
+	if (reader->file != NULL && reader->file != stdin)
+		fclose(reader->file);
+	free(reader->buffer);
+}
+
+int main(int argc, char *argv[]) {
+	Batch *batch;
+	FastaReader first;
+	FastaReader second;
+	FastaReader *other; //where the second record of each pair comes from
+	Text extra_id = {NULL, 0, 0};
+	Text extra_seq = {NULL, 0, 0};
+	size_t count;
+	size_t i;
+	int threads = 1;
+	int opt;
+	int error; //of a failed read
+	int ret = 0;
+	bool paired;
+	bool done = false;
+
+	batch = calloc(1, sizeof(Batch));
+	if (batch == NULL) {
+		fprintf(stderr, "fastnw: out of memory\n");
+		return 2;
+	}
+	batch->match = 1;
+	batch->mismatch = -1;
+	batch->gap = -2;
+	batch->gap_extend = INT_MIN;
+	batch->min_score = INT_MIN;
+	batch->engine = FASTNW_DYNAMIC;
+	batch->output = ALIGNMENTS;
+
+	while ((opt = getopt(argc, argv, "m:x:g:e:wbrqscM:T:t:h")) != -1) {
+		switch (opt) {
+			case 'm' : batch->match = atoi(optarg); break;
+			case 'x' : batch->mismatch = atoi(optarg); break;
+			case 'g' : batch->gap = atoi(optarg); break;
+			case 'e' : batch->gap_extend = atoi(optarg); break;
+			case 'w' : batch->engine = FASTNW_WAVEFRONT; break;
+			case 'b' : batch->engine = FASTNW_BANDED; break;
+			case 'r' : batch->engine = FASTNW_FOUR_RUSSIANS; break;
+			case 'q' : batch->quick = true; break;
+			case 's' : batch->output = SCORES; break;
+			case 'c' : batch->output = CIGARS; break;
+			case 'M' : batch->max_memory = strtoul(optarg, NULL, 10); break;
+			case 'T' : batch->min_score = atoi(optarg); break;
+			case 't' : threads = atoi(optarg); break;
+			case 'h' : Usage(stdout); free(batch); return 0;
+			default : Usage(stderr); free(batch); return 1;
+		}
+	}
+	if (batch->gap_extend == INT_MIN)
+		batch->gap_extend = batch->gap;
+	if (threads < 1 || argc-optind > 2) {
+		Usage(stderr);
+		free(batch);
+		return 1;
+	}
+
+	paired = (argc-optind == 2);
+	if (!OpenReader(&first, optind < argc ? argv[optind] : "-")
+		|| (paired && !OpenReader(&second, argv[optind+1]))) {
+		free(batch);
+		return 1;
+	}
+	other = paired ? &second : &first;
+	pthread_mutex_init(&batch->lock, NULL);
+
+	while (!done && ret == 0) {
+		//read a batch of pairs
+		for (count=0; count<CLI_BATCH; count++) {
+			if (!ReadRecord(&first, &batch->ids1[count], &batch->seqs1[count])) {
+				done = true;
+				break;
+			}
+			if (!ReadRecord(other, &batch->ids2[count], &batch->seqs2[count])) {
+				if (!other->failed)
+					fprintf(stderr, "fastnw: record %s has no partner\n",
+						batch->ids1[count].data);
+				ret = 1;
+				break;
+			}
+		}
+		if (paired && done && ReadRecord(&second, &extra_id, &extra_seq)) {
+			fprintf(stderr, "fastnw: record %s has no partner\n", extra_id.data);
+			ret = 1;
+		}
+		if (first.failed || other->failed) {
+			error = first.failed ? first.error : other->error;
+			fprintf(stderr, "fastnw: %s\n", error != 0 ? strerror(error) : "out of memory");
+			ret = 2;
+		}
+		if (ret != 0)
+			break;
+
+		RunParallel(BatchWork, batch, count, threads);
+		for (i=0; i<count; i++) {
+			if (!batch->failed && !BatchPrint(batch, i)) {
+				batch->failed = true;
+				batch->failure = INT_MIN;
+			}
+			FreeAlignment(batch->results[i]);
+		}
+		if (batch->failed) {
+			fprintf(stderr, "fastnw: %s\n", FailureMessage(batch->failure));
+			ret = 2;
+		}
+	}
+
+	for (i=0; i<CLI_BATCH; i++) {
+		free(batch->ids1[i].data);
+		free(batch->seqs1[i].data);
+		free(batch->ids2[i].data);
+		free(batch->seqs2[i].data);
+	}
+	free(extra_id.data);
+	free(extra_seq.data);
+	pthread_mutex_destroy(&batch->lock);
+	CloseReader(&first);
+	if (paired)
+		CloseReader(&second);
+	free(batch);
+
+	return ret;
+}
@@ -0,0 +1,413 @@
+/**********************************************************************
+* FastNW: Fast Needleman-Wunsch
+* Copyright (C) 2014 Jonathan Richards
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+* 
+* Written by Jonathan Richards, jonrds@gmail.com
+**********************************************************************/
+
+/*
+* Internals of the FastNW library, for fastnw.c and the programs built
+* with it (FastNWModule.c, fastnw_cli.c). Everything here expects the
+* shorter string horizontally and may change between versions; other
+* code should only include fastnw.h.
+*/
+
+#ifndef FASTNW_INTERNAL_H
+#define FASTNW_INTERNAL_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "fastnw.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static __inline int mymax(int a, int b) {
+  return a > b ? a : b;
+}
+
+//Hirsch hands partitions of at most this many cells to NeedlemanWunsch
+//unless a memory budget picks another cutoff
+#define LEAF_CELLS 1000000
+
+typedef struct {
+	int score;
+	size_t index;
+} HirschReturn;
+
+extern const HirschReturn NEED_MEM;
+extern const HirschReturn LOW_SCORE; //could not reach min_score
+extern const HirschReturn TRACE_ERROR; //traceback left the matrix, a bug
+
+typedef struct {
+	int *cur;
+	int *cur_right;
+	int *cur_down;
+	bool pruned; //stopped early, min_score was out of reach
+} ScoreReturn;
+
+extern const ScoreReturn NO_MEM;
+extern const ScoreReturn PRUNED;
+
+typedef enum {NONE, DOWN, RIGHT, ANY} Direction;
+
+//a string as the DP kernels read it. Packed 2 bits a symbol when it is
+//all ACGT, 4 bits when it only uses IUPAC nucleotide codes and left as
+//the caller's characters otherwise. reverse reads it back to front, so
+//no reversed copy is needed
+typedef struct {
+	const unsigned char *symbols;
+	size_t length;
+	int bits; //2, 4 or 8
+	bool reverse;
+} Sequence;
+
+typedef struct {
+	int index;
+	Direction left;
+	Direction right;
+} PartitionReturn;
+
+//growable string
+typedef struct {
+	char *data;
+	size_t length;
+	size_t capacity;
+} Text;
+
+//reads FASTA or FASTQ from memory (a buffer or a mapped file) or a stream
+typedef struct {
+	const char *data;
+	size_t length;
+	size_t pos;
+	FILE *file;
+	char *buffer;
+	char header; //'>' or '@' starting the next record, once read
+	bool line_start;
+	bool failed;
+	int error; //errno when failed on a read error, 0 when out of memory
+} FastaReader;
+
+#define FASTA_BUFFER 65536
+
+//one of the best records of a search
+typedef struct {
+	int score;
+	long index;
+	char *id;
+	char *seq;
+	size_t length;
+	char *Z; //aligned query
+	char *W; //aligned record
+} Hit;
+
+//state of a search, see RunSearch
+typedef struct {
+	const char *query;
+	size_t query_length;
+	int match;
+	int mismatch;
+	int gap;
+	int gap_extend;
+	Engine engine;
+
+	//current batch of records
+	Text *ids;
+	Text *seqs;
+	long first;
+
+	//worst of the best k kept at the top
+	Hit *heap;
+	size_t size;
+	size_t k;
+
+	pthread_mutex_t lock;
+	bool failed;
+} Search;
+
+//state of an all-vs-all run, see RunPairwise
+typedef struct {
+	const char **seqs;
+	size_t *lengths;
+	size_t count;
+	int match;
+	int mismatch;
+	int gap;
+	int gap_extend;
+	Engine engine;
+
+	//upper triangle tiles, as (row, column) tile numbers
+	size_t *tile_rows;
+	size_t *tile_cols;
+
+	int *out; //count*count row-major matrix
+	pthread_mutex_t lock;
+	bool failed;
+} Pairwise;
+
+//state of a run aligning pairs of strings, see RunPairs
+typedef struct {
+	const char **seqs1;
+	size_t *lengths1;
+	const char **seqs2;
+	size_t *lengths2;
+	size_t count;
+	int match;
+	int mismatch;
+	int gap;
+	int gap_extend;
+	Engine engine;
+	bool align; //false to only score, leaving ops NULL
+	int min_score; //when only scoring, INT_MIN for any
+
+	int *scores; //one per pair
+	char **ops; //per pair, what FastNWOps gives for it, 0 terminated
+	pthread_mutex_t lock;
+	bool failed;
+} Pairs;
+
+//rows of an alignment of some of the strings of a Msa, with a summary
+//of every column: column j has counts[k] rows of symbols[k] for k in
+//starts[j]..starts[j+1], and residues[j] rows that are not gaps
+typedef struct {
+	char **rows;
+	size_t *members; //string of each row
+	size_t count;
+	size_t length;
+
+	unsigned char *symbols;
+	unsigned int *counts;
+	size_t *starts;
+	unsigned int *residues;
+} Group;
+
+//state of a progressive multiple alignment, see RunMsa
+typedef struct {
+	const char **seqs;
+	size_t *lengths;
+	size_t count;
+	int match;
+	int mismatch;
+	int gap;
+	int gap_extend;
+
+	//guide tree. Nodes below count are the strings, node count+i is
+	//the ith join, of left[i] and right[i]
+	size_t *left;
+	size_t *right;
+	Group *groups; //of every node not yet joined to another
+	size_t *todo; //joins that can run at once
+
+	char **out; //aligned strings, in input order
+	pthread_mutex_t lock;
+	bool failed;
+} Msa;
+
+//the last row of Score over a string whose vertical partner is still
+//arriving, so more of it can be appended without starting over
+struct Stream {
+	unsigned char *symbols; //horizontal string, one symbol a byte
+	size_t width;
+	size_t height; //vertical characters so far
+	int bits; //encoding of symbols, see PackSequences
+
+	int match;
+	int mismatch;
+	int gap;
+	int gap_extend;
+
+	//last row, and the one before while a row is filled
+	int *cur;
+	int *cur_right;
+	int *cur_down;
+	int *prev;
+	int *prev_right;
+	int *prev_down;
+};
+
+//identifies a call: a 128 bit hash of both strings, their lengths,
+//the method, the engine and the scores. Hashes this wide are taken
+//as unique rather than keeping the strings to compare
+typedef struct {
+	unsigned long long hash[2];
+} CacheKey;
+
+typedef struct CacheEntry {
+	CacheKey key;
+	int score;
+	char *cigar; //NULL when only the score was cached
+	size_t bytes; //counted against the budget
+
+	struct CacheEntry *next; //in the same bucket
+	struct CacheEntry *newer; //least recently used order
+	struct CacheEntry *older;
+} CacheEntry;
+
+//least recently used results within a budget of bytes
+typedef struct {
+	CacheEntry **buckets;
+	size_t bucket_count;
+	size_t count;
+	CacheEntry *newest;
+	CacheEntry *oldest;
+
+	size_t bytes;
+	size_t max_bytes; //0 turns the cache off
+	long long hits;
+	long long misses;
+
+	pthread_mutex_t lock;
+} Cache;
+
+/************************ Engine ****************************/
+
+//encodes two strings with the same number of bits a symbol, so their
+//symbols can be compared. False when out of memory
+int SequenceBits(const char *string, size_t length);
+bool PackSequences(Sequence *horizontal, const char *string1, size_t length1,
+	Sequence *vertical, const char *string2, size_t length2);
+void FreeSequence(Sequence seq);
+Sequence Reversed(Sequence seq);
+
+//bytes PackSequences allocates for a string at most
+size_t PackedMemory(size_t length);
+
+//last rows of the matrix. Gives up with PRUNED when no alignment
+//through the rows so far, followed by more_rows further rows, can
+//score min_score, or when *cancel is set
+ScoreReturn Score(Sequence horizontal, size_t hl, size_t hr,
+	Sequence vertical, size_t vl, size_t vr,
+	int match, int mismatch, int gap, int gap_extend,
+	Direction start_direction, int min_score, size_t more_rows,
+	Profile *profile,
+	const volatile int *cancel);
+
+HirschReturn NeedlemanWunsch(char *Z, char *W, size_t Z_spot,
+	Sequence horizontal, size_t hl, size_t hr,
+	Sequence vertical, size_t vl, size_t vr,
+	int match, int mismatch, int gap, int gap_extend,
+	Direction start_direction, Direction end_direction, Profile *profile);
+
+PartitionReturn Partition(ScoreReturn ScoreL, ScoreReturn ScoreR, size_t width,
+	int gap, int gap_extend);
+
+//depth is that of the call in the recursion, 0 at the top
+HirschReturn Hirsch(char *Z, char *W, size_t Z_spot,
+	Sequence horizontal, size_t hl, size_t hr,
+	Sequence vertical, size_t vl, size_t vr,
+	int match, int mismatch, int gap, int gap_extend,
+	Direction start_direction, Direction end_direction,
+	size_t leaf_cells, int min_score, int depth, Profile *profile,
+	const volatile int *cancel);
+
+HirschReturn WFAAlign(char *Z, char *W,
+	const char *horizontal, const char *rev_hor, size_t width,
+	const char *vertical, const char *rev_vert, size_t height,
+	int match, int mismatch, int gap, int gap_extend, int min_score);
+
+//best global score, the shorter string horizontal. INT_MIN when out
+//of memory, BELOW_MIN_SCORE when under min_score, CANCELLED once
+//*cancel is set (the wfa engine only checks it when done)
+int GlobalScore(const char *horizontal, size_t width,
+	const char *vertical, size_t height,
+	int match, int mismatch, int gap, int gap_extend, Engine engine,
+	int min_score, Profile *profile,
+	const volatile int *cancel);
+
+//global alignment, the shorter string horizontal. Z and W need room
+//for width+height+1 characters; index is NEED_MEM.index when out of
+//memory, LOW_SCORE.index when the score would be under min_score and
+//TRACE_ERROR.index on an engine error
+HirschReturn GlobalAlign(char *Z, char *W,
+	const char *horizontal, size_t width,
+	const char *vertical, size_t height,
+	int match, int mismatch, int gap, int gap_extend, Engine engine,
+	size_t leaf_cells, int min_score, Profile *profile,
+	const volatile int *cancel);
+
+//bytes of workspace used by Score, NeedlemanWunsch and GlobalAlign
+//(including the aligned strings) at their peak
+size_t ScoreMemory(size_t width);
+size_t LeafMemory(size_t width, size_t height);
+size_t AlignMemory(size_t width, size_t height, size_t leaf_cells, Engine engine);
+
+//largest leaf cutoff keeping GlobalAlign within max_memory bytes,
+//0 when no cutoff does
+size_t LeafCells(size_t width, size_t height, size_t max_memory);
+
+//calls work(data, i) for every i below count over a number of threads
+void RunParallel(void (*work)(void *, size_t), void *data,
+	size_t count, int threads);
+
+bool TextAppend(Text *text, char c);
+bool TextClear(Text *text);
+
+//next FASTA or FASTQ record. false at the end of input or on failure
+bool ReadRecord(FastaReader *reader, Text *id, Text *seq);
+
+//scores every record of reader against search->query and aligns the
+//best search->k, which come back in search->heap best first
+bool RunSearch(Search *search, FastaReader *reader, int threads);
+
+//fills pairwise->out with the score of every pair
+bool RunPairwise(Pairwise *pairwise, int threads);
+
+//aligns seqs1[i] with seqs2[i] for every i into pairs->scores and
+//pairs->ops, which FreePairs releases, or only scores them when
+//pairs->align is false, pairs below min_score getting BELOW_MIN_SCORE.
+//false when out of memory
+bool RunPairs(Pairs *pairs, int threads);
+void FreePairs(Pairs *pairs);
+
+//aligns every string of msa into msa->out, which FreeMsa releases.
+//false when out of memory
+bool RunMsa(Msa *msa, int threads);
+void FreeMsa(Msa *msa);
+
+void InitCache(Cache *cache);
+void FreeCache(Cache *cache);
+bool CacheEnabled(Cache *cache);
+CacheKey MakeCacheKey(const char *string1, size_t length1,
+	const char *string2, size_t length2, Method method, Engine engine,
+	int match, int mismatch, int gap, int gap_extend);
+
+//whether the key is cached, counting a hit or a miss. The CIGAR, if
+//wanted and there is one, comes back as a copy that must be freed
+bool CacheGet(Cache *cache, CacheKey key, int *score, char **cigar);
+
+//cigar may be NULL for a score. Nothing is cached if it does not fit
+void CachePut(Cache *cache, CacheKey key, int score, const char *cigar);
+
+//changes the budget, evicting to fit it. 0 empties and turns it off
+void SetCacheBudget(Cache *cache, size_t max_bytes);
+void ClearCache(Cache *cache);
+
+//room for any alignment of strings of these lengths, align1 NULL when
+//out of memory
+Alignment NewAlignment(size_t length1, size_t length2);
+
+//rebuilds an alignment from its strings and CIGAR (see FastNWCigar).
+//align1 is NULL when out of memory
+Alignment CigarAlignment(const char *string1, const char *string2,
+	const char *cigar, int score);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,3 +1,6 @@
-from distutils.core import setup, Extension
+try:
+    from setuptools import setup, Extension
+except ImportError:
+    from distutils.core import setup, Extension
 setup(name='FastNW', version='0.1',  \
-      ext_modules=[Extension('FastNW', ['FastNWModule.c'])])
+      ext_modules=[Extension('FastNW', ['FastNWModule.c', 'fastnw.c'])])
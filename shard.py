@@ -0,0 +1,370 @@
+#!/usr/bin/env python
+"""
+FastNW: Fast Needleman-Wunsch
+Copyright (C) 2014 Jonathan Richards
+
+Sharded batch runner for the FastNW module.
+
+Aligns pairs of FASTA or (four-line) FASTQ records, like the fastnw
+program: with two files record i of the first is paired with record i
+of the second, with one file consecutive records are paired. The input
+is indexed once into shards of --shard-pairs pairs, and worker
+processes take shards from a queue. Each worker maps the input files
+itself, so records are shared through the page cache rather than
+copied between processes, and is pinned to the CPUs of one NUMA node
+(round robin) where the platform allows it. A shard is aligned with
+align_batch (score_batch with --scores) and written to its own file in the
+work directory, renamed into place once complete, so a restarted job
+with the same work directory skips finished shards:
+
+    python shard.py -w work -o out.tsv -m 1 -x -1 -g -2 pairs.fa
+
+Output lines match the fastnw program with -c or -s: both ids, the
+score and the CIGAR string, tab-separated, in input order.
+"""
+
+from __future__ import print_function
+
+import argparse
+import glob
+import json
+import mmap
+import multiprocessing
+import os
+import re
+import shutil
+import struct
+import sys
+import time
+import traceback
+
+#bytes of input counted at a time while indexing
+INDEX_CHUNK = 1 << 24
+
+#pairs handed to align_batch or score_batch at a time, bounding a
+#worker's memory
+CALL_PAIRS = 4096
+
+MANIFEST = "manifest.json"
+
+#the byte that starts a record's header and how many lines separate
+#one record from the next (0 for any number, FASTA)
+FORMATS = {
+	"fasta": (b">", 0),
+	"fastq": (b"@", 4),
+}
+
+CIGAR_RUN = re.compile(b"=+|X+|I+|D+")
+
+def detect_format(path):
+	with open(path, "rb") as f:
+		first = f.read(1)
+	for name, (start, lines) in FORMATS.items():
+		if first == start:
+			return name
+	raise ValueError("%s is not FASTA or FASTQ" % path)
+
+def map_file(path):
+	f = open(path, "rb")
+	try:
+		if os.fstat(f.fileno()).st_size == 0:
+			return b""
+		return mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+	finally:
+		f.close()
+
+#counts the records of a mapped file and finds where every step'th
+#one starts. Returns (records, [offset of record 0, step, 2*step ...])
+def index_records(data, format, step):
+	lines = FORMATS[format][1]
+	#every record but the first starts after one of these
+	sep = b"\n" if lines else b"\n" + FORMATS[format][0]
+	per_record = lines or 1
+	size = len(data)
+	offsets = [0]
+	target = step*per_record #marks before the next offset wanted
+	seen = 0
+	pos = 0
+
+	while pos < size:
+		#a mark starting in this chunk is counted here, even when it
+		#ends in the next one
+		chunk = data[pos:pos+INDEX_CHUNK+len(sep)-1]
+		left = chunk.count(sep)
+		at = 0
+		while seen+left >= target:
+			for _ in range(target-seen):
+				at = chunk.find(sep, at)+1
+			left -= target-seen
+			seen = target
+			#the record starts on the byte after the newline
+			offsets.append(pos+at)
+			target += step*per_record
+		seen += left
+		pos += INDEX_CHUNK
+
+	if size == 0:
+		return 0, offsets
+	if lines:
+		#the last record may not end in a newline
+		return (seen+lines-1)//lines, offsets
+	return seen+1, offsets
+
+#the (id, sequence) records in a block of a file
+def parse_records(block, format):
+	records = []
+	if format == "fastq":
+		lines = block.split(b"\n")
+		for i in range(0, len(lines)-3, 4):
+			fields = lines[i][1:].split(None, 1)
+			records.append((fields[0] if fields else b"", lines[i+1].strip()))
+		return records
+
+	for record in block[1:].split(b"\n>"):
+		header, _, seq = record.partition(b"\n")
+		fields = header.split(None, 1)
+		records.append((fields[0] if fields else b"", b"".join(seq.split())))
+	return records
+
+#the CPUs of every NUMA node this process may run on, empty when they
+#cannot be found or there is only one node
+def numa_nodes():
+	if not hasattr(os, "sched_setaffinity"):
+		return []
+	allowed = os.sched_getaffinity(0)
+	nodes = []
+	for path in sorted(glob.glob("/sys/devices/system/node/node[0-9]*/cpulist")):
+		cpus = set()
+		with open(path) as f:
+			for part in f.read().strip().split(","):
+				if "-" in part:
+					lo, hi = part.split("-")
+					cpus.update(range(int(lo), int(hi)+1))
+				elif part:
+					cpus.add(int(part))
+		if cpus & allowed:
+			nodes.append(sorted(cpus & allowed))
+	return nodes if len(nodes) > 1 else []
+
+def shard_path(work, shard):
+	return os.path.join(work, "shard-%06d.tsv" % shard)
+
+#aligns one shard and writes it to its file in the work directory
+def run_shard(manifest, data, shard, FastNW):
+	settings = manifest["settings"]
+	format = manifest["format"]
+	blocks = manifest["blocks"][shard]
+
+	if len(data) == 1:
+		records = parse_records(data[0][blocks[0][0]:blocks[0][1]], format)
+		pairs = list(zip(records[0::2], records[1::2]))
+	else:
+		pairs = list(zip(parse_records(data[0][blocks[0][0]:blocks[0][1]], format),
+			parse_records(data[1][blocks[1][0]:blocks[1][1]], format)))
+
+	scores = dict((k, settings[k]) for k in ("match", "mismatch", "gap", "gap_extend"))
+	scores["engine"] = settings["engine"]
+	scores["threads"] = settings["threads"]
+	score_args = dict(scores)
+	if settings["min_score"] is not None:
+		score_args["min_score"] = settings["min_score"]
+	path = shard_path(manifest["work"], shard)
+	with open(path + ".tmp", "wb") as out:
+		for first in range(0, len(pairs), CALL_PAIRS):
+			call = pairs[first:first+CALL_PAIRS]
+			lines = []
+			if settings["scores"]:
+				#pairs below min_score come back below it
+				result = FastNW.score_batch([p[0][1] for p in call],
+					[p[1][1] for p in call], **score_args)
+				result = struct.unpack("=%di" % len(call), bytes(result))
+				for i, ((id1, seq1), (id2, seq2)) in enumerate(call):
+					if settings["min_score"] is None or result[i] >= settings["min_score"]:
+						lines.append(b"%s\t%s\t%d\n" % (id1, id2, result[i]))
+			else:
+				result, ops, offsets = FastNW.align_batch([p[0][1] for p in call],
+					[p[1][1] for p in call], **scores)
+				result = struct.unpack("=%di" % len(call), bytes(result))
+				offsets = struct.unpack("=%dq" % (len(call)+1), bytes(offsets))
+				ops = bytes(ops)
+				for i, ((id1, seq1), (id2, seq2)) in enumerate(call):
+					if settings["min_score"] is not None and result[i] < settings["min_score"]:
+						continue
+					cigar = b"".join(b"%d%s" % (len(run), run[:1])
+						for run in CIGAR_RUN.findall(ops[offsets[i]:offsets[i+1]]))
+					lines.append(b"%s\t%s\t%d\t%s\n" % (id1, id2, result[i], cigar))
+			out.write(b"".join(lines))
+		out.flush()
+		os.fsync(out.fileno())
+	os.rename(path + ".tmp", path)
+	return len(pairs)
+
+#worker process: takes shards from the queue until it gets None
+def worker(manifest, queue, cpus):
+	try:
+		if cpus:
+			os.sched_setaffinity(0, cpus)
+		import FastNW
+		data = [map_file(p["path"]) for p in manifest["inputs"]]
+		while True:
+			shard = queue.get()
+			if shard is None:
+				break
+			start = time.time()
+			pairs = run_shard(manifest, data, shard, FastNW)
+			print("shard %d: %d pairs in %.2f s" % (shard, pairs, time.time()-start),
+				file=sys.stderr)
+	except Exception:
+		traceback.print_exc()
+		sys.exit(1)
+
+#the inputs as the manifest records them, to tell whether a work
+#directory belongs to this job
+def describe_inputs(paths):
+	return [{"path": os.path.abspath(p), "size": os.path.getsize(p),
+		"mtime": int(os.path.getmtime(p))} for p in paths]
+
+#reads the manifest of an earlier run of this job, or indexes the
+#inputs and writes a new one
+def load_manifest(args, settings):
+	inputs = describe_inputs(args.inputs)
+	path = os.path.join(args.work, MANIFEST)
+	if os.path.exists(path):
+		with open(path) as f:
+			manifest = json.load(f)
+		if manifest["inputs"] != inputs or manifest["settings"] != settings \
+			or manifest["shard_pairs"] != args.shard_pairs:
+			raise ValueError("%s holds a different job; use a new work directory" % args.work)
+		manifest["work"] = os.path.abspath(args.work)
+		return manifest
+
+	format = detect_format(args.inputs[0])
+	if len(args.inputs) == 2 and detect_format(args.inputs[1]) != format:
+		raise ValueError("both inputs must be FASTA or both FASTQ")
+
+	start = time.time()
+	#a shard of a single file takes both records of its pairs
+	step = args.shard_pairs*(3-len(args.inputs))
+	indexes = []
+	for p in args.inputs:
+		data = map_file(p)
+		indexes.append(index_records(data, format, step))
+		if hasattr(data, "close"):
+			data.close()
+
+	if len(indexes) == 1:
+		if indexes[0][0]%2:
+			raise ValueError("%s has an odd number of records" % args.inputs[0])
+		pairs = indexes[0][0]//2
+	else:
+		if indexes[0][0] != indexes[1][0]:
+			raise ValueError("the inputs have different numbers of records")
+		pairs = indexes[0][0]
+
+	shards = (pairs+args.shard_pairs-1)//args.shard_pairs
+	blocks = []
+	for shard in range(shards):
+		blocks.append([[offsets[shard], offsets[shard+1] if shard+1 < shards else inp["size"]]
+			for (records, offsets), inp in zip(indexes, inputs)])
+	print("indexed %d pairs into %d shards in %.2f s" % (pairs, shards, time.time()-start),
+		file=sys.stderr)
+
+	manifest = {
+		"inputs": inputs,
+		"format": format,
+		"settings": settings,
+		"shard_pairs": args.shard_pairs,
+		"pairs": pairs,
+		"blocks": blocks,
+	}
+	with open(path + ".tmp", "w") as f:
+		json.dump(manifest, f)
+	os.rename(path + ".tmp", path)
+	manifest["work"] = os.path.abspath(args.work)
+	return manifest
+
+#concatenates the shards in order
+def merge(manifest, out):
+	for shard in range(len(manifest["blocks"])):
+		with open(shard_path(manifest["work"], shard), "rb") as f:
+			shutil.copyfileobj(f, out)
+
+def main():
+	parser = argparse.ArgumentParser(description="Align pairs of records across processes.")
+	parser.add_argument("inputs", nargs="+", help="pairs.fa, or first.fa second.fa")
+	parser.add_argument("-w", "--work", required=True,
+		help="directory for the index and finished shards, reused on restart")
+	parser.add_argument("-o", "--out", help="merged output (standard output if not given)")
+	parser.add_argument("-m", "--match", type=int, default=1)
+	parser.add_argument("-x", "--mismatch", type=int, default=-1)
+	parser.add_argument("-g", "--gap", type=int, default=-2)
+	parser.add_argument("-e", "--gap-extend", type=int, help="same as gap if not given")
+	parser.add_argument("--engine", default="dp", choices=["dp", "wfa", "band", "russians"],
+		help="dp, wfa, band or russians (the last only speeds up -s)")
+	parser.add_argument("-s", "--scores", action="store_true", help="scores only, no CIGAR")
+	parser.add_argument("-T", "--min-score", type=int, help="leave out pairs scoring below this")
+	parser.add_argument("-p", "--workers", type=int, default=multiprocessing.cpu_count(),
+		help="worker processes (one per CPU)")
+	parser.add_argument("-t", "--threads", type=int, default=1,
+		help="threads each worker aligns with")
+	parser.add_argument("--shard-pairs", type=int, default=100000)
+	parser.add_argument("--no-pin", action="store_true", help="do not pin workers to NUMA nodes")
+	args = parser.parse_args()
+
+	if len(args.inputs) > 2:
+		parser.error("give one file of pairs or two files")
+	if args.workers < 1 or args.threads < 1 or args.shard_pairs < 1:
+		parser.error("workers, threads and shard-pairs must be positive")
+
+	settings = {
+		"match": args.match,
+		"mismatch": args.mismatch,
+		"gap": args.gap,
+		"gap_extend": args.gap if args.gap_extend is None else args.gap_extend,
+		"engine": args.engine,
+		"scores": args.scores,
+		"min_score": args.min_score,
+		"threads": args.threads,
+	}
+	if not os.path.isdir(args.work):
+		os.makedirs(args.work)
+	try:
+		manifest = load_manifest(args, settings)
+	except (ValueError, IOError, OSError) as e:
+		print("shard.py: %s" % e, file=sys.stderr)
+		return 2
+
+	todo = [s for s in range(len(manifest["blocks"]))
+		if not os.path.exists(shard_path(manifest["work"], s))]
+	if len(todo) < len(manifest["blocks"]):
+		print("skipping %d finished shards" % (len(manifest["blocks"])-len(todo)), file=sys.stderr)
+
+	if todo:
+		nodes = [] if args.no_pin else numa_nodes()
+		queue = multiprocessing.Queue()
+		for shard in todo:
+			queue.put(shard)
+		workers = []
+		for w in range(min(args.workers, len(todo))):
+			queue.put(None)
+			cpus = nodes[w%len(nodes)] if nodes else None
+			workers.append(multiprocessing.Process(target=worker, args=(manifest, queue, cpus)))
+			workers[-1].start()
+		for p in workers:
+			p.join()
+		if any(p.exitcode != 0 for p in workers):
+			print("shard.py: a worker failed, rerun to retry its shards", file=sys.stderr)
+			return 2
+
+	if args.out:
+		with open(args.out + ".tmp", "wb") as out:
+			merge(manifest, out)
+		os.rename(args.out + ".tmp", args.out)
+	else:
+		out = getattr(sys.stdout, "buffer", sys.stdout)
+		merge(manifest, out)
+		out.flush()
+	return 0
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,95 @@
+"""
+FastNW: Fast Needleman-Wunsch
+Copyright (C) 2014 Jonathan Richards
+
+Helpers shared by the tests: random strings, and a scorer for finished
+alignments that follows the module's rules (affine gaps, no insertion
+next to a deletion).
+"""
+
+import random
+
+#(match, mismatch, gap, gap_extend) tuples the tests run over
+SCORES = [(1, -1, -2, -2), (2, -3, -5, -2), (1, -1, -1, -3), (1, 0, -1, -1), (5, -4, -10, -1)]
+
+def random_string(rng, length, alphabet="ACGT"):
+	return "".join(rng.choice(alphabet) for i in range(length))
+
+#copy of string with about rate of its symbols substituted, deleted or
+#followed by an insertion
+def mutate(rng, string, rate, alphabet="ACGT"):
+	out = []
+	for c in string:
+		r = rng.random()
+		if r < rate/3:
+			out.append(rng.choice(alphabet))
+		elif r < 2*rate/3:
+			pass
+		elif r < rate:
+			out.append(c)
+			out.append(rng.choice(alphabet))
+		else:
+			out.append(c)
+	return "".join(out)
+
+#pairs of random strings: empty and one symbol long, unrelated, and
+#mutated copies of each other
+def random_pairs(rng, count, max_length, alphabet="ACGT"):
+	pairs = [("", ""), ("", "A"), ("A", ""), ("A", "A"), ("A", "C"), ("AC", "A")]
+	while len(pairs) < count:
+		a = random_string(rng, rng.randint(0, max_length), alphabet)
+		if rng.random() < 0.7:
+			b = mutate(rng, a, rng.random()*0.5, alphabet)
+		else:
+			b = random_string(rng, rng.randint(0, max_length), alphabet)
+		pairs.append((a, b))
+	return pairs
+
+#best score by the textbook affine recurrence, where a gap one way may
+#not follow a gap the other way. Quadratic in Python, for short strings
+def reference_score(a, b, match, mismatch, gap, gap_extend):
+	none = -10**9
+	diagonal = [[none]*(len(a)+1) for j in range(len(b)+1)]
+	right = [[none]*(len(a)+1) for j in range(len(b)+1)]
+	down = [[none]*(len(a)+1) for j in range(len(b)+1)]
+	diagonal[0][0] = 0
+	for j in range(len(b)+1):
+		for i in range(len(a)+1):
+			if i > 0 and j > 0:
+				diagonal[j][i] = max(diagonal[j-1][i-1], right[j-1][i-1], down[j-1][i-1]) \
+					+ (match if a[i-1] == b[j-1] else mismatch)
+			if i > 0:
+				right[j][i] = max(diagonal[j][i-1]+gap, right[j][i-1]+gap_extend)
+			if j > 0:
+				down[j][i] = max(diagonal[j-1][i]+gap, down[j-1][i]+gap_extend)
+	return max(diagonal[-1][-1], right[-1][-1], down[-1][-1])
+
+#score of an alignment, None if it breaks the rules
+def alignment_score(z, w, match, mismatch, gap, gap_extend):
+	score = 0
+	last = None
+	for c1, c2 in zip(z, w):
+		if c1 == "-" and c2 == "-":
+			return None
+		if c1 == "-":
+			if last == "right":
+				return None
+			score += gap_extend if last == "down" else gap
+			last = "down"
+		elif c2 == "-":
+			if last == "down":
+				return None
+			score += gap_extend if last == "right" else gap
+			last = "right"
+		else:
+			score += match if c1 == c2 else mismatch
+			last = "match"
+	return score
+
+#checks that alignment (z, w, score) aligns a with b and scores score
+def check_alignment(test, alignment, a, b, scores):
+	z, w, score = alignment[0], alignment[1], alignment[2]
+	test.assertEqual(len(z), len(w))
+	test.assertEqual(z.replace("-", ""), a)
+	test.assertEqual(w.replace("-", ""), b)
+	test.assertEqual(alignment_score(z, w, *scores), score)
@@ -0,0 +1,79 @@
+"""
+FastNW: Fast Needleman-Wunsch
+Copyright (C) 2014 Jonathan Richards
+
+score_async, align_async and qalign_async give the same results as
+the blocking calls, and cancelling a running call stops it.
+"""
+
+import random
+import time
+import unittest
+
+try:
+	import concurrent.futures as futures
+except ImportError:
+	futures = None
+
+import FastNW
+from support import SCORES, random_pairs, random_string
+
+@unittest.skipIf(futures is None, "needs concurrent.futures")
+class AsyncTest(unittest.TestCase):
+	def test_results(self):
+		rng = random.Random(12)
+		pairs = random_pairs(rng, 80, 200)
+		calls = [(FastNW.score_async(a, b, *SCORES[1]), FastNW.align_async(a, b, *SCORES[1]),
+			FastNW.qalign_async(a, b, *SCORES[0]), FastNW.score_async(a, b, *SCORES[1], engine="wfa"))
+			for a, b in pairs]
+		for (a, b), (score, align, qalign, wfa) in zip(pairs, calls):
+			self.assertTrue(isinstance(score, futures.Future))
+			self.assertEqual(score.result(), FastNW.score(a, b, *SCORES[1]))
+			self.assertEqual(align.result(), FastNW.align(a, b, *SCORES[1]))
+			self.assertEqual(qalign.result(), FastNW.qalign(a, b, *SCORES[0]))
+			self.assertEqual(wfa.result(), score.result())
+
+	def test_options(self):
+		self.assertEqual(FastNW.score_async("ACGT", "TTTT", 1, -1, -1, min_score=10).result(), None)
+		result, profile = FastNW.score_async("ACGT", "ACGA", 1, -1, -1, profile=True).result()
+		self.assertEqual(result, 2)
+		self.assertEqual(profile["kernel"], "dp")
+		self.assertRaises(ValueError, FastNW.score_async, "A", "A", 1, -1, -1, engine="x")
+
+	#a cancelled call stops at its next check rather than running on
+	def test_cancel(self):
+		rng = random.Random(13)
+		a = random_string(rng, 30000)
+		b = random_string(rng, 30000)
+		started = time.time()
+		FastNW.score(a, b, 1, -1, -2)
+		full = time.time()-started
+
+		for call in (FastNW.score_async, FastNW.align_async):
+			future = call(a, b, 1, -1, -2)
+			time.sleep(0.05)
+			started = time.time()
+			self.assertTrue(future.cancel())
+			self.assertTrue(future.cancelled())
+			self.assertRaises(futures.CancelledError, future.result)
+			#the pool is free again long before the call would have ended
+			self.assertEqual(FastNW.score_async("AC", "AC", 1, -1, -1).result(), 2)
+			self.assertTrue(time.time()-started < full/2, (time.time()-started, full))
+		self.assertEqual(FastNW.score_async(a[:100], b[:100], 1, -1, -2).result(),
+			FastNW.score(a[:100], b[:100], 1, -1, -2))
+
+	#cancelling queued calls drops them without running them
+	def test_cancel_queued(self):
+		rng = random.Random(14)
+		a = random_string(rng, 20000)
+		b = random_string(rng, 20000)
+		queued = [FastNW.score_async(a, b, 1, -1, -2) for i in range(40)]
+		for future in queued:
+			future.cancel()
+		started = time.time()
+		self.assertEqual(FastNW.score_async("AC", "AC", 1, -1, -1).result(), 2)
+		self.assertTrue(all(future.cancelled() for future in queued))
+		self.assertTrue(time.time()-started < 5)
+
+if __name__ == "__main__":
+	unittest.main()
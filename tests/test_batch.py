@@ -0,0 +1,121 @@
+"""
+FastNW: Fast Needleman-Wunsch
+Copyright (C) 2014 Jonathan Richards
+
+align_batch must give, for every pair, the score of align and the
+CIGAR operations of its alignment, and score_batch the score of score,
+however many threads share the work.
+"""
+
+import random
+import struct
+import unittest
+
+import FastNW
+from support import SCORES, random_pairs
+
+#CIGAR operation of every column, as FastNWCigar writes them
+def operations(z, w):
+	ops = []
+	for c1, c2 in zip(z, w):
+		if c2 == "-":
+			ops.append("I")
+		elif c1 == "-":
+			ops.append("D")
+		elif c1 == c2:
+			ops.append("=")
+		else:
+			ops.append("X")
+	return "".join(ops)
+
+class BatchTest(unittest.TestCase):
+	def setUp(self):
+		rng = random.Random(15)
+		pairs = random_pairs(rng, 150, 150)
+		self.strings1 = [a for a, b in pairs]
+		self.strings2 = [b for a, b in pairs]
+
+	def unpack(self, result):
+		scores, ops, offsets = result
+		count = len(self.strings1)
+		self.assertEqual(len(scores), 4*count)
+		self.assertEqual(len(offsets), 8*(count+1))
+		scores = struct.unpack("%di" % count, bytes(scores))
+		offsets = struct.unpack("%dq" % (count+1), bytes(offsets))
+		self.assertEqual(offsets[0], 0)
+		self.assertEqual(offsets[-1], len(ops))
+		return scores, bytes(ops).decode("ascii"), offsets
+
+	def check(self, result, scores_tuple):
+		scores, ops, offsets = self.unpack(result)
+		for i, (a, b) in enumerate(zip(self.strings1, self.strings2)):
+			z, w, score = FastNW.align(a, b, *scores_tuple)
+			self.assertEqual(scores[i], score, i)
+			self.assertEqual(ops[offsets[i]:offsets[i+1]], operations(z, w), i)
+
+	def test_threads(self):
+		for threads in (1, 2, 7):
+			for scores in SCORES:
+				self.check(FastNW.align_batch(self.strings1, self.strings2, *scores,
+					threads=threads), scores)
+
+	def test_linear_gaps(self):
+		self.check(FastNW.align_batch(self.strings1, self.strings2, 1, -1, -2), (1, -1, -2, -2))
+
+	def test_engines(self):
+		for engine in ("wfa", "band"):
+			scores, ops, offsets = self.unpack(FastNW.align_batch(self.strings1, self.strings2,
+				*SCORES[0], threads=3, engine=engine))
+			for i, (a, b) in enumerate(zip(self.strings1, self.strings2)):
+				self.assertEqual(scores[i], FastNW.score(a, b, *SCORES[0]), (engine, i))
+				#any optimal alignment will do, but its operations
+				#must spell out both strings
+				pair = ops[offsets[i]:offsets[i+1]]
+				self.assertEqual(len(pair)-pair.count("I"), len(b))
+				self.assertEqual(len(pair)-pair.count("D"), len(a))
+
+	def test_scores(self):
+		count = len(self.strings1)
+		for threads in (1, 4):
+			for engine in ("dp", "wfa", "band"):
+				for scores in SCORES[:3]:
+					result = FastNW.score_batch(self.strings1, self.strings2, *scores,
+						threads=threads, engine=engine)
+					self.assertEqual(len(result), 4*count)
+					result = struct.unpack("%di" % count, bytes(result))
+					for i, (a, b) in enumerate(zip(self.strings1, self.strings2)):
+						self.assertEqual(result[i], FastNW.score(a, b, *scores), (engine, i))
+
+	#pairs below min_score come back below it, the rest with their score
+	def test_min_score(self):
+		count = len(self.strings1)
+		for min_score in (-20, 0, 30):
+			result = FastNW.score_batch(self.strings1, self.strings2, *SCORES[0],
+				threads=3, min_score=min_score)
+			result = struct.unpack("%di" % count, bytes(result))
+			for i, (a, b) in enumerate(zip(self.strings1, self.strings2)):
+				score = FastNW.score(a, b, *SCORES[0])
+				if score >= min_score:
+					self.assertEqual(result[i], score, i)
+				else:
+					self.assertTrue(result[i] < min_score, i)
+
+	def test_empty(self):
+		self.assertEqual(len(FastNW.score_batch([], [], 1, -1, -1)), 0)
+		scores, ops, offsets = FastNW.align_batch([], [], 1, -1, -1)
+		self.assertEqual(len(scores), 0)
+		self.assertEqual(len(ops), 0)
+		self.assertEqual(struct.unpack("q", bytes(offsets)), (0,))
+
+	def test_errors(self):
+		self.assertRaises(ValueError, FastNW.align_batch, ["A"], [], 1, -1, -1)
+		self.assertRaises(ValueError, FastNW.align_batch, ["A"], ["A"], 1, -1, -1, threads=0)
+		self.assertRaises(ValueError, FastNW.align_batch, ["A"], ["A"], 1, -1, -1, engine="x")
+		self.assertRaises(TypeError, FastNW.align_batch, ["A", 1], ["A", "C"], 1, -1, -1)
+		self.assertRaises(ValueError, FastNW.score_batch, ["A"], [], 1, -1, -1)
+		self.assertRaises(ValueError, FastNW.score_batch, ["A"], ["A"], 1, -1, -1, threads=0)
+		self.assertRaises(ValueError, FastNW.score_batch, ["A"], ["A"], 1, -1, -1, engine="x")
+		self.assertRaises(TypeError, FastNW.score_batch, ["A", 1], ["A", "C"], 1, -1, -1)
+
+if __name__ == "__main__":
+	unittest.main()
@@ -0,0 +1,82 @@
+"""
+FastNW: Fast Needleman-Wunsch
+Copyright (C) 2014 Jonathan Richards
+
+The result cache: repeats are answered from it with the same results,
+it stays within its budget, and it is off unless set_cache turns it on.
+"""
+
+import random
+import unittest
+
+import FastNW
+from support import random_string
+
+SCORES = (2, -3, -5, -2)
+
+class CacheTest(unittest.TestCase):
+	def setUp(self):
+		rng = random.Random(11)
+		self.pairs = [(random_string(rng, rng.randint(1, 80)), random_string(rng, rng.randint(1, 80), "ACGTN"))
+			for i in range(30)]
+		self.pairs += [("", "ACG"), ("A", "")]
+		FastNW.set_cache(0)
+
+	def tearDown(self):
+		FastNW.set_cache(0)
+
+	def results(self):
+		ret = []
+		for a, b in self.pairs:
+			for engine in ("dp", "wfa"):
+				ret.append(FastNW.score(a, b, *SCORES, engine=engine))
+				ret.append(FastNW.align(a, b, *SCORES, engine=engine))
+				ret.append(FastNW.align(b, a, *SCORES, engine=engine))
+				ret.append(FastNW.score(a, b, *SCORES, engine=engine, min_score=0))
+			ret.append(FastNW.qalign(a, b, *SCORES))
+		return ret
+
+	def test_off(self):
+		self.results()
+		info = FastNW.cache_info()
+		self.assertEqual((info["hits"], info["misses"], info["entries"], info["bytes"]), (0, 0, 0, 0))
+
+	def test_repeats(self):
+		expected = self.results()
+		FastNW.set_cache(1 << 20)
+		self.assertEqual(self.results(), expected)
+		misses = FastNW.cache_info()["misses"]
+		self.assertEqual(self.results(), expected)
+		info = FastNW.cache_info()
+		self.assertEqual(info["misses"], misses)
+		self.assertTrue(info["hits"] >= len(expected))
+		self.assertTrue(0 < info["bytes"] <= info["max_bytes"])
+
+	#a small budget drops the least recently used results
+	def test_budget(self):
+		expected = self.results()
+		FastNW.set_cache(2000)
+		for i in range(3):
+			self.assertEqual(self.results(), expected)
+			self.assertTrue(FastNW.cache_info()["bytes"] <= 2000)
+		FastNW.set_cache(300)
+		self.assertTrue(FastNW.cache_info()["bytes"] <= 300)
+
+	def test_clear(self):
+		FastNW.set_cache(1 << 20)
+		self.results()
+		FastNW.cache_clear()
+		info = FastNW.cache_info()
+		self.assertEqual((info["hits"], info["misses"], info["entries"], info["bytes"]), (0, 0, 0, 0))
+		self.assertEqual(info["max_bytes"], 1 << 20)
+
+	#profile calls are always computed, so their counters are real
+	def test_profile(self):
+		FastNW.set_cache(1 << 20)
+		a, b = self.pairs[0]
+		FastNW.align(a, b, *SCORES)
+		alignment, profile = FastNW.align(a, b, *SCORES, profile=True)
+		self.assertTrue(profile["score_cells"] + profile["leaf_cells"] > 0)
+
+if __name__ == "__main__":
+	unittest.main()
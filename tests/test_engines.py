@@ -0,0 +1,138 @@
+"""
+FastNW: Fast Needleman-Wunsch
+Copyright (C) 2014 Jonathan Richards
+
+The engines other than dp must agree with it on every pair they take,
+and fall back to it on the rest.
+"""
+
+import random
+import unittest
+
+import FastNW
+from support import SCORES, random_pairs, random_string, mutate, check_alignment, reference_score
+
+class EngineTest(unittest.TestCase):
+	#scores and alignments of engine against dp over random pairs
+	def compare(self, engine, pairs, scores=SCORES):
+		for a, b in pairs:
+			for s in scores:
+				expected = FastNW.score(a, b, *s)
+				self.assertEqual(FastNW.score(a, b, *s, engine=engine), expected, (engine, a, b, s))
+				alignment = FastNW.align(a, b, *s, engine=engine)
+				self.assertEqual(alignment[2], expected, (engine, a, b, s))
+				check_alignment(self, alignment, a, b, s)
+
+	def test_wfa(self):
+		rng = random.Random(1)
+		self.compare("wfa", random_pairs(rng, 300, 60))
+
+	def test_wfa_long(self):
+		rng = random.Random(2)
+		pairs = []
+		for rate in (0.01, 0.1, 0.3):
+			a = random_string(rng, 3000)
+			pairs.append((a, mutate(rng, a, rate)))
+		pairs.append((random_string(rng, 2000), random_string(rng, 2500)))
+		self.compare("wfa", pairs, SCORES[:2])
+
+	#divergent pairs give up on the wavefronts and are scored by dp
+	def test_wfa_divergent(self):
+		rng = random.Random(3)
+		a = random_string(rng, 4000)
+		b = random_string(rng, 4000)
+		score, profile = FastNW.score(a, b, 1, -1, -2, -1, engine="wfa", profile=True)
+		self.assertEqual(profile["kernel"], "dp")
+		self.assertEqual(score, FastNW.score(a, b, 1, -1, -2, -1))
+
+	def test_band(self):
+		rng = random.Random(6)
+		self.compare("band", random_pairs(rng, 200, 80))
+		self.compare("band", random_pairs(rng, 30, 80, "ACGTNRY"), SCORES[:2])
+
+	#similar pairs are proven within a narrow band, including the traceback
+	def test_band_long(self):
+		rng = random.Random(7)
+		pairs = []
+		for rate in (0.0, 0.01, 0.05):
+			a = random_string(rng, 3000)
+			pairs.append((a, mutate(rng, a, rate)))
+		a = random_string(rng, 3000)
+		pairs.append((a, mutate(rng, a, 0.02)[:2000]))
+		self.compare("band", pairs, SCORES[:2])
+		a, b = pairs[1]
+		self.assertEqual(FastNW.score(a, b, *SCORES[0], engine="band", profile=True)[1]["kernel"], "band")
+		self.assertEqual(FastNW.align(a, b, *SCORES[0], engine="band", profile=True)[1]["kernel"], "band")
+
+	#divergent pairs stop widening the band well before it covers the
+	#matrix, and are scored by dp
+	def test_band_divergent(self):
+		rng = random.Random(8)
+		a = random_string(rng, 4000)
+		b = random_string(rng, 4000)
+		score, profile = FastNW.score(a, b, 1, -1, -2, -1, engine="band", profile=True)
+		self.assertEqual(profile["kernel"], "dp")
+		self.assertEqual(score, FastNW.score(a, b, 1, -1, -2, -1))
+		self.assertTrue(profile["score_cells"] < 1.5*4001*4001, profile["score_cells"])
+
+	#linear gap scores the russians engine has blocks for
+	LINEAR = [(1, -1, -1, -1), (1, -1, -2, -2), (2, -3, -2, -2), (1, 0, -1, -1)]
+
+	#short pairs do not pay for the tables and are scored by dp
+	def test_russians(self):
+		rng = random.Random(9)
+		self.compare("russians", random_pairs(rng, 100, 60), self.LINEAR + SCORES[:2])
+
+	#long enough for the tables, with lengths that do not fill the last
+	#block and a string much shorter than the other
+	def test_russians_long(self):
+		rng = random.Random(10)
+		a = random_string(rng, 2001)
+		pairs = [(a, mutate(rng, a, 0.05)), (a, mutate(rng, a, 0.3)),
+			(random_string(rng, 1999), random_string(rng, 2400)),
+			(random_string(rng, 4000), random_string(rng, 1501)), (a, a)]
+		for a, b in pairs:
+			for s in self.LINEAR:
+				score, profile = FastNW.score(a, b, *s, engine="russians", profile=True)
+				self.assertEqual(profile["kernel"], "russians", (len(a), len(b), s))
+				self.assertEqual(score, FastNW.score(a, b, *s), (len(a), len(b), s))
+				self.assertEqual(FastNW.score(b, a, *s, engine="russians"), score)
+		#IUPAC codes pack into blocks too; affine gaps and symbols that do
+		#not pack have none
+		a = random_string(rng, 2000, "ACGTN")
+		b = mutate(rng, a, 0.1, "ACGTRY")
+		score, profile = FastNW.score(a, b, 1, -1, -1, engine="russians", profile=True)
+		self.assertEqual(profile["kernel"], "russians")
+		self.assertEqual(score, FastNW.score(a, b, 1, -1, -1))
+		a, b = pairs[0]
+		self.assertEqual(FastNW.score(a, b, 1, -1, -2, -1, engine="russians", profile=True)[1]["kernel"], "dp")
+		self.assertEqual(FastNW.score(a+"X", b, 1, -1, -1, engine="russians", profile=True)[1]["kernel"], "dp")
+
+	#dp packs ACGT into 2 bits and IUPAC codes into 4, and leaves anything
+	#else as it is; each must score as the plain recurrence does
+	def test_packed(self):
+		rng = random.Random(4)
+		for alphabet in ("ACGT", "ACGTN", "ACGTRYKMSWBDHVN", "ACGTacgt", "ACDEFGHIKLMNPQ"):
+			for a, b in random_pairs(rng, 60, 40, alphabet):
+				s = rng.choice(SCORES)
+				expected = reference_score(a, b, *s)
+				self.assertEqual(FastNW.score(a, b, *s), expected, (a, b, s))
+				for method in (FastNW.align, FastNW.qalign):
+					alignment = method(a, b, *s)
+					self.assertEqual(alignment[2], expected, (a, b, s))
+					check_alignment(self, alignment, a, b, s)
+
+	#long enough to be partitioned, so the packed strings are read backwards
+	def test_packed_long(self):
+		rng = random.Random(5)
+		for alphabet in ("ACGT", "ACGTN", "ACGTX"):
+			a = random_string(rng, 1500, alphabet)
+			b = mutate(rng, a, 0.2, alphabet)
+			unpacked = FastNW.score(a.replace("A", "Z"), b.replace("A", "Z"), *SCORES[0])
+			self.assertEqual(FastNW.score(a, b, *SCORES[0]), unpacked)
+			alignment = FastNW.align(a, b, *SCORES[0], max_memory=10**6)
+			self.assertEqual(alignment[2], unpacked)
+			check_alignment(self, alignment, a, b, SCORES[0])
+
+if __name__ == "__main__":
+	unittest.main()
@@ -0,0 +1,68 @@
+"""
+FastNW: Fast Needleman-Wunsch
+Copyright (C) 2014 Jonathan Richards
+
+max_memory budgets: alignments that fit stay within them and give the
+same result, and the rest raise MemoryError before doing any work.
+"""
+
+import random
+import unittest
+
+import FastNW
+from support import random_string, mutate, check_alignment
+
+SCORES = (1, -1, -2, -1)
+
+class MemoryTest(unittest.TestCase):
+	def setUp(self):
+		rng = random.Random(6)
+		self.a = random_string(rng, 3000)
+		self.b = mutate(rng, self.a, 0.3)
+
+	def test_align_budgets(self):
+		expected = FastNW.score(self.a, self.b, *SCORES)
+		nodes = None
+		for budget in (10**6, 4*10**6, 64*2**20):
+			estimate = FastNW.memory_estimate(len(self.a), len(self.b), "align", max_memory=budget)
+			self.assertTrue(0 < estimate <= budget)
+			alignment, profile = FastNW.align(self.a, self.b, *SCORES, max_memory=budget, profile=True)
+			self.assertEqual(alignment[2], expected)
+			check_alignment(self, alignment, self.a, self.b, SCORES)
+			self.assertTrue(profile["peak"] <= budget, (budget, profile["peak"]))
+			#bigger budgets mean bigger leaves and fewer partitions
+			if nodes is not None:
+				self.assertTrue(profile["nodes"] <= nodes)
+			nodes = profile["nodes"]
+			self.assertTrue(profile["depth"] < profile["nodes"] or profile["nodes"] == 1)
+
+	def test_too_small(self):
+		for method in ("align", "qalign"):
+			self.assertRaises(MemoryError, FastNW.memory_estimate,
+				len(self.a), len(self.b), method, max_memory=10**5)
+			self.assertRaises(MemoryError, getattr(FastNW, method),
+				self.a, self.b, *SCORES, max_memory=10**5)
+		#the score pass only keeps rows
+		self.assertEqual(FastNW.score(self.a, self.b, *SCORES, max_memory=10**5),
+			FastNW.score(self.a, self.b, *SCORES))
+
+	def test_qalign_budget(self):
+		needed = FastNW.memory_estimate(len(self.a), len(self.b), "qalign")
+		alignment = FastNW.qalign(self.a, self.b, *SCORES, max_memory=needed)
+		self.assertEqual(alignment[2], FastNW.score(self.a, self.b, *SCORES))
+		self.assertRaises(MemoryError, FastNW.qalign, self.a, self.b, *SCORES, max_memory=needed//2)
+
+	#a failed alignment leaves nothing behind for the next call
+	def test_after_failure(self):
+		self.assertRaises(MemoryError, FastNW.align, self.a, self.b, *SCORES, max_memory=10**5)
+		self.assertEqual(FastNW.align(self.a, self.b, *SCORES, min_score=10**6), None)
+		alignment, profile = FastNW.align(self.a, self.b, *SCORES, max_memory=10**6, profile=True)
+		check_alignment(self, alignment, self.a, self.b, SCORES)
+		self.assertTrue(profile["depth"] <= 2*len(self.b).bit_length())
+
+	def test_empty(self):
+		self.assertEqual(FastNW.align("", "", *SCORES, max_memory=10**4)[2], 0)
+		self.assertEqual(FastNW.align("A", "", *SCORES, max_memory=10**4)[2], SCORES[2])
+
+if __name__ == "__main__":
+	unittest.main()
@@ -0,0 +1,43 @@
+"""
+FastNW: Fast Needleman-Wunsch
+Copyright (C) 2014 Jonathan Richards
+
+min_score: pairs scoring below it come back as None from every method
+and engine, and pairs reaching it are unaffected.
+"""
+
+import random
+import unittest
+
+import FastNW
+from support import SCORES, random_pairs, check_alignment
+
+class MinScoreTest(unittest.TestCase):
+	def test_threshold(self):
+		rng = random.Random(7)
+		for a, b in random_pairs(rng, 120, 80):
+			s = rng.choice(SCORES)
+			score = FastNW.score(a, b, *s)
+			for engine in ("dp", "wfa", "band"):
+				#exactly at the threshold passes, one above fails
+				self.assertEqual(FastNW.score(a, b, *s, engine=engine, min_score=score), score)
+				self.assertEqual(FastNW.score(a, b, *s, engine=engine, min_score=score+1), None)
+				alignment = FastNW.align(a, b, *s, engine=engine, min_score=score)
+				self.assertEqual(alignment[2], score)
+				check_alignment(self, alignment, a, b, s)
+				self.assertEqual(FastNW.align(a, b, *s, engine=engine, min_score=score+1), None)
+			self.assertEqual(FastNW.qalign(a, b, *s, min_score=score)[2], score)
+			self.assertEqual(FastNW.qalign(a, b, *s, min_score=score+1), None)
+
+	#a pair far below the threshold is given up on early
+	def test_pruning(self):
+		rng = random.Random(8)
+		a = "".join(rng.choice("ACGT") for i in range(4000))
+		b = "".join(rng.choice("ACGT") for i in range(4000))
+		score, full = FastNW.score(a, b, 1, -1, -2, -1, profile=True)
+		result, pruned = FastNW.score(a, b, 1, -1, -2, -1, min_score=len(a)//2, profile=True)
+		self.assertEqual(result, None)
+		self.assertTrue(pruned["score_cells"] < full["score_cells"]//2)
+
+if __name__ == "__main__":
+	unittest.main()
@@ -0,0 +1,86 @@
+"""
+FastNW: Fast Needleman-Wunsch
+Copyright (C) 2014 Jonathan Richards
+
+msa must return one row per input, in input order, all of one length,
+each giving back its input once the gaps are removed.
+"""
+
+import random
+import unittest
+
+import FastNW
+from support import random_string, mutate
+
+#sum of pairs score of the rows, columns of gaps in both dropped
+def sum_of_pairs(rows, match, mismatch, gap, gap_extend):
+	total = 0
+	for x in range(len(rows)):
+		for y in range(x+1, len(rows)):
+			last = None
+			for c1, c2 in zip(rows[x], rows[y]):
+				if c1 == "-" and c2 == "-":
+					continue
+				if c1 != "-" and c2 != "-":
+					total += match if c1 == c2 else mismatch
+					last = None
+				else:
+					side = "down" if c1 == "-" else "right"
+					total += gap_extend if last == side else gap
+					last = side
+	return total
+
+class MsaTest(unittest.TestCase):
+	def check(self, strings, rows):
+		self.assertEqual(len(rows), len(strings))
+		if not rows:
+			return
+		self.assertEqual(len(set(len(row) for row in rows)), 1)
+		for string, row in zip(strings, rows):
+			self.assertEqual(row.replace("-", ""), string)
+		#no column is all gaps
+		for j in range(len(rows[0])):
+			self.assertTrue(any(row[j] != "-" for row in rows), j)
+
+	def test_small(self):
+		self.assertEqual(FastNW.msa([], 1, -1, -2), [])
+		self.assertEqual(FastNW.msa(["ACGT"], 1, -1, -2), ["ACGT"])
+		self.assertEqual(FastNW.msa(["", ""], 1, -1, -2), ["", ""])
+		self.check(["", "A"], FastNW.msa(["", "A"], 1, -1, -2))
+		self.check(["A", "C", ""], FastNW.msa(["A", "C", ""], 1, -1, -2))
+
+	#two rows are a pairwise alignment, and as good as align's
+	def test_pairs(self):
+		rng = random.Random(16)
+		for i in range(100):
+			a = random_string(rng, rng.randint(0, 60))
+			b = mutate(rng, a, 0.3) if i%2 else random_string(rng, rng.randint(0, 60))
+			for scores in ((1, -1, -2, -2), (2, -3, -5, -2)):
+				rows = FastNW.msa([a, b], *scores)
+				self.check([a, b], rows)
+				self.assertTrue(sum_of_pairs(rows, *scores) >= FastNW.align(a, b, *scores)[2])
+
+	def test_long_pair(self):
+		rng = random.Random(17)
+		a = random_string(rng, 3000)
+		b = mutate(rng, a, 0.2)
+		rows = FastNW.msa([a, b], 2, -3, -5, -2)
+		self.check([a, b], rows)
+		self.assertTrue(sum_of_pairs(rows, 2, -3, -5, -2) >= FastNW.align(a, b, 2, -3, -5, -2)[2])
+
+	#threads only change who joins which groups, not the result
+	def test_family(self):
+		rng = random.Random(18)
+		root = random_string(rng, 300)
+		family = [mutate(rng, root, 0.1) for i in range(40)] + ["", "A"]
+		rows = FastNW.msa(family, 2, -3, -5, -2)
+		self.check(family, rows)
+		for threads in (2, 5):
+			self.assertEqual(FastNW.msa(family, 2, -3, -5, -2, threads=threads), rows)
+
+	def test_errors(self):
+		self.assertRaises(ValueError, FastNW.msa, ["A"], 1, -1, -1, threads=0)
+		self.assertRaises(TypeError, FastNW.msa, ["A", 2], 1, -1, -1)
+
+if __name__ == "__main__":
+	unittest.main()
@@ -0,0 +1,77 @@
+"""
+FastNW: Fast Needleman-Wunsch
+Copyright (C) 2014 Jonathan Richards
+
+pairwise_scores fills the upper triangle by tiles and mirrors it, so
+every cell must match score on its own pair.
+"""
+
+import array
+import random
+import struct
+import sys
+import unittest
+
+import FastNW
+from support import random_string, mutate
+
+SCORES = (2, -3, -5, -2)
+
+class PairwiseTest(unittest.TestCase):
+	def setUp(self):
+		rng = random.Random(5)
+		#enough strings for several tiles and a partial one, with
+		#empty and one-character strings among them
+		base = random_string(rng, 80)
+		self.seqs = ["", "A"] + [mutate(rng, base, rng.random()*0.6) for i in range(35)]
+		self.seqs += [random_string(rng, rng.randint(0, 100)) for i in range(5)]
+
+	def check(self, values):
+		n = len(self.seqs)
+		self.assertEqual(len(values), n*n)
+		for i in range(n):
+			for j in range(n):
+				self.assertEqual(values[i*n+j], values[j*n+i])
+				if j >= i:
+					self.assertEqual(values[i*n+j],
+						FastNW.score(self.seqs[i], self.seqs[j], *SCORES), (i, j))
+
+	def test_new_buffer(self):
+		for threads in (1, 3, 8):
+			out = FastNW.pairwise_scores(self.seqs, *SCORES, threads=threads)
+			self.assertEqual(type(out), bytearray)
+			n = len(self.seqs)
+			self.check(struct.unpack("=%di" % (n*n), bytes(out)))
+
+	def test_engines(self):
+		n = len(self.seqs)
+		for engine in ("wfa", "dp"):
+			out = FastNW.pairwise_scores(self.seqs, *SCORES, threads=4, engine=engine)
+			self.check(struct.unpack("=%di" % (n*n), bytes(out)))
+
+	def test_empty(self):
+		self.assertEqual(len(FastNW.pairwise_scores([], *SCORES)), 0)
+		self.assertEqual(struct.unpack("=i", bytes(FastNW.pairwise_scores(["ACG"], *SCORES))),
+			(3*SCORES[0],))
+
+	#array.array only exports the new buffer interface on Python 3
+	def test_out(self):
+		if sys.version_info < (3,):
+			return
+		n = len(self.seqs)
+		out = array.array("i", [0]*(n*n))
+		self.assertTrue(FastNW.pairwise_scores(self.seqs, *SCORES, threads=4, out=out) is out)
+		self.check(out)
+
+	def test_bad_out(self):
+		if sys.version_info < (3,):
+			return
+		n = len(self.seqs)
+		for out in (bytearray(4*n*n), array.array("f", [0]*(n*n)), array.array("h", [0]*(2*n*n))):
+			self.assertRaises(TypeError, FastNW.pairwise_scores, self.seqs, *SCORES, out=out)
+		self.assertRaises(ValueError, FastNW.pairwise_scores, self.seqs, *SCORES,
+			out=array.array("i", [0]*(n*n-1)))
+		self.assertRaises(BufferError, FastNW.pairwise_scores, self.seqs, *SCORES, out=b"x"*(4*n*n))
+
+if __name__ == "__main__":
+	unittest.main()
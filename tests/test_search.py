@@ -0,0 +1,95 @@
+"""
+FastNW: Fast Needleman-Wunsch
+Copyright (C) 2014 Jonathan Richards
+
+search over files, buffers and broken inputs.
+"""
+
+import errno
+import os
+import random
+import shutil
+import sys
+import tempfile
+import unittest
+
+import FastNW
+from support import random_string, mutate, check_alignment
+
+SCORES = (1, -1, -2, -1)
+
+class SearchTest(unittest.TestCase):
+	def setUp(self):
+		rng = random.Random(4)
+		self.query = random_string(rng, 200)
+		self.records = []
+		for i in range(500):
+			if rng.random() < 0.5:
+				seq = mutate(rng, self.query, rng.random()*0.8)
+			else:
+				seq = random_string(rng, rng.randint(0, 300))
+			self.records.append(("rec%d" % i, seq))
+		self.fasta = "".join(">%s description\n%s\n%s\n" % (name, seq[:60], seq[60:])
+			for name, seq in self.records).encode("ascii")
+		self.directory = tempfile.mkdtemp()
+		self.path = os.path.join(self.directory, "db.fa")
+		with open(self.path, "wb") as f:
+			f.write(self.fasta)
+
+	def tearDown(self):
+		shutil.rmtree(self.directory)
+
+	#checks hits against scoring every record, ties going to the first
+	def check(self, hits, k):
+		best = sorted((-FastNW.score(self.query, seq, *SCORES), i)
+			for i, (name, seq) in enumerate(self.records))[:k]
+		self.assertEqual([hit[0] for hit in hits], [self.records[i][0] for score, i in best])
+		for hit, (score, i) in zip(hits, best):
+			self.assertEqual(hit[3], -score)
+			check_alignment(self, hit[1:], self.query, self.records[i][1], SCORES)
+
+	def test_path(self):
+		for threads in (1, 4):
+			self.check(FastNW.search(self.query, self.path, 10, *SCORES, threads=threads), 10)
+
+	def test_path_like(self):
+		if sys.version_info < (3, 6):
+			return
+		import pathlib
+		self.check(FastNW.search(self.query, pathlib.Path(self.path), 5, *SCORES), 5)
+
+	def test_buffer(self):
+		self.check(FastNW.search(self.query, bytearray(self.fasta), 10, *SCORES, threads=2), 10)
+		self.check(FastNW.search(self.query, memoryview(self.fasta), 3, *SCORES), 3)
+
+	#bytes are a buffer on Python 3, where str is the file name type
+	def test_bytes(self):
+		if sys.version_info < (3,):
+			return
+		self.check(FastNW.search(self.query, self.fasta, 10, *SCORES), 10)
+
+	def test_engine(self):
+		self.check(FastNW.search(self.query, self.path, 10, *SCORES, engine="wfa"), 10)
+
+	def test_missing_file(self):
+		try:
+			FastNW.search(self.query, os.path.join(self.directory, "missing.fa"), 10, *SCORES)
+		except EnvironmentError as e:
+			self.assertEqual(e.errno, errno.ENOENT)
+		else:
+			self.fail("no error for a missing file")
+
+	#a directory opens but cannot be read
+	def test_read_error(self):
+		try:
+			FastNW.search(self.query, self.directory, 10, *SCORES)
+		except EnvironmentError as e:
+			self.assertEqual(e.errno, errno.EISDIR)
+		else:
+			self.fail("no error for a directory")
+
+	def test_empty(self):
+		self.assertEqual(FastNW.search(self.query, bytearray(), 10, *SCORES), [])
+
+if __name__ == "__main__":
+	unittest.main()
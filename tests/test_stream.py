@@ -0,0 +1,51 @@
+"""
+FastNW: Fast Needleman-Wunsch
+Copyright (C) 2014 Jonathan Richards
+
+Stream must score every prefix appended so far as score would.
+"""
+
+import random
+import unittest
+
+import FastNW
+from support import SCORES, random_string, mutate, reference_score
+
+class StreamTest(unittest.TestCase):
+	def test_chunks(self):
+		rng = random.Random(9)
+		for i in range(100):
+			alphabet = rng.choice(["ACGT", "ACGTN", "xyzACGT"])
+			reference = random_string(rng, rng.randint(0, 50), alphabet)
+			query = mutate(rng, reference, rng.random()*0.5, alphabet) \
+				if rng.random() < 0.7 else random_string(rng, rng.randint(0, 60), alphabet)
+			s = rng.choice(SCORES)
+			stream = FastNW.Stream(reference, *s)
+			self.assertEqual(stream.score(), reference_score(reference, "", *s))
+			self.assertEqual(len(stream), 0)
+			appended = 0
+			while appended < len(query):
+				end = min(len(query), appended+rng.randint(0, 7))
+				result = stream.append(query[appended:end])
+				appended = end
+				self.assertEqual(result, reference_score(reference, query[:appended], *s))
+				self.assertEqual(stream.score(), result)
+				self.assertEqual(len(stream), appended)
+
+	#long enough that the row kept between appends matters
+	def test_long(self):
+		rng = random.Random(10)
+		reference = random_string(rng, 2000)
+		query = mutate(rng, reference, 0.1)
+		stream = FastNW.Stream(reference, 2, -3, -5, -2)
+		for start in range(0, len(query), 333):
+			stream.append(query[start:start+333])
+		self.assertEqual(stream.score(), FastNW.score(reference, query, 2, -3, -5, -2))
+
+	def test_empty_reference(self):
+		stream = FastNW.Stream("", 1, -1, -2, -1)
+		self.assertEqual(stream.append("ACG"), -4)
+		self.assertEqual(stream.append(""), -4)
+
+if __name__ == "__main__":
+	unittest.main()